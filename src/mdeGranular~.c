@@ -43,21 +43,121 @@
 #include <time.h>
 #include <float.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
 #include "mdeGranular~.h"
 
+/* seeking and telling in sound files bigger than a (Windows) long */
+#ifdef _WIN32
+#define mdeSeek(fp, offset, whence) _fseeki64(fp, offset, whence)
+#define mdeTell(fp) _ftelli64(fp)
+#else
+#define mdeSeek(fp, offset, whence) fseeko(fp, (off_t)(offset), whence)
+#define mdeTell(fp) ((mdelong)ftello(fp))
+#endif
+
+/* everything the engine posts goes via mdeGranularLog (see there) */
+#define post(...) mdeGranularLog(0, __VA_ARGS__)
+
+#ifndef M_PI
+#define M_PI (mdefloat)3.14159265358979323846264338327
+#endif
+#ifndef TWO_PI
+#define TWO_PI ((mdefloat)2.0 * M_PI)
+#endif
+
+/*****************************************************************************/
+
+/** If MDEPROFILE is #defined (via the compiler) then the time spent in each
+ *  stage of mdeGranularGo (t_profstage) is totted up, in CPU cycles where we
+ *  can read the time stamp counter, nanoseconds otherwise, and printed by the
+ *  profile message. Otherwise these macros are nothing at all. They're used
+ *  without semicolons: PROF_VAR amongst the declarations, the others as
+ *  statements. */
+
+#ifdef MDEPROFILE
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define mdeTicks() ((unsigned long long)__rdtsc())
+#define PROFUNITS "cycles"
+#else
+#define mdeTicks() ((unsigned long long)(mdeGranularSeconds() * 1e9))
+#define PROFUNITS "ns"
+#endif
+#define PROF_VAR(t) unsigned long long t = 0;
+#define PROF_START(t) t = mdeTicks();
+#define PROF_STOP(g, stage, t) { (g)->profTicks[stage] += mdeTicks() - (t); \
+    (g)->profCounts[stage]++; }
+static const char* ProfStageNames[NUMPROFSTAGES] =
+  { "whole tick", "grain amps", "silencing", "grain init", "sample reads",
+    "ramps", "status ramp" };
+#else
+#define PROF_VAR(t)
+#define PROF_START(t)
+#define PROF_STOP(g, stage, t)
+#endif
+
 /*****************************************************************************/
 
-/** If DEBUG is #defined then details of each grain and its samples will be
- *  written to a separate file in the temp directory.  N.B. These will only be
- *  meaningful however if the number of voices is 1.
+/** If DEBUG is #defined then some sanity checks are posted whilst running.
+ *  For the details of each grain, use the trace message instead (see
+ *  mdeGranularTraceStart), which doesn't disturb the audio thread.
 
 #define DEBUG 1
  * */
 
-#ifdef DEBUG
-static FILE* DebugFP = NULL;
+#ifdef _WIN32
+typedef HANDLE mdeThread;
+#else
+typedef pthread_t mdeThread;
 #endif
 
+#ifdef _MSC_VER
+#define MDETHREADLOCAL __declspec(thread)
+#else
+#define MDETHREADLOCAL _Thread_local
+#endif
+
+/** Whether messages posted in this thread have to wait for the main thread
+ *  (see mdeGranularLog): > 0 in the audio thread whilst we're processing, and
+ *  always in our own background threads. */
+static MDETHREADLOCAL int LogDefer = 0;
+
+/** How many instances have been made in this process: mixed into each one's
+ *  random seed, as several made in the same clock() tick (e.g. by loading a
+ *  patch) would otherwise granulate in lockstep. */
+static atomic_uint Instances = 0;
+
+/** All the shared live rings (see the liveshare message) in this process. */
+static mdeGranularLiveShare* LiveShares = NULL;
+
+/** A quarter sine for equal-power panning: the gain for a grain -frac- of the
+ *  way from one channel to the next is PanTable[PANTABLESIZE * frac] for the
+ *  next channel and PanTable[PANTABLESIZE * (1 - frac)] for this one. */
+static mdefloat PanTable[PANTABLESIZE + 1];
+
+/** The grain budget shared by all the instances in this process (see
+ *  GrainBudget): how many grains a second may start (0 = no limit), and a
+ *  bucket of grains (in thousandths) that's topped up at that rate and drawn
+ *  on by mdeGranularGrainInit. They're atomic because Max may run instances
+ *  in several audio threads. */
+static atomic_long BudgetRate = 0;
+static atomic_long BudgetMilliGrains = 0;
+static atomic_llong BudgetStampNS = 0;
+
 /*****************************************************************************/
 
 /** The mdeGranular object's set methods: */
@@ -98,11 +198,18 @@ void mdeGranularSetMaxVoices(mdeGranular* g, mdefloat maxVoices)
   int mv = (int)maxVoices;
 
   if (mv > 0) {
-    g->maxVoices = mv;
-    if (g->grains)
+    if (g->grains) {
+      mdeGranularStreamUnpinAll(g);
       mdeFree(g->grains);
+    }
+    g->maxVoices = mv;
     g->grains = mdeCalloc(mv, sizeof(mdeGranularGrain), 
                           "mdeGranularSetMaxVoices", g->warnings);
+    if (g->pool)
+      mdeFree(g->pool);
+    g->pool = mdeCalloc(mv, sizeof(int), "mdeGranularSetMaxVoices",
+                        g->warnings);
+    mdeGranularResetPool(g);
     if (mv < g->activeVoices)
       g->activeVoices = mv;
     mdeGranularSetActiveVoices(g, (mdefloat)g->activeVoices);
@@ -135,7 +242,7 @@ void mdeGranularSetRampType(mdeGranular* g, char* type)
 void mdeGranularSetRampLenMS(mdeGranular* g, mdefloat rampLenMS)
 {
   mdefloat halfgrainlength = g->grainLengthMS * (mdefloat)0.5;
-  mdefloat* oldramp = g->rampUp;
+  mdefloat* oldramp = NULL;
   /* post("\nSETRAMPLENMS: %fms (srate=%f)", rampLenMS, g->samplingRate); 
      return;  */
 
@@ -172,11 +279,20 @@ void mdeGranularSetRampLenMS(mdeGranular* g, mdefloat rampLenMS)
    * simply a pointer to the middle */
   /* todo: don't malloc here if we're using the ramp: in fact only allow ramps
      to be changed when object is off */ 
-  g->rampUp = mdeCalloc(g->rampLenSamples * 2, sizeof(mdefloat),
-                        "mdeGranularSetRampLenMS", g->warnings);
+  /* a shorter ramp fits in what we have: keeping it means that recalling a
+   * scene never needs more (see mdeGranularRecallNow) */
+  if (g->rampLenSamples * 2 > g->rampCapacity) {
+    oldramp = g->rampUp;
+    g->rampUp = mdeCalloc(g->rampLenSamples * 2, sizeof(mdefloat),
+                          "mdeGranularSetRampLenMS", g->warnings);
+    g->rampCapacity = g->rampUp ? g->rampLenSamples * 2 : 0;
+  }
   g->rampDown = g->rampUp + g->rampLenSamples;
   /* remember: the 2.5 is CLM's mysterious 'beta' arg... */
   makeWindow(g->rampType, g->rampLenSamples * 2, 2.5, g->rampUp);
+  /* the start/stop ramp mustn't carry on in the old (maybe freed) one */
+  if (mdeSmootherMoving(&g->statusAmp))
+    mdeGranularStatusTarget(g, g->statusAmp.target);
   /* reinitialize the grains now we have a different ramp length--this will
    * only happen if we have samples already so should be ignored if we're at
    * the init stage */
@@ -203,6 +319,16 @@ void mdeGranularSetTranspositionOffsetST(mdeGranular* g, mdefloat f)
 
 void mdeGranularSetLiveBufferSize(mdeGranular* g, mdefloat sizeMS)
 {
+  /* the shared ring's length was fixed by whoever created it and others are
+   * using it, so it's not ours to resize: leave the liveshare first */
+  if (g->liveShare) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              Can't change buffer size whilst sharing the live ");
+      post("              input (liveshare %s). Ignoring.", g->liveShare->name);
+    }
+    return;
+  }
   /* 7/3/06: only malloc if we're off and therefore not accessing previously
      allocated memory! */
   if (g->status == OFF) {
@@ -216,13 +342,13 @@ void mdeGranularSetLiveBufferSize(mdeGranular* g, mdefloat sizeMS)
            g->BufferSamplesMS);
     }
     else {
-      int numSamples = ms2samples(g->samplingRate, sizeMS);
+      mdelong numSamples = ms2samples(g->samplingRate, sizeMS);
       mdefloat* old = g->theSamples;
       g->theSamples = mdeCalloc(numSamples, sizeof(mdefloat),
                                  "mdeGranularSetLiveBufferSize", g->warnings);
       g->nAllocatedBufferSamples = numSamples;
       g->AllocatedBufferMS = sizeMS;
-      if (g->live)
+      if (g->live && !g->liveShare)
         g->samples = g->theSamples;
       if (old)
         mdeFree(old);
@@ -279,9 +405,10 @@ mdefloat maxFloat(mdefloat* array, int size)
 void mdeGranularSetGrainLengthMS(mdeGranular* g, mdefloat f)
 {
   mdefloat sr = g->samplingRate;
-  int lenSamples = ms2samples(sr, f);
+  mdelong lenSamples = ms2samples(sr, f);
   mdefloat highestSRC = maxFloat(g->srcs, g->numTranspositions);
-  int sampsNeeded = lenSamples * highestSRC * g->transpositionOffset;
+  mdelong sampsNeeded = (mdelong)((double)lenSamples * highestSRC *
+                                  g->transpositionOffset);
 
   if (f <= (2 * g->rampLenMS)) {
     if (g->warnings) {
@@ -307,12 +434,12 @@ void mdeGranularSetGrainLengthMS(mdeGranular* g, mdefloat f)
       post("              Buffer should generally be twice the grain length.");
       post("              (Use the 'set msXXX' message to set the internal ");
       post("              buffer size in millisecs.)");
-      post("              (%d samples (%fms) in buffer, ",
-           g->nBufferSamples, samples2ms(sr, g->nBufferSamples));
-      post("              %d (%fms) samples in grain, ",
-           lenSamples, samples2ms(sr, lenSamples));
-      post("              %d (%fms) samples needed for highest transposition)",
-           sampsNeeded, msneeded);
+      post("              (%lld samples (%fms) in buffer, ",
+           (long long)g->nBufferSamples, samples2ms(sr, g->nBufferSamples));
+      post("              %lld (%fms) samples in grain, ",
+           (long long)lenSamples, samples2ms(sr, lenSamples));
+      post("              %lld (%fms) samples needed for highest "
+           "transposition)", (long long)sampsNeeded, msneeded);
       post("              Min buffer size should be %f",
            msneeded * 2.0f);
       post("              Ignoring.");
@@ -356,9 +483,9 @@ void mdeGranularSmoothMode(mdeGranular* g)
 {
   int i;
   int av = g->activeVoices;
-  int len = g->grainLength;
-  int delay = 0;
-  int dinc = len / av;
+  mdelong len = g->grainLength;
+  mdelong delay = 0;
+  mdelong dinc = len / av;
 
   /* stop all grains now--might cause click! */
   mdeGranularForceGrainReinit(g);
@@ -484,6 +611,291 @@ void mdeGranularPortionWidth(mdeGranular* g, mdefloat width)
 
 /*****************************************************************************/
 
+/** With a multichannel source, choose which channel grains read from: -mode-
+ *  is "fixed" (always -channel-, counting from 1), "output" (the same channel
+ *  as the grain is output on, wrapping if there are more outputs than source
+ *  channels) or "random". */
+
+void mdeGranularSetSourceChannel(mdeGranular* g, char* mode, int channel)
+{
+  if (!strcmp(mode, "fixed")) {
+    if (channel < 1) {
+      if (g->warnings) {
+        post("mdeGranular~:");
+        post("              SourceChannel fixed needs a channel number ");
+        post("              (from 1). Using 1.");
+      }
+      channel = 1;
+    }
+    g->sourceChannelMode = SRC_FIXED;
+    g->sourceChannel = channel - 1;
+  }
+  else if (!strcmp(mode, "output"))
+    g->sourceChannelMode = SRC_OUTPUT;
+  else if (!strcmp(mode, "random"))
+    g->sourceChannelMode = SRC_RANDOM;
+  else if (g->warnings) {
+    post("mdeGranular~:");
+    post("              SourceChannel should be fixed, output or random, ");
+    post("              not %s. Ignoring.", mode);
+  }
+}
+
+/*****************************************************************************/
+
+/** -mode- is "discrete" (each grain on a single random channel, the default),
+ *  "line" (grains panned between adjacent channels, the first and last
+ *  channels being the extremes), "ring" (as line but the last channel is
+ *  adjacent to the first, e.g. for a circle of speakers) or "ambisonic" (the
+ *  outputs are Ambisonic channels in ACN order with SN3D normalisation, as
+ *  many orders as there are channels for, up to MAXAMBIORDER; see
+ *  AmbiSpread). */
+
+void mdeGranularSetPanMode(mdeGranular* g, char* mode)
+{
+  int order;
+
+  if (!strcmp(mode, "ambisonic")) {
+    order = (int)sqrt((double)g->numChannels) - 1;
+    if (order > MAXAMBIORDER)
+      order = MAXAMBIORDER;
+    if (order < 1) {
+      if (g->warnings) {
+        post("mdeGranular~:");
+        post("              Ambisonic output needs at least 4 channels ");
+        post("              (first order). Ignoring.");
+      }
+      return;
+    }
+    if ((order + 1) * (order + 1) != g->numChannels && g->warnings) {
+      post("mdeGranular~:");
+      post("              Encoding order %d Ambisonics: only the first %d ",
+           order, (order + 1) * (order + 1));
+      post("              of the %d outputs will be used.", g->numChannels);
+    }
+    g->ambiOrder = order;
+    g->panMode = PAN_AMBISONIC;
+  }
+  else if (!strcmp(mode, "discrete"))
+    g->panMode = PAN_DISCRETE;
+  else if (!strcmp(mode, "line"))
+    g->panMode = PAN_LINE;
+  else if (!strcmp(mode, "ring"))
+    g->panMode = PAN_RING;
+  else if (g->warnings) {
+    post("mdeGranular~:");
+    post("              PanMode should be discrete, line, ring or ");
+    post("              ambisonic, ");
+    post("              not %s. Ignoring.", mode);
+  }
+}
+
+/*****************************************************************************/
+
+/** When panning, grains are placed at random within -width- channels centred
+ *  on channel -centre- (counting from 1; fractions are between channels).
+ *  E.g. PanSpread 2.5 1 keeps grains between channels 2 and 3, whereas 
+ *  PanSpread 2.5 0 puts them all exactly between those. */
+
+void mdeGranularSetPanSpread(mdeGranular* g, mdefloat centre, mdefloat width)
+{
+  if (width < 0.0) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              PanSpread width should be >= 0, not %f. ", width);
+      post("              Ignoring.");
+    }
+    return;
+  }
+  g->panCentre = centre - (mdefloat)1.0;
+  g->panWidth = width;
+}
+
+/*****************************************************************************/
+
+/** Where Ambisonic grains go: random directions up to half of each width
+ *  either side of -azimuth- (anticlockwise from the front) and -elevation-
+ *  (up from the horizontal), all in degrees. E.g. AmbiSpread 0 360 45 90 is
+ *  anywhere in the upper hemisphere. */
+
+void mdeGranularSetAmbiSpread(mdeGranular* g, mdefloat azimuth,
+                              mdefloat azimuthWidth, mdefloat elevation,
+                              mdefloat elevationWidth)
+{
+  mdefloat d2r = M_PI / (mdefloat)180.0;
+
+  if (azimuthWidth < 0.0 || elevationWidth < 0.0) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              AmbiSpread widths should be >= 0. Ignoring.");
+    }
+    return;
+  }
+  g->ambiAzimuth = azimuth * d2r;
+  g->ambiAzimuthWidth = azimuthWidth * d2r;
+  g->ambiElevation = elevation * d2r;
+  g->ambiElevationWidth = elevationWidth * d2r;
+}
+
+/*****************************************************************************/
+
+/** Called by PD/Max at the top of the perform routine, before the outputs are
+ *  touched: take our own copy of each connected parameter signal as the host
+ *  may have given us the same memory for an output that we're about to
+ *  clear. */
+
+void mdeGranularCopySignals(mdeGranular* g)
+{
+  int p;
+  long n = g->nOutputSamples;
+
+  for (p = 0; p < NUMSIGPARAMS; ++p)
+    if (g->sigHost[p] && g->sigCopies) {
+      g->sigIns[p] = g->sigCopies + p * n;
+      memcpy(g->sigIns[p], g->sigHost[p], n * sizeof(mdefloat));
+    }
+    else g->sigIns[p] = NULL;
+}
+
+/*****************************************************************************/
+
+/** Called before a grain is initialised during mdeGranularGo: update any
+ *  parameters whose signal inlet has changed since we last looked, reading the
+ *  value at the sample the grain starts on. No messages are involved. */
+
+void mdeGranularReadSignals(mdeGranular* g)
+{
+  int p;
+  mdefloat v;
+
+  if (g->sigIndex < 0)
+    return;
+  for (p = 0; p < NUMSIGPARAMS; ++p)
+    /* GrainAmp is done per sample in mdeGranularSignalGrainAmps */
+    if (g->sigIns[p] && p != SIG_GRAINAMP) {
+      v = g->sigIns[p][g->sigIndex];
+      if (v != g->sigLast[p]) {
+        g->sigLast[p] = v;
+        mdeGranularSignalParam(g, (t_sigparam)p, v);
+      }
+    }
+}
+
+/*****************************************************************************/
+
+/** Like the set methods but for values coming from a signal: out of range
+ *  values are clamped or ignored without posting anything as we're in the
+ *  middle of the DSP tick. */
+
+void mdeGranularSignalParam(mdeGranular* g, t_sigparam p, mdefloat v)
+{
+  mdefloat half;
+  mdefloat buf_ms = g->BufferSamplesMS;
+  mdelong len;
+
+  if (v < (mdefloat)0.0 && p != SIG_TRANSPOSITION)
+    v = (mdefloat)0.0;
+  switch (p) {
+  case SIG_TRANSPOSITION:
+    mdeGranularSetTranspositionOffsetST(g, v);
+    break;
+  case SIG_GRAINLENGTH:
+    len = ms2samples(g->samplingRate, v);
+    if (v > 2 * g->rampLenMS &&
+        (!g->nBufferSamples ||
+         (double)len * maxFloat(g->srcs, g->numTranspositions)
+         * g->transpositionOffset < g->nBufferSamples)) {
+      g->grainLengthMS = v;
+      g->grainLength = len;
+    }
+    break;
+  case SIG_DEVIATION:
+    g->grainLengthDeviation = v > (mdefloat)100.0 ? (mdefloat)100.0 : v;
+    break;
+  case SIG_START:
+    mdeGranularSetWindow(g, v, g->samplesEndMS);
+    break;
+  case SIG_END:
+    mdeGranularSetWindow(g, g->samplesStartMS, v);
+    break;
+  case SIG_DENSITY:
+    g->density = v > (mdefloat)100.0 ? (mdefloat)100.0 : v;
+    break;
+  case SIG_PORTION:
+    /* as mdeGranularPortion, using the last width given */
+    if (v > (mdefloat)100.0)
+      v = (mdefloat)100.0;
+    g->portionPosition = v;
+    half = buf_ms * g->portionWidth * (mdefloat)0.005;
+    v = buf_ms * v * (mdefloat)0.01;
+    if (v - half < (mdefloat)0.0)
+      v = half;
+    if (v + half > buf_ms)
+      v = buf_ms - half;
+    mdeGranularSetWindow(g, v - half, v + half);
+    break;
+  default:
+    break;
+  }
+}
+
+/*****************************************************************************/
+
+/** Set the start and end points without any of the warnings of
+ *  mdeGranularSetSamplesStartMS/EndMS, and without madvise()ing a mapped
+ *  file (that's a system call) though a streamed file's reader thread is told
+ *  (that's cheap). */
+
+void mdeGranularSetWindow(mdeGranular* g, mdefloat startMS, mdefloat endMS)
+{
+  mdelong last = g->nBufferSamples - 1;
+  mdelong start = ms2samples(g->samplingRate, startMS);
+  mdelong end = ms2samples(g->samplingRate, endMS);
+
+  if (last < 0)
+    return;
+  start = start < 0 ? 0 : (start > last ? last : start);
+  end = end < 0 ? 0 : (end > last ? last : end);
+  g->samplesStart = start;
+  g->samplesStartMS = samples2ms(g->samplingRate, start);
+  g->samplesEnd = end;
+  g->samplesEndMS = samples2ms(g->samplingRate, end);
+  if (g->stream)
+    mdeGranularAdviseMapping(g);
+}
+
+/*****************************************************************************/
+
+/** If GrainAmp has a signal that's changed, copy it into grainAmps (i.e. it's
+ *  applied per sample) and return 1, otherwise leave grainAmps to the usual
+ *  smoothing and return 0. */
+
+int mdeGranularSignalGrainAmps(mdeGranular* g)
+{
+  mdefloat* sig = g->sigIns[SIG_GRAINAMP];
+  mdefloat last = g->sigLast[SIG_GRAINAMP];
+  mdefloat v;
+  long i;
+  long n = g->nOutputSamples;
+
+  if (!sig)
+    return 0;
+  for (i = 0; i < n && sig[i] == last; ++i)
+    ;
+  if (i == n)
+    return 0;
+  for (i = 0; i < n; ++i) {
+    v = sig[i];
+    g->grainAmps[i] = v < (mdefloat)0.0 ? (mdefloat)0.0 : v;
+  }
+  /* carry on from here if the signal stops changing */
+  g->sigLast[SIG_GRAINAMP] = sig[n - 1];
+  mdeSmootherJump(&g->grainAmp, g->grainAmps[n - 1]);
+  return 1;
+}
+
+/*****************************************************************************/
+
 void mdeGranularSetSamplesStartMS(mdeGranular* g, mdefloat f)
 {
   g->samplesStartMS = f;
@@ -506,6 +918,7 @@ void mdeGranularSetSamplesStartMS(mdeGranular* g, mdefloat f)
       post("              Setting to %fms", g->samplesStartMS);
     }
   }
+  mdeGranularAdviseMapping(g);
 }
 
 /*****************************************************************************/
@@ -539,6 +952,7 @@ void mdeGranularSetSamplesEndMS(mdeGranular* g, mdefloat f)
       post("              Setting to %fms", g->samplesEndMS);
     }
   }
+  mdeGranularAdviseMapping(g);
 }
 
 /*****************************************************************************/
@@ -591,6 +1005,8 @@ void mdeGranularSetActiveChannels(mdeGranular* g, long l)
     g->activeChannels = 1;
   }
   else g->activeChannels = l;
+  mdeGranularAliasBuild(&g->channelAlias, g->channelWeights,
+                        g->numChannelWeights, g->activeChannels);
 }
 
 /*****************************************************************************/
@@ -609,13 +1025,44 @@ void mdeGranularSetGrainAmp(mdeGranular* g, mdefloat f)
 
   /* post("grainAmp %f", f); */
   if (g && f >= (mdefloat)0.0 && f <= (mdefloat)100.0) {
-    if (mdeGranularAtTargetGrainAmp(g) &&
-        (fabs(g->targetGrainAmp - f) > min)) {
-      g->lastGrainAmp = g->grainAmp;
-      g->targetGrainAmp = f < min ? (mdefloat)0.0 : f;
-      g->grainAmpInc = (f - g->lastGrainAmp) / (g->nOutputSamples - 1);
+    if (f < min)
+      f = (mdefloat)0.0;
+    /* a new value takes over from wherever we've got to */
+    if (f != g->grainAmp.target)
+      mdeSmootherSetTarget(&g->grainAmp, f, g->grainAmpSmoothMS > 0.0 ?
+                           ms2samples(g->samplingRate, g->grainAmpSmoothMS) :
+                           g->nOutputSamples,
+                           g->grainAmpShape, NULL);
+  }
+}
+
+/*****************************************************************************/
+
+/** How new grain amps arrive: over -ms- millisecs (0 = one tick, the
+ *  default) in a straight line or exponentially (-shape- linear or
+ *  exponential). */
+
+void mdeGranularSetGrainAmpSmoothing(mdeGranular* g, mdefloat ms,
+                                     char* shape)
+{
+  if (ms < 0.0) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              GrainAmpSmoothing should be >= 0, not %f. "
+           "Ignoring.", ms);
     }
-    /* no else clause so new values rejected unless we reached the target */
+    return;
+  }
+  g->grainAmpSmoothMS = ms;
+  if (!shape || !*shape || !strcmp(shape, "linear"))
+    g->grainAmpShape = SMOOTH_LINEAR;
+  else if (!strcmp(shape, "exponential"))
+    g->grainAmpShape = SMOOTH_EXPONENTIAL;
+  else if (g->warnings) {
+    post("mdeGranular~:");
+    post("              GrainAmpSmoothing: unknown shape %s (linear or ",
+         shape);
+    post("              exponential). Keeping the last.");
   }
 }
 
@@ -636,21 +1083,75 @@ void mdeGranularSetTranspositions(mdeGranular* g, int num, mdefloat* list)
     num = 1;
     list = noTransp;
   }
-  g->numTranspositions = num;
-  for (i = 0; i < num && i < MAXTRANSPOSITIONS; ++i) {
+  if (num > MAXTRANSPOSITIONS)
+    num = MAXTRANSPOSITIONS;
+  /* the weights were a morph's, for its own transpositions, not the user's */
+  if (g->morphedTranspositions) {
+    g->numTranspositionWeights = 0;
+    g->morphedTranspositions = 0;
+  }
+  for (i = 0; i < num; ++i) {
     st = *list++;
     g->transpositions[i] = st;
     g->srcs[i] = st2src(st, g->octaveSize, g->octaveDivisions);
   }
+  g->numTranspositions = num;
+  mdeGranularAliasBuild(&g->transpositionAlias, g->transpositionWeights,
+                        g->numTranspositionWeights, num);
 } 
 
 /*****************************************************************************/
 
+/** How likely each of the transpositions is to be chosen for a grain,
+ *  relative to the others, in the order they were given: 1 2 makes the second
+ *  twice as likely as the first. Transpositions without a weight have 1, so
+ *  no weights at all (the default) means all are equally likely. Negative
+ *  weights are taken as 0. */
+
+void mdeGranularSetTranspositionWeights(mdeGranular* g, int num,
+                                        mdefloat* list)
+{
+  int i;
+
+  if (num > MAXTRANSPOSITIONS)
+    num = MAXTRANSPOSITIONS;
+  for (i = 0; i < num; ++i)
+    g->transpositionWeights[i] = list[i];
+  g->numTranspositionWeights = num;
+  g->morphedTranspositions = 0;
+  mdeGranularAliasBuild(&g->transpositionAlias, g->transpositionWeights,
+                        num, g->numTranspositions);
+}
+
+/*****************************************************************************/
+
+/** As mdeGranularSetTranspositionWeights but for the output channels grains
+ *  are put on (in PanMode discrete; the others place grains by position). */
+
+void mdeGranularSetChannelWeights(mdeGranular* g, int num, mdefloat* list)
+{
+  int i;
+
+  if (!g->channelWeights)
+    return;
+  if (num > g->numChannels)
+    num = g->numChannels;
+  for (i = 0; i < num; ++i)
+    g->channelWeights[i] = list[i];
+  g->numChannelWeights = num;
+  mdeGranularAliasBuild(&g->channelAlias, g->channelWeights, num,
+                        g->activeChannels);
+}
+
+/*****************************************************************************/
+
 void mdeGranularOn(mdeGranular* g)
 {
+  mdeGranularWake(g);
   if (g->status != STARTING && g->status != ON) {
     mdeGranularClearTheSamples(g);
     g->status = STARTING;
+    mdeGranularStatusTarget(g, (mdefloat)1.0);
   }
 }
 
@@ -658,7 +1159,9 @@ void mdeGranularOn(mdeGranular* g)
 
 void mdeGranularClearTheSamples(mdeGranular* g)
 {
-  if (g->live && g->theSamples) {
+  /* a shared ring is being written continuously by another instance so leave
+   * it alone */
+  if (g->live && g->theSamples && !g->liveShare) {
     silence(g->theSamples, g->nAllocatedBufferSamples);
     g->liveIndex = 0;
   }
@@ -669,14 +1172,14 @@ void mdeGranularClearTheSamples(mdeGranular* g)
 void mdeGranularForceGrainReinit(mdeGranular* g)
 {
   int i;
-  mdeGranularGrain gg;
+  mdeGranularGrain* gg;
 
   if (g->grains) {
     for (i = 0; i < g->maxVoices; ++i) {
-      gg = g->grains[i];
+      gg = &g->grains[i];
       /* doing this will cause mdeGranularGrainExhaused() to return true
        * so the grains will be reinitialized */ 
-      gg.icurrent = gg.length + 1;
+      gg->icurrent = gg->length + 1;
     }
   }
 }
@@ -685,8 +1188,10 @@ void mdeGranularForceGrainReinit(mdeGranular* g)
 
 void mdeGranularOff(mdeGranular* g)
 {
-  if (g->status != STOPPING && g->status != OFF)
+  if (g->status != STOPPING && g->status != OFF) {
     g->status = STOPPING;
+    mdeGranularStatusTarget(g, (mdefloat)0.0);
+  }
 }
 
 /*****************************************************************************/
@@ -708,22 +1213,22 @@ int mdeGranularIsOff(mdeGranular* g)
 void mdeGranularGrainPrint(mdeGranularGrain* gg)
 {
   post("mdeGranular~ grain info:");
-  post("length %ld", gg->length);
+  post("length %lld", (long long)gg->length);
   post("start %f", gg->start);
   post("end %f", gg->end);
-  post("endRampUp %ld", gg->endRampUp);
-  post("startRampDown %ld", gg->startRampDown);
-  post("current %f", gg->current);
-  post("icurrent %ld", gg->icurrent);
+  post("endRampUp %lld", (long long)gg->endRampUp);
+  post("startRampDown %lld", (long long)gg->startRampDown);
+  post("current %f", (double)gg->base + (double)gg->phase / PHASEONE);
+  post("icurrent %lld", (long long)gg->icurrent);
   post("rampi %ld", gg->rampi);
   post("inc %f", gg->inc);
   post("backwards %d", gg->backwards);
   post("status %d", gg->status);
   post("activeStatus %d", gg->activeStatus);
   post("channel %d", gg->channel);
-  post("doDelay %d", gg->doDelay);
-  post("firstDelay %ld", gg->firstDelay);
-  post("firstDelayCounter %ld", gg->firstDelayCounter);
+  post("doDelay %lld", (long long)gg->doDelay);
+  post("firstDelay %lld", (long long)gg->firstDelay);
+  post("firstDelayCounter %lld", (long long)gg->firstDelayCounter);
 }
 
 /*****************************************************************************/
@@ -755,31 +1260,58 @@ void mdeGranularPrint(mdeGranular* g)
   post("transpositionOffset %f", g->transpositionOffset);
   post("numTranspositions %d", g->numTranspositions);
   post("grainLengthMS %f", g->grainLengthMS);
-  post("grainLength %d", g->grainLength);
+  post("grainLength %lld", (long long)g->grainLength);
   post("grainLengthDeviation %f", g->grainLengthDeviation);
   post("numChannels %d", g->numChannels);
   post("activeChannels %d", g->activeChannels);
   post("nOutputSamples %ld", g->nOutputSamples);
   post("BufferName: %s", g->BufferName);
-  post("nBufferSamples %ld", g->nBufferSamples);
+  post("nBufferSamples %lld", (long long)g->nBufferSamples);
   post("BufferSamplesMS %f", g->BufferSamplesMS);
-  post("nAllocatedBufferSamples %ld", g->nAllocatedBufferSamples);
+  post("nAllocatedBufferSamples %lld", (long long)g->nAllocatedBufferSamples);
   post("AllocatedBufferMS %f", g->AllocatedBufferMS);
   post("samplesStartMS %f", g->samplesStartMS);
-  post("samplesStart %ld", g->samplesStart);
+  post("samplesStart %lld", (long long)g->samplesStart);
   post("samplesEndMS %f", g->samplesEndMS);
-  post("samplesEnd %ld", g->samplesEnd);
+  post("samplesEnd %lld", (long long)g->samplesEnd);
   post("rampLenMS %f", g->rampLenMS);
   post("rampLenSamples %ld", g->rampLenSamples);
   post("density %f", g->density);
   post("status %d", g->status);
-  post("grainAmp %f", g->grainAmp);
-  post("lastGrainAmp %f", g->lastGrainAmp);
-  post("targetGrainAmp %f", g->targetGrainAmp);
-  post("grainAmpInc %f", g->grainAmpInc);
-  post("statusRampIndex %ld", g->statusRampIndex);
+  post("grainAmp %f", g->grainAmp.value);
+  post("targetGrainAmp %f", g->grainAmp.target);
+  post("grainAmpSmoothMS %f", g->grainAmpSmoothMS);
+  post("grainAmpShape %d", g->grainAmpShape);
+  post("statusAmp %f", g->statusAmp.value);
   post("live %d", g->live);
-  post("liveIndex %ld", g->liveIndex);
+  post("liveIndex %lld", (long long)g->liveIndex);
+  post("sourceChannels %d", g->sourceChannels);
+  post("sourceChannelMode %d", g->sourceChannelMode);
+  post("sourceChannel %d", g->sourceChannel);
+  post("panMode %d", g->panMode);
+  post("panCentre %f", g->panCentre);
+  post("panWidth %f", g->panWidth);
+  post("ambiOrder %d", g->ambiOrder);
+  post("ambiAzimuth %f", g->ambiAzimuth);
+  post("ambiAzimuthWidth %f", g->ambiAzimuthWidth);
+  post("ambiElevation %f", g->ambiElevation);
+  post("ambiElevationWidth %f", g->ambiElevationWidth);
+  post("liveShare %s", g->liveShare ? g->liveShare->name : "(none)");
+  post("mapping %s", g->mapping ? g->mapping->path : "(none)");
+  post("stream %s", g->stream ? g->BufferName : "(none)");
+  post("nReadSamples %lld", (long long)g->nReadSamples);
+  post("onsetRate %f", g->onsetRate);
+  post("onsetJitter %f", g->onsetJitter);
+  post("nPlaying %d", g->nPlaying);
+  post("pendingOnsets %d", g->pendingOnsets);
+  post("stealMode %d", g->stealMode);
+  post("cpuBudget %f", g->cpuBudget);
+  post("idleAfterMS %f", g->idleAfterMS);
+  post("inputIdle %d", g->inputIdle);
+  post("cpuLoad %f", g->cpuLoad);
+  post("govShed %f", g->govShed);
+  post("GrainBudget %ld", atomic_load(&BudgetRate));
+  post("priority %f", g->priority);
   post("OctaveSize %f", g->octaveSize);
   post("OctaveDivisions %f", g->octaveDivisions);
   post("PortionPosition %f", g->portionPosition);
@@ -788,35 +1320,6 @@ void mdeGranularPrint(mdeGranular* g)
   mdeGranularGrainPrint(&g->grains[0]);
 }
 
-/*****************************************************************************/
-
-int mdeGranularAtTargetGrainAmp(mdeGranular* g)
-{
-  if (g)
-    return (((g->lastGrainAmp <= g->targetGrainAmp) /* ascending */
-             && (g->grainAmp >= g->targetGrainAmp))
-            ||
-            ((g->lastGrainAmp >= g->targetGrainAmp) /* descending */
-             && (g->grainAmp <= g->targetGrainAmp)));
-  else return 0;
-}
-
-/*****************************************************************************/
-
-mdefloat mdeGranularGetGrainAmpAndInc(mdeGranular* g)
-{
-  if (g) {
-    mdefloat ret = g->grainAmp;
-
-    if (!mdeGranularAtTargetGrainAmp(g))
-      g->grainAmp += g->grainAmpInc;
-    /* 17/4/08: don't go < 0! */
-    if (g->grainAmp < (mdefloat)0.0)
-      g->grainAmp = (mdefloat) 0.0;
-    return ret;
-  }
-  else return (mdefloat)0.0;
-}
 
 /*****************************************************************************/
 
@@ -839,14 +1342,8 @@ void mdeGranularInitGrains(mdeGranular* g)
 
 void mdeGranularStoreRampType(mdeGranular* g, char* type)
 {
-  char* new = mdeCalloc(strlen(type) + 1, sizeof(char), 
-                        "mdeGranularStoreRampType", g->warnings);
-  char* old = g->rampType;
-
-  strcpy(new, type);
-  g->rampType = new;
-  if (old)
-    mdeFree(old);
+  strncpy(g->rampType, type, RAMPTYPELEN - 1);
+  g->rampType[RAMPTYPELEN - 1] = '\0';
 }
 
 /*****************************************************************************/
@@ -858,7 +1355,12 @@ void mdeGranularStoreRampType(mdeGranular* g, char* type)
  */ 
 int mdeGranularInit1(mdeGranular* g, int maxVoices, int numChannels)
 {
-  unsigned seed = (unsigned int)clock();
+  /* the instance count, our address and the time, each hashed apart */
+  uint32_t seed = (atomic_fetch_add(&Instances, 1U) + 1U) * 0x9E3779B9U ^
+    (uint32_t)((uintptr_t)g >> 4) * 0x85EBCA6BU ^
+    (uint32_t)(unsigned long long)(mdeGranularSeconds() * 1e9) * 0xC2B2AE35U ^
+    (uint32_t)clock();
+  int i;
   /* post("%d %d", (int)maxVoices, (int)numChannels); */
 
   g->channelBuffers = NULL;
@@ -866,25 +1368,101 @@ int mdeGranularInit1(mdeGranular* g, int maxVoices, int numChannels)
   g->grains = NULL;
   g->theSamples = NULL;
   g->samples = NULL;
+  g->sourceChannels = 1;
+  g->sourceChannelMode = SRC_FIXED;
+  g->sourceChannel = 0;
+  g->liveShare = NULL;
+  g->mapping = NULL;
+  g->stream = NULL;
+  g->trace = NULL;
+  atomic_init(&g->recorder, (mdeGranularRecorder*)NULL);
+  g->recordersRetired = NULL;
+  g->sampleClock = 0;
+  g->idleAfterMS = (mdefloat)0.0;
+  g->silentInput = 0;
+  g->inputIdle = 0;
+  g->nReadSamples = 0;
   g->rampUp = NULL;
   g->rampDown = NULL;
+  g->rampCapacity = 0;
   g->grainAmps = NULL;
-  g->rampType = NULL;
+  g->rampType[0] = '\0';
+  g->grainScratch = NULL;
+  g->panMode = PAN_DISCRETE;
+  g->sigCopies = NULL;
+  for (i = 0; i < NUMSIGPARAMS; ++i) {
+    g->sigHost[i] = NULL;
+    g->sigIns[i] = NULL;
+    g->sigLast[i] = (mdefloat)0.0;
+  }
+  g->sigIndex = -1;
+  g->onsetRate = (mdefloat)0.0;
+  g->onsetJitter = (mdefloat)0.0;
+  g->onsetPhase = 0.0;
+  g->pool = NULL;
+  g->nPlaying = 0;
+  g->pendingOnsets = 0;
+  g->stealMode = STEAL_OLDEST;
+  g->cpuBudget = (mdefloat)0.0;
+  g->cpuLoad = 0.0;
+  g->govShed = 0.0;
+  g->govStage = 0;
+  g->govCheap = 0;
+  g->govVoices = (mdefloat)1.0;
+  g->govDensity = (mdefloat)1.0;
+  g->priority = (mdefloat)50.0;
+  memset(&g->stats, 0, sizeof(mdeGranularStats));
+  memset(g->statsSlots, 0, sizeof(g->statsSlots));
+  atomic_init(&g->statsReset, 0);
+  atomic_init(&g->statsMiddle, 2);
+  g->statsBack = 0;
+  g->statsFront = 1;
+#ifdef MDEPROFILE
+  mdeGranularProfile(g, "reset");
+#endif
+  /* anywhere */
+  g->panCentre = (mdefloat)(numChannels - 1) * (mdefloat)0.5;
+  g->panWidth = (mdefloat)numChannels;
+  g->ambiOrder = 0;
+  /* anywhere on the horizontal */
+  g->ambiAzimuth = (mdefloat)0.0;
+  g->ambiAzimuthWidth = TWO_PI;
+  g->ambiElevation = (mdefloat)0.0;
+  g->ambiElevationWidth = (mdefloat)0.0;
+  mdeGranularMakePanTable();
   g->octaveSize = (mdefloat)2.0;
   g->octaveDivisions = (mdefloat)12.0;
   g->portionPosition = (mdefloat)0.0;
   g->portionWidth = (mdefloat)100.0;
 
   srand(seed);
+  g->rngCounter = seed;
+  g->planRandoms = NULL;
+  g->planFilled = g->planUsed = 0;
+  /* nothing matches this so the first grain fills the cache */
+  g->initCache.grainLength = -1;
   g->warnings = 1;
   g->status = OFF;
-  g->statusRampIndex = 0;
+  mdeSmootherJump(&g->statusAmp, (mdefloat)0.0);
+  g->statusAmps = NULL;
+  g->grainAmpSmoothMS = (mdefloat)0.0;
+  g->grainAmpShape = SMOOTH_LINEAR;
   mdeGranularSetMaxVoices(g, maxVoices);
   /* set all the voices active */
   mdeGranularSetActiveVoices(g, maxVoices);
+  g->numTranspositionWeights = 0;
+  mdeGranularAliasAlloc(&g->transpositionAlias, MAXTRANSPOSITIONS,
+                        g->warnings);
   mdeGranularSetTranspositions(g, 0, NULL);
   g->numChannels = numChannels;
   g->activeChannels = numChannels;
+  if (g->channelWeights)
+    mdeFree(g->channelWeights);
+  g->channelWeights = mdeCalloc(numChannels, sizeof(mdefloat),
+                                "mdeGranularInit1", g->warnings);
+  g->numChannelWeights = 0;
+  mdeGranularAliasAlloc(&g->channelAlias, numChannels, g->warnings);
+  mdeGranularAliasBuild(&g->channelAlias, NULL, 0, numChannels);
   if (g->channelBuffers)
     mdeFree(g->channelBuffers);
   g->channelBuffers = mdeCalloc(numChannels, sizeof(mdefloat*),
@@ -893,9 +1471,21 @@ int mdeGranularInit1(mdeGranular* g, int maxVoices, int numChannels)
   mdeGranularSetTranspositionOffsetST(g, (mdefloat)0.0);
   mdeGranularSetGrainLengthDeviation(g, (mdefloat)10.0);
   mdeGranularSetDensity(g, (mdefloat)100.0);
-  /* do this so memory is not freed! */
-  g->rampType = NULL;
   mdeGranularStoreRampType(g, DEFAULT_RAMP_TYPE);
+  for (i = 0; i < MAXSCENES; ++i)
+    atomic_init(&g->scenes[i], (mdeGranularScene*)NULL);
+  for (i = 0; i < SCENEREADERS; ++i)
+    atomic_init(&g->sceneReaders[i], (mdeGranularScene*)NULL);
+  g->sceneSpare = NULL;
+  atomic_init(&g->recallScene, -1);
+  atomic_init(&g->morphA, -1);
+  atomic_init(&g->morphB, -1);
+  atomic_init(&g->morphT, (mdefloat)0.0);
+  atomic_init(&g->morphPending, 0);
+  g->morphedTranspositions = 0;
+  g->layers = NULL;
+  g->numLayers = 0;
+  g->layer = 0;
   return 0;
 }
 
@@ -928,17 +1518,37 @@ int mdeGranularInit2(mdeGranular* g, long nOutputSamples, mdefloat rampLenMS,
       for (i = 0; i < g->numChannels; ++i)
         g->channelBuffers[i] =  channelBuffers[i];
     /* can't call the inlet method here, have to set it directly */
-    if (!mdeGranularDidInit(g)) {
-      g->grainAmp = 0.5;
-      g->targetGrainAmp = g->grainAmp;
-      g->lastGrainAmp = g->grainAmp;
-    }
+    if (!mdeGranularDidInit(g))
+      mdeSmootherJump(&g->grainAmp, (mdefloat)0.5);
     if (g->grainAmps)
       mdeFree(g->grainAmps);
     g->grainAmps = mdeCalloc(g->nOutputSamples, sizeof(mdefloat),
                              "mdeGranularInit2", g->warnings);
     if (!g->grainAmps)
       mdeGranularError("mdeGranular~: can't allocate memory for the grain amplitudes!");
+    if (g->grainScratch)
+      mdeFree(g->grainScratch);
+    g->grainScratch = mdeCalloc(g->nOutputSamples, sizeof(mdefloat),
+                                "mdeGranularInit2", g->warnings);
+    if (g->sigCopies)
+      mdeFree(g->sigCopies);
+    g->sigCopies = mdeCalloc(g->nOutputSamples * NUMSIGPARAMS,
+                             sizeof(mdefloat), "mdeGranularInit2",
+                             g->warnings);
+    if (g->statusAmps)
+      mdeFree(g->statusAmps);
+    g->statusAmps = mdeCalloc(g->nOutputSamples, sizeof(mdefloat),
+                              "mdeGranularInit2", g->warnings);
+    if (!g->planRandoms)
+      g->planRandoms = mdeCalloc(PLANMAXGRAINS * PLANDRAWS, sizeof(mdefloat),
+                                 "mdeGranularInit2", g->warnings);
+    g->planFilled = g->planUsed = 0;
+    /* a new block size (or sampling rate) for the layers too */
+    for (i = 0; i < g->numLayers; ++i) {
+      g->layers[i].samplingRate = g->samplingRate;
+      mdeGranularInit2(&g->layers[i], nOutputSamples, rampLenMS,
+                       g->channelBuffers);
+    }
   }
   return 0;
 }
@@ -963,7 +1573,7 @@ void mdeGranular_tildeSetF(t_mdeGranular_tilde *x, double bufsize)
            MINLIVEBUFSIZE, bufsize);
     return;
   }
-  if (mdeGranularInit3(g, NULL, bufsize, ms2samples(srate, bufsize))
+  if (mdeGranularInit3(g, NULL, bufsize, ms2samples(srate, bufsize), 1)
       < 0)
     post("mdeGranular~: couldn't init Granular object \n\
                         for live granulation");
@@ -973,18 +1583,31 @@ void mdeGranular_tildeSetF(t_mdeGranular_tilde *x, double bufsize)
 
 /** Called when a set message is sent to the object
  *  samplesMS is the length of the buffer (-samples-) in millisecs,
- *  numSamples the length of the same in samples.
+ *  numSamples the length of the same in samples (i.e. frames: -samples- has
+ *  -channels- interleaved channels; live input is always mono).
  *  */
 
 int mdeGranularInit3(mdeGranular* g, mdefloat* samples, mdefloat samplesMS,
-                     mdefloat numSamples)
+                     mdelong numSamples, int channels)
 {
   /* post("mdeGranularInit3"); */
   /* we were given the name of a buffer to granulate */
   if (samples) {
+    /* granulating a buffer so we no longer need any shared live ring */
+    mdeGranularLeaveLiveShare(g);
     g->samples = samples;
+    g->sourceChannels = channels > 0 ? channels : 1;
     g->live = 0;
   }
+  else if (g->liveShare) {
+    /* the ring's length was fixed by whoever created it, so ignore the
+     * requested size */
+    g->samples = g->liveShare->samples;
+    numSamples = g->liveShare->nSamples;
+    samplesMS = samples2ms(g->samplingRate, g->liveShare->nSamples);
+    g->sourceChannels = 1;
+    g->live = 1;
+  }
   else { /* live input */
     /* this should only happen at the init stage... */
     if (!g->theSamples)
@@ -1005,10 +1628,12 @@ int mdeGranularInit3(mdeGranular* g, mdefloat* samples, mdefloat samplesMS,
       }
       return 1;
     }
+    g->sourceChannels = 1;
     g->live = 1;
     g->liveIndex = 0;
   }
-  g->nBufferSamples = (long)numSamples;
+  g->nBufferSamples = numSamples;
+  g->nReadSamples = g->nBufferSamples;
   g->BufferSamplesMS = samplesMS;
   /* the DBL_MIN triggers setting the end to the end of the sample buffer */
   mdeGranularSetSamplesEndMS(g, (mdefloat)DBL_MIN);
@@ -1016,7 +1641,7 @@ int mdeGranularInit3(mdeGranular* g, mdefloat* samples, mdefloat samplesMS,
    * buffer */
   mdeGranularSetSamplesStartMS(g, (mdefloat)DBL_MIN);
   if (g->nBufferSamples < g->grainLength) {
-    int ninetypc = (int)((mdefloat)g->nBufferSamples * (mdefloat)0.9);
+    mdelong ninetypc = (mdelong)((double)g->nBufferSamples * 0.9);
 
     mdefloat ninetypcf = samples2ms(g->samplingRate, ninetypc);
     if (g->warnings) {
@@ -1040,20 +1665,34 @@ int mdeGranularInit3(mdeGranular* g, mdefloat* samples, mdefloat samplesMS,
 void mdeGranularFree(mdeGranular* g)
 {
 #if 1
+  mdeGranularLayersFree(g);
+  if (g->liveShare)
+    mdeGranularDetachLiveShare(g);
+  mdeGranularCloseFile(g);
+  mdeGranularTraceFree(g);
+  mdeGranularRecordFree(g);
+  mdeGranularAliasFree(&g->transpositionAlias);
+  mdeGranularAliasFree(&g->channelAlias);
+  if (g->channelWeights) {
+    mdeFree(g->channelWeights);
+    g->channelWeights = NULL;
+  }
   if (g->grains) {
     mdeFree(g->grains);
     g->grains = NULL;
   }
+  if (g->pool) {
+    mdeFree(g->pool);
+    g->pool = NULL;
+  }
   /* ramp down is just a pointer to the middle of rampUp so no need to free
      it */
   if (g->rampUp) {
     mdeFree(g->rampUp);
     g->rampUp = NULL;
   }
-  if (g->rampType) {
-    mdeFree(g->rampType);
-    g->rampType = NULL;
-  }
+  g->rampCapacity = 0;
+  mdeGranularScenesFree(g);
   if (g->channelBuffers) {
     mdeFree(g->channelBuffers);
     g->channelBuffers = NULL;
@@ -1062,6 +1701,23 @@ void mdeGranularFree(mdeGranular* g)
     mdeFree(g->grainAmps);
     g->grainAmps = NULL;
   }
+  if (g->sigCopies) {
+    mdeFree(g->sigCopies);
+    g->sigCopies = NULL;
+  }
+  if (g->statusAmps) {
+    mdeFree(g->statusAmps);
+    g->statusAmps = NULL;
+  }
+  if (g->planRandoms) {
+    mdeFree(g->planRandoms);
+    g->planRandoms = NULL;
+  }
+  g->planFilled = g->planUsed = 0;
+  if (g->grainScratch) {
+    mdeFree(g->grainScratch);
+    g->grainScratch = NULL;
+  }
   if (g->theSamples) {
     mdeFree(g->theSamples);
     g->theSamples = NULL;
@@ -1074,60 +1730,84 @@ void mdeGranularFree(mdeGranular* g)
 int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent, 
                          int doFirstDelay)
 {
-  int plen = parent->grainLength;
-  long givenStart = parent->samplesStart;
-  long givenEnd = parent->samplesEnd;
-  /* the grain's sample increment is a randomly chosen transposition from the
-   * parent multiplied by the offset from the parent  */
-  mdefloat inc =
-    parent->srcs[(int)between((mdefloat)0.0,
-                              (mdefloat)parent->numTranspositions)] *
-    parent->transpositionOffset;
+  mdeGranularInitCache* cache = &parent->initCache;
+  mdelong plen;
+  mdelong givenStart;
+  mdelong givenEnd;
+  /* the random numbers for this grain, in the order used below: usually
+   * drawn already by the planner */
+  mdefloat r[PLANDRAWS];
+  int i;
+  mdefloat inc;
   int ramplength = parent->rampLenSamples;
-  int length;
-  mdefloat samplesNeeded;
-  mdefloat max_start = (mdefloat)0.0;
-  mdefloat st;
-  mdefloat nd;
-  int backwards = givenStart > givenEnd;
+  mdelong length;
+  /* positions are worked out in double: a float can't address far into a
+   * long buffer */
+  double samplesNeeded;
+  double max_start = 0.0;
+  double st;
+  double nd;
+  int backwards;
   /* whether the grain will produce audio output or not */
   t_status status = ON;
-  int ramplength2 = ramplength * 2;
-  mdefloat min_start = 0.0;
+  int ramplength2;
+  double min_start = 0.0;
   int live = parent->live;
-  long latestSample = parent->liveIndex;
-  long newLiveSamples;
+  mdelong latestSample = mdeGranularGetLiveIndex(parent);
+  mdelong newLiveSamples;
+  mdelong wantStart;
+  mdelong wantEnd;
+  int tries;
+  /* why we're skipping the grain, if we are: the first reason we find */
+  t_skip cause = SKIP_SHORT;
   /* mdefloat fstart;*/
 
-  /* now we know whether we going backwards or forwards, proceed as if we were
-   * going forwards anyway and change after we've calculated our data */ 
-  if (backwards) {
-    givenStart = givenEnd; 
-    givenEnd = parent->samplesStart;
-  }
-  /* fstart = (mdefloat)givenStart; */
+  /* whatever the grain was reading from the stream cache, it's done with */
+  mdeGranularStreamUnpin(parent->stream, gg);
   if (gg->activeStatus == INACTIVE) { 
     /* we can switch this grain off now as it's come to the end of its ramp
      * down and it's been turned off */ 
     gg->status = OFF;
     return 1;
   }
-  /* if the requested grain length is too low to get the ramps in, change it
-   *  accordingly. */
-  if (plen < ramplength2)
-    plen = ramplength2;
-  length = (int)randomlyDeviate((mdefloat)plen, parent->grainLengthDeviation);
+  for (i = 0; i < PLANDRAWS; ++i)
+    r[i] = mdeGranularRandom(parent);
+  /* the grain's sample increment is a randomly chosen (weighted)
+   * transposition from the parent multiplied by the offset from the parent */
+  inc = parent->srcs[mdeGranularAliasPick(&parent->transpositionAlias, r[0])] *
+    parent->transpositionOffset;
+  mdeGranularInitCacheUpdate(parent);
+  /* now we know whether we going backwards or forwards, proceed as if we were
+   * going forwards anyway and change after we've calculated our data */ 
+  givenStart = cache->start;
+  givenEnd = cache->end;
+  backwards = cache->backwards;
+  /* fstart = (mdefloat)givenStart; */
+  /* the grain length, made long enough for the ramps, randomly deviated
+   * either way */
+  plen = cache->plen;
+  ramplength2 = cache->ramplength2;
+  length = (mdelong)((double)plen *
+                     (1.0 + cache->deviation *
+                      ((mdefloat)2.0 * r[1] - (mdefloat)1.0)));
   /* Get the number of live samples that will have been written by the time
    * this grain comes to an end. So bear in mind that if we're live, our sample
    * buffer will need to be > twice the grain length */
-  newLiveSamples = 
-    live ? parent->nOutputSamples * (1 + (length / parent->nOutputSamples))
-    : 0;
-  samplesNeeded = (mdefloat)length * inc;
+  if (!live)
+    newLiveSamples = 0;
+  else if (cache->outShift >= 0)
+    newLiveSamples = ((length >> cache->outShift) + 1) <<
+      cache->outShift;
+  else
+    newLiveSamples =
+      parent->nOutputSamples * (1 + (length / parent->nOutputSamples));
+  samplesNeeded = (double)length * inc;
   /* without this check we get slight crackling when the grain length
    * approaches ramplength2 */
-  if (length < ramplength2)
+  if (length < ramplength2) {
     status = SKIPGRAIN;
+    cause = SKIP_SHORT;
+  }
   /* These start/end points are using the whole buffer between user-given start
    * and end. If we're live, user-given start and end have no meaning as the
    * live sample writing will go to the end of the buffer and start again at
@@ -1149,22 +1829,51 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
    */
   else {
     /* newLiveSamples = 0 if we're not live so that's fine */
-    min_start = (mdefloat)(givenStart + newLiveSamples);
-    max_start = (mdefloat)givenEnd - samplesNeeded;
-    if (max_start < min_start)
+    min_start = (double)(givenStart + newLiveSamples);
+    max_start = (double)givenEnd - samplesNeeded;
+    /* when streaming, the cache might not hold all of start->end; leave
+     * room for the frames either side that interpolation reads (see
+     * mdeGranularStreamPin below) */
+    if (parent->stream) {
+      mdeGranularStreamWindow(parent->stream, &wantStart, &wantEnd);
+      if (min_start < wantStart + 1)
+        min_start = (double)(wantStart + 1);
+      if (max_start > wantEnd - 2 - samplesNeeded)
+        max_start = (double)(wantEnd - 2) - samplesNeeded;
+    }
+    if (max_start < min_start) {
       /* we don't have enough samples to do this transposition for the
        *  requested grain length */
       status = SKIPGRAIN;
+      cause = SKIP_WINDOW;
+    }
   }
   if (status) {
     /* given the above if/else, start should always be < max_start, right? */
-    st = between(min_start, max_start);
+    st = min_start + (max_start - min_start) * r[2];
     /* if we're not transposing, no point interpolating all the time is there?
      * */ 
     if (inc == 1.0)
-      st = (mdefloat)((long)st);
+      st = (double)((mdelong)st);
     /* could be < 0 or > buffer size but we wrap later */
     nd = st + samplesNeeded;
+    /* never wait for the disk: if the reader thread hasn't got to where we
+     * landed yet, try somewhere else, and failing that sit this grain out
+     * (i.e. defer it until its next reinit) */
+    for (tries = 0; parent->stream && status == ON && tries < 4; ++tries) {
+      if (mdeGranularStreamPin(parent->stream, gg, (mdelong)st - 1,
+                               (mdelong)nd + 2))
+        break;
+      st = min_start + (max_start - min_start) *
+        (double)mdeGranularRandom(parent);
+      if (inc == 1.0)
+        st = (double)((mdelong)st);
+      nd = st + samplesNeeded;
+    }
+    if (parent->stream && tries == 4) {
+      status = SKIPGRAIN;
+      cause = SKIP_STREAM;
+    }
   }
   else {
     /* there will be no audio output for this grain but set it up to be 
@@ -1173,8 +1882,8 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
      * it doesn't matter if the start or end point now go over sample buffer
      * boundaries as there will be no sample lookup anyway, just simple
      * increment. */
-    st = (mdefloat)givenStart;
-    nd = (mdefloat)(givenStart + plen);
+    st = (double)givenStart;
+    nd = (double)(givenStart + plen);
     inc = 1.0;
   }
 
@@ -1192,7 +1901,9 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
   gg->end = backwards ? st : nd;
   gg->inc = backwards ? -inc : inc;
   gg->backwards = backwards ? 1 : 0;
-  gg->current = gg->start;
+  gg->base = (mdelong)floor(gg->start);
+  gg->phase = mdeGranularToPhase(gg->start - (double)gg->base);
+  gg->phaseInc = mdeGranularToPhase((double)gg->inc);
   gg->status = status;
   gg->rampi = 0;
   gg->icurrent = 0;
@@ -1201,13 +1912,50 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
 */
   gg->endRampUp = ramplength;
   gg->startRampDown = length - ramplength;
-  /* channel is selected randomly */
-  gg->channel = (int)between((mdefloat)0.0, (mdefloat)parent->activeChannels);
+  /* channel is selected randomly (weighted) */
+  gg->channel = mdeGranularAliasPick(&parent->channelAlias, r[3]);
+  gg->nOuts = 0;
+  if (parent->panMode != PAN_DISCRETE && parent->grainScratch)
+    mdeGranularGrainPan(gg, parent, r + 7);
+  switch (parent->sourceChannelMode) {
+  case SRC_FIXED:
+    gg->srcChannel = parent->sourceChannel < parent->sourceChannels ?
+      parent->sourceChannel : parent->sourceChannels - 1;
+    break;
+  case SRC_OUTPUT:
+    gg->srcChannel = gg->channel % parent->sourceChannels;
+    break;
+  case SRC_RANDOM:
+    gg->srcChannel = (int)(r[4] * (mdefloat)parent->sourceChannels);
+    if (gg->srcChannel >= parent->sourceChannels)
+      gg->srcChannel = parent->sourceChannels - 1;
+    break;
+  }
   /* post("gg->channel = %d", gg->channel); */
   /* do density: we can assume that it is >= 0 and <= 100 because of the set
    * method that checks this. */
-  if (between((mdefloat)0.0, (mdefloat)100.0) > parent->density)
+  if (r[5] * (mdefloat)100.0 > parent->density * parent->govDensity) {
+    if (gg->status == ON)
+      cause = SKIP_DENSITY;
+    gg->status = SKIPGRAIN;
+  }
+  /* the CPU governor sits the highest voices out (in onset mode it limits
+   * how many grains play at once instead: see mdeGranularStartGrain) */
+  if (parent->govVoices < (mdefloat)1.0 && parent->onsetRate <= 0.0 &&
+      gg - parent->grains >= 
+      (long)ceil(parent->activeVoices * parent->govVoices)) {
+    if (gg->status == ON)
+      cause = SKIP_GOVERNOR;
+    gg->status = SKIPGRAIN;
+  }
+  /* only grains that would be heard count against the budget */
+  if (gg->status == ON && !mdeGranularBudgetTake(parent)) {
     gg->status = SKIPGRAIN;
+    cause = SKIP_BUDGET;
+  }
+  if (gg->status == ON)
+    parent->stats.grainsStarted++;
+  else parent->stats.skips[cause]++;
   /* if requested, set a delay of the given number of samples or up to 200% the
    * grain length for this grain */ 
   if (doFirstDelay || gg->doDelay) {
@@ -1217,98 +1965,109 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
      * to 1) in init1 */ 
 #ifdef DEBUG
     if (gg->doDelay > 1)
-      post("gg->doDelay=%d length=%d", gg->doDelay, gg->length);
+      post("gg->doDelay=%lld length=%lld", (long long)gg->doDelay,
+           (long long)gg->length);
 #endif 
     /* i.e. doDelay could be the number of samples we already know we want to
      * delay for so use that, otherwise pick a random number */
     gg->firstDelay = (gg->doDelay > 1) ? gg->doDelay :
-      (long)between((mdefloat)0.0, gg->length * (mdefloat)2.0);
+      (mdelong)(r[6] * gg->length * (mdefloat)2.0);
     gg->firstDelayCounter = 0;
     /* don't do it next time! */
     gg->doDelay = 0;
   }
 
-#ifdef DEBUG
-  if (DebugFP)
-    fprintf(DebugFP,
-            "start %f (bufstart %ld), end %f (bufend %ld), inc %f, "
-            "current %f, up %d, down %d, "
-            "length %d latestSample %d ",
-            gg->start, givenStart, gg->end, givenEnd, gg->inc, gg->current,
-            gg->endRampUp, gg->startRampDown, gg->length, latestSample);
-#endif
-
+  if (parent->trace)
+    mdeGranularTraceGrain(parent, gg, TRACE_INIT);
   return 0;
 }
 
 /*****************************************************************************/
 
-/** The side-effect here is that status changes when it is detected that ramp
- *  up/down is over 
+/** Apply the next -n- samples of the start/stop ramp to the outputs. The
+ *  side-effect here is that status changes when the ramp up/down is over.
  *  10.9.10 NB that the ramp used for starting and stopping is exactly the same
  *  (and therefore the same length) as that used for the grains. 
  * */
 
-mdefloat mdeGranularGetAmpForStatus(mdeGranular* g)
+void mdeGranularStatusRamp(mdeGranular* g, long n)
 {
-  double result = 0.0;
+  mdefloat* amps = g->statusAmps;
+  mdefloat* samp;
+  long i;
+  int j;
 
-  switch (g->status) {
-  case STARTING:
-    result = g->rampUp ? g->rampUp[g->statusRampIndex++] : 0.0;
-    /* this means of course that our fade up (and down--see case
-     * STOPPING) is the same length as the grain ramp length
-     */ 
-    if (g->statusRampIndex >= g->rampLenSamples) {
+  if (!mdeSmootherBlock(&g->statusAmp, amps, n)) {
+    if (g->status == STARTING)
       g->status = ON;
-      g->statusRampIndex = 0;
-      result = 1.0;
-    }
-    break;
-  case STOPPING:
-    result = g->rampDown[g->statusRampIndex++];
-    if (g->statusRampIndex >= g->rampLenSamples) {
+    else {
       g->status = OFF;
-      g->statusRampIndex = 0;
-      result = 0.0;
       mdeGranularForceGrainReinit(g);
+      /* the layers stopped with us */
+      for (j = 0; j < g->numLayers; ++j)
+        mdeGranularForceGrainReinit(&g->layers[j]);
     }
-    break;
-    /* probably won't need these last two but for the sake of
-     * completeness... */ 
-  case ON:
-    result = 1.0;
-    break;
-  case OFF:
-    result = 0.0;
-    break;
-  case SKIPGRAIN:
-    break;
-  case INACTIVE:
-    break;
-  case ACTIVE:
-    break;
   }
-  return (mdefloat)result;
+  /* not just the active channels: Ambisonic grains use them all */
+  for (j = 0; j < g->numChannels; ++j) {
+    samp = g->channelBuffers[j];
+    for (i = 0; i < n; ++i)
+      samp[i] *= amps[i];
+  }
 }
 
 /*****************************************************************************/
 
-void mdeGranularGo(mdeGranular* g)
+/** Start the start (-target- 1) or stop (0) ramp from wherever the status
+ *  amplitude is now, in the shape of our rampUp or rampDown. */
+
+void mdeGranularStatusTarget(mdeGranular* g, mdefloat target)
+{
+  if (target > (mdefloat)0.0)
+    mdeSmootherSetTarget(&g->statusAmp, target, g->rampLenSamples,
+                         SMOOTH_TABLE, g->rampUp);
+  else mdeSmootherSetTarget(&g->statusAmp, target, g->rampLenSamples,
+                            SMOOTH_TABLEDOWN, g->rampDown);
+}
+
+/*****************************************************************************/
+
+void mdeGranularGo(mdeGranular* g)
 {
   int i;
-  int j;
   mdeGranularGrain* gg;
-  mdefloat statusRampVal;
-  mdefloat* samp;
   long tickSize = g->nOutputSamples;
   mdefloat* gamp = g->grainAmps;
-
-#ifdef DEBUG
-  if (gamp)
-    fprintf(DebugFP, "gamp=%ld *gamp=%f", gamp, *gamp);
-  else fprintf(DebugFP, "gamp=NULL!");
-#endif
+  double started = mdeGranularSeconds();
+  double ns;
+  PROF_VAR(tGo)
+  PROF_VAR(t)
+
+  /* scenes change here, between ticks */
+  if (atomic_load_explicit(&g->recallScene, memory_order_acquire) >= 0)
+    mdeGranularRecallNow(g);
+  if (atomic_load_explicit(&g->morphPending, memory_order_acquire))
+    mdeGranularMorphNow(g);
+  /* the stats were read: start again, even if we're about to idle */
+  if (atomic_exchange_explicit(&g->statsReset, 0, memory_order_acq_rel)) {
+    memset(&g->stats, 0, sizeof(mdeGranularStats));
+    for (i = 0; i < g->numLayers; ++i)
+      memset(&g->layers[i].stats, 0, sizeof(mdeGranularStats));
+    mdeGranularPublishStats(g);
+  }
+  /* nothing to do but keep the outlets quiet (and the clock going): there are
+   * no grains when we're off, and a silent live buffer makes only silence. As
+   * soon as we're turned on or the input comes back, we're here no more. */
+  if (mdeGranularIsIdle(g)) {
+    for (i = 0; i < g->numChannels; ++i)
+      silence(g->channelBuffers[i], tickSize);
+    mdeGranularRecordBlock(g);
+    g->sampleClock += tickSize;
+    return;
+  }
+  PROF_START(tGo)
+  mdeGranularDeferLog(1);
+  mdeGranularBudgetRefill();
 
 #ifdef DEBUG
   if (!gamp || !g)
@@ -1316,627 +2075,4593 @@ void mdeGranularGo(mdeGranular* g)
   post("gamp %ld g %ld", gamp, g);
 #endif
 
-  /* if we're at the target amp and the first number in our array is the same
-   * as the target amp, then we're at steady state and don't need to get the
+  /* if we're at the target amp and the first and last numbers in our array
+   * are the same as it, then we're at steady state and don't need to get the
    * ramp values (however, first time at target amp is not enough: we need to
    * fill the buffer with repeated target amps
    * */
   /* post("gamp %f g %ld", *gamp, g); */
-  if (mdeGranularDidInit(g)) {
-    if (!(mdeGranularAtTargetGrainAmp(g) && *gamp == g->grainAmp)) {
-      for (i = 0; i < tickSize; ++i, ++gamp) {
-        *gamp = mdeGranularGetGrainAmpAndInc(g);
-      }
-    }
+  g->sigIndex = 0;
+  PROF_START(t)
+  if (mdeGranularDidInit(g) && !mdeGranularSignalGrainAmps(g)) {
+    if (mdeSmootherMoving(&g->grainAmp) || gamp[0] != g->grainAmp.value ||
+        gamp[tickSize - 1] != g->grainAmp.value)
+      mdeSmootherBlock(&g->grainAmp, gamp, tickSize);
   }
+  PROF_STOP(g, PROF_GRAINAMPS, t)
 
   /* zero out the buffers first */
+  PROF_START(t)
   for (i = 0; i < g->numChannels; ++i)
     silence(g->channelBuffers[i], tickSize);
+  PROF_STOP(g, PROF_SILENCE, t)
   if (g->status && g->grains) {
-    for (i = 0; i < g->maxVoices; ++i) {
+    mdeGranularPlan(g, tickSize);
+    if (g->onsetRate > 0.0 && g->pool)
+      mdeGranularOnsets(g);
+    else for (i = 0; i < g->maxVoices; ++i) {
       gg = &g->grains[i];
-      mdeGranularGrainMixIn(gg, g, g->channelBuffers[gg->channel],
-                            tickSize);
+      mdeGranularGrainMixIn(gg, g, mdeGranularGrainWhere(gg, g), tickSize);
     }
+    if (g->layers)
+      mdeGranularLayersGo(g, tickSize);
     if (g->status == STARTING || g->status == STOPPING) {
-      for (i = 0; i < tickSize; ++i) {
-        statusRampVal = mdeGranularGetAmpForStatus(g);
-        for (j = 0; j < g->activeChannels; ++j) {
-          samp = g->channelBuffers[j] + i;
-          *samp *= statusRampVal;
-        }
-      }
+      PROF_START(t)
+      mdeGranularStatusRamp(g, tickSize);
+      PROF_STOP(g, PROF_STATUSRAMP, t)
     }
+    g->planFilled = g->planUsed = 0;
   }
+  g->sigIndex = -1;
+  mdeGranularRecordBlock(g);
+  g->sampleClock += tickSize;
+  ns = (mdeGranularSeconds() - started) * 1e9;
+  if (!g->stats.ticks || ns < g->stats.minNS)
+    g->stats.minNS = ns;
+  if (ns > g->stats.maxNS)
+    g->stats.maxNS = ns;
+  g->stats.totalNS += ns;
+  g->stats.ticks++;
+  mdeGranularPublishStats(g);
+  if (g->cpuBudget > 0.0)
+    mdeGranularGovern(g, ns * 1e-9);
+  mdeGranularDeferLog(0);
+  PROF_STOP(g, PROF_GO, tGo)
 }
 
 /*****************************************************************************/
 
-/** Get -howMany- samples from -samples- and mix them into -where- i.e. mix
- *  with what's already there.
- *  
- */
+/** profile: post the totals for each stage of mdeGranularGo since we started
+ *  (or were last reset), and the average per time through it. profile reset
+ *  starts them again. Only when compiled with MDEPROFILE. */
 
-void mdeGranularGrainMixIn(mdeGranularGrain* gg, mdeGranular* parent, 
-                           mdefloat* where, int howMany)
+void mdeGranularProfile(mdeGranular* g, char* what)
 {
-  mdefloat rampval;
-  mdefloat samp;
-  mdefloat out;
-  mdefloat* samples = parent->samples;
-  mdefloat inc = gg->inc;
+#ifdef MDEPROFILE
   int i;
-  
-#if 0
-  if (gg == NULL)
-    post("gg is NULL!");
-  if (parent == NULL)
-    post("parent is NULL!");
-#endif
 
-#ifdef DEBUG
-  static int file_count = 1;
-  char filename[128];
+  if (what && !strcmp(what, "reset")) {
+    for (i = 0; i < NUMPROFSTAGES; ++i) {
+      g->profTicks[i] = 0;
+      g->profCounts[i] = 0;
+    }
+    return;
+  }
+  post("mdeGranular~ profile (" PROFUNITS "):");
+  for (i = 0; i < NUMPROFSTAGES; ++i)
+    post("              %-12s total %llu, %llu times, mean %.1f",
+         ProfStageNames[i], g->profTicks[i], g->profCounts[i],
+         g->profCounts[i] ?
+         (double)g->profTicks[i] / (double)g->profCounts[i] : 0.0);
+#else
+  UNUSED(what);
+  if (g->warnings) {
+    post("mdeGranular~:");
+    post("              profile: not compiled with MDEPROFILE defined.");
+  }
 #endif
+}
 
-  /* only do it if there are samples to granulate and a buffer to write into */
-  if (samples && where)
-    for (i = 0; i < howMany; ++i) {
-      /* are we in the initial delay part for this grain? */
-      if (gg->firstDelayCounter < gg->firstDelay)
-        gg->firstDelayCounter++;
-      else {
-        if (mdeGranularGrainExhausted(gg)) {
+/*****************************************************************************/
 
-#ifdef DEBUG
-          if (DebugFP) {
-            fprintf(DebugFP, "\n end grain");
-            fflush(DebugFP);
-            fclose(DebugFP);
-          }
-          sprintf(filename, "/temp/mdeGranular%03d.txt", file_count++);
-          DebugFP = fopen(filename, "w");
-          if (!DebugFP)
-            mdeGranularError("Can't open temp file.");
-          fprintf(DebugFP, "%f\n", inc);
-#endif
-          mdeGranularGrainInit(gg, parent, 0);
-          /* don't start back at the beginning--carry on from where we left
-           * off, i.e. plus i!!!!!  */
-          where = parent->channelBuffers[gg->channel] + i;
-          /* 4/8/04: gg->inc will probably have changed!  Not updating
-           * the inc local variable to reflect this was almost
-           * certainly causing buffer overruns and perhaps even
-           * crashes!  */
-          inc = gg->inc;
-        }
-        if (!(gg->status == OFF || gg->status == SKIPGRAIN)) {
-          if (inc == (mdefloat)1.0) {
-            /* MDE Wed Sep 18 19:47:49 2013 -- we're all 64bit float since Max
-             * 6 but buffer~s are still 32bit (damn!) so we'll have to fudge
-             * things a little here 
-            tmp = (long)gg->current % parent->nBufferSamples;
-            samp = parent->live ? *(samples + tmp) : *(fsamples + tmp);
-            */
-            samp = *(samples + ((long)gg->current % parent->nBufferSamples));
-          }
-          else samp = interpolate(gg->current, samples, parent->nBufferSamples,
-                                  gg->backwards); /*, parent->live);*/
-          rampval = mdeGranularGrainGetRampVal(gg, parent->rampUp,
-                                               parent->rampDown, 
-                                               parent->rampLenSamples);
-          out = samp * rampval * parent->grainAmps[i];
-          *where += out;    /* mix with what's already there */
-#ifdef DEBUG
-          if (rampval < (mdefloat)0.0 || rampval > (mdefloat)1.0)
-            post("rampval %f", rampval);
-          if (*where < (mdefloat)-1.0 || *where > (mdefloat)1.0)
-            post("%f", *where);
-          if (DebugFP)
-            fprintf(DebugFP, "current %f icurrent %d sample %f ramp %f out %f "
-                    "where %f nsamples %d this %d\n",
-                    gg->current, gg->icurrent, samp, rampval, out, *where,
-                    parent->nOutputSamples, gg);
-#endif
-        }
-        /* let these go over the buffer size and modulo later to get the
-         * correct sample */
-        gg->current += inc;
-        /*
-        if (gg->current < 0)
-            post("gg->current=%f!", gg->current);
-        */
-        gg->icurrent++;
-      }
-      ++where;
-    }
+/** Called by mdeGranularGo to hand the stats over to the stats message,
+ *  which mustn't read them whilst we're counting (see statsSlots). The
+ *  layers' grains and reads are counted in with ours; the ticks are all
+ *  ours. */
+
+void mdeGranularPublishStats(mdeGranular* g)
+{
+  mdeGranularStats* stats = &g->statsSlots[g->statsBack];
+  mdeGranularStats* l;
+  int i;
+  int j;
+
+  *stats = g->stats;
+  for (i = 0; i < g->numLayers; ++i) {
+    l = &g->layers[i].stats;
+    stats->grainsStarted += l->grainsStarted;
+    for (j = 0; j < NUMSKIPS; ++j)
+      stats->skips[j] += l->skips[j];
+    stats->integerReads += l->integerReads;
+    stats->interpolatedReads += l->interpolatedReads;
+  }
+  g->statsBack = atomic_exchange_explicit(&g->statsMiddle,
+                                          g->statsBack | STATSFRESH,
+                                          memory_order_acq_rel) & 3;
 }
 
 /*****************************************************************************/
 
-/** When we're granulating a live input rather than a static buffer use this
- *  function to copy -nsamps- samples into our samples buffer, incrementing the
- *  index as we go.
- *
- *  NB this always leaves g->LiveIndex at the place for the __next__ incoming
- *  sample, not pointing to the last stored. 
- *  */
+/** Copy the stats as they were at the end of the last tick into -stats- and
+ *  have mdeGranularGo start gathering them again. */
 
-void mdeGranularCopyInputSamples(mdeGranular* g, mdefloat* in,
-                                 long nsamps) 
+void mdeGranularGetStats(mdeGranular* g, mdeGranularStats* stats)
 {
-  mdefloat* samples = g->theSamples;
-  long i;
-  long li = g->liveIndex;
-  long end = g->nBufferSamples;
-  
-  if (samples) {
-    samples += li;
-    for (i = 0; i < nsamps; ++i) {
-      *samples++ = *in++;
-      if (++li == end) {
-        li = 0;
-        samples = g->theSamples;
-      }
+  if (atomic_load_explicit(&g->statsMiddle, memory_order_acquire)
+      & STATSFRESH)
+    g->statsFront = atomic_exchange_explicit(&g->statsMiddle, g->statsFront,
+                                             memory_order_acq_rel) & 3;
+  *stats = g->statsSlots[g->statsFront];
+  atomic_store_explicit(&g->statsReset, 1, memory_order_release);
+}
+
+/*****************************************************************************/
+
+/** How many grains are sounding at the moment (i.e. not skipped, off or
+ *  waiting for their first delay to pass), the layers' included. */
+
+int mdeGranularSounding(mdeGranular* g)
+{
+  mdeGranularGrain* gg;
+  int n = 0;
+  int i;
+
+  for (i = 0; i < g->numLayers; ++i)
+    n += mdeGranularSounding(&g->layers[i]);
+  if (!g->grains)
+    return n;
+  for (i = 0; i < g->maxVoices; ++i) {
+    gg = &g->grains[i];
+    if (gg->status == ON && gg->firstDelayCounter >= gg->firstDelay)
+      ++n;
+  }
+  return n;
+}
+
+/*****************************************************************************/
+
+/** When granulating live, stop granulating (and recording) once the input has
+ *  been silent for -ms- millisecs, and start again as soon as it isn't. Less
+ *  than the live buffer's length is taken as that length, as only then is
+ *  everything in it silent too. 0 (the default) never stops. */
+
+void mdeGranularSetIdleAfter(mdeGranular* g, mdefloat ms)
+{
+  if (ms < 0.0) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              IdleAfter should be >= 0, not %f. Ignoring.", ms);
     }
-    g->liveIndex = li;
+    return;
   }
+  g->idleAfterMS = ms;
+  g->silentInput = 0;
+  g->inputIdle = 0;
 }
 
 /*****************************************************************************/
 
-/* MDE Thu Sep 19 09:24:13 2013 -- now that msp is 64 bit, we're still stuck
- * with 32 bit float buffer~s so we'll need to copy samples over and promote to
- * doubles. */
+/** Called by the hosts with the live input before they'd pass it to
+ *  mdeGranularCopyInputSamples: returns 1 if it's been silent for long enough
+ *  (see mdeGranularSetIdleAfter) that there's no need to, and mdeGranularGo
+ *  will idle this tick too. Not for a shared ring, as others are reading
+ *  it. */
 
-long mdeGranularCopyFloatSamples(mdeGranular* g, float* in, long nsamps) 
+int mdeGranularInputIdle(mdeGranular* g, mdefloat* in, long nsamps)
 {
-  mdefloat* samples = g->theSamples;
   long i;
-  long num = nsamps;
+  mdelong after;
 
-  if (nsamps > g->nAllocatedBufferSamples && g->warnings) {
-    post("mdeGranular~:");
-    post("              The allocated live sample buffer is only ");
-    post("              %fms but your buffer~ length is %fms ",
-         g->AllocatedBufferMS, (mdefloat)nsamps / (g->samplingRate * .001));
-    post("              (assuming the buffer~'s sampling rate is the ");
-    post("              same as the dac~'s).");
-    post("              Please send the object a \"MaxLiveBufferMS\" ");
-    post("              message to increase this (preferably do this at");
-    post("              the beginning of your performance, allocating ");
-    post("              enough for all the performance's needs).");
-    num = g->nAllocatedBufferSamples;
+  if (g->idleAfterMS <= 0.0 || !g->live || g->liveShare) {
+    g->inputIdle = 0;
+    return 0;
   }
-  if (samples && in) {
-    for (i = 0; i < num; ++i) {
-      *samples++ = (mdefloat)*in++;
+  for (i = 0; i < nsamps; ++i) {
+    if (in[i] > IDLESILENCE || in[i] < -IDLESILENCE) {
+      g->silentInput = 0;
+      g->inputIdle = 0;
+      return 0;
     }
   }
-  return num;
+  if (!g->inputIdle) {
+    g->silentInput += nsamps;
+    after = ms2samples(g->samplingRate, g->idleAfterMS);
+    if (after < g->nBufferSamples)
+      after = g->nBufferSamples;
+    g->inputIdle = g->silentInput >= after;
+  }
+  return g->inputIdle;
 }
 
 /*****************************************************************************/
 
-/**  Get the amplitude scaler for the grain depending on whether we're in the
- *  ramp up, steady state, or ramp down.
- *  */
+/** Stop idling because the live input went quiet (on, or bang whilst idle):
+ *  the silence has to last IdleAfter again before we idle once more. */
 
-mdefloat mdeGranularGrainGetRampVal(mdeGranularGrain* gg, 
-                                           mdefloat* rampUp, mdefloat* rampDown,
-                                           /* rampLen is in samples */
-                                           long rampLen)
+void mdeGranularWake(mdeGranular* g)
 {
-  if (rampUp == NULL || rampDown == NULL)
-    return (mdefloat)0.0;
-  if (gg->icurrent < gg->endRampUp)
-    return rampUp[gg->icurrent];
-  else if (gg->icurrent >= gg->startRampDown) {
-    /* 10.9.10: to be honest we shouldn't have to do this check as we should
-     * never go over the ramp length but in certain circumstances, when
-     * changing ramp length we're getting crashes in accessing the ramp down,
-     * so just make sure */
-    if (gg->rampi < rampLen)
-      return rampDown[gg->rampi++];
-    else return (mdefloat)0.0;
-  }
-  else
-    return (mdefloat)1.0;
+  g->silentInput = 0;
+  g->inputIdle = 0;
 }
 
 /*****************************************************************************/
 
-/** Do we need to reinitialise our grain, i.e. have we finished with the ramp
- *  down?  
- */
+/** Whether mdeGranularGo has nothing to do but output silence: when we're
+ *  off (i.e. after the stopping ramp) or the live input has gone quiet. */
 
-int mdeGranularGrainExhausted(mdeGranularGrain* gg)
+int mdeGranularIsIdle(mdeGranular* g)
 {
-  return (gg->icurrent > gg->length);
+  return g->status == OFF || g->inputIdle;
 }
 
 /*****************************************************************************/
-/* 3.10.11 set buffer, grain and ramp lengths simultaneously, thus avoiding all
- * of the length conflicts NB buffer is a symbol, not just a size e.g. ms1000*/ 
-void mdeGranularBufferGrainRamp(t_mdeGranular_tilde* x, t_symbol* s,
-                                double grain_len, double ramp_len)
-{
-  mdeGranular* g = &x->x_g;
 
-  if (g->status != OFF) {
+/** The CPU governor: if mdeGranularGo takes more than -percent- of the
+ *  duration of the samples it's producing, shed work rather than risk a
+ *  dropout. 0 turns it off (and restores everything straight away). */
+
+void mdeGranularSetCPUBudget(mdeGranular* g, mdefloat percent)
+{
+  if (percent < 0.0) {
     if (g->warnings) {
       post("mdeGranular~:");
-      post("              BufferGrainRamp can only be called when off. ");
+      post("              CPUBudget should be >= 0, not %f. Ignoring.",
+           percent);
     }
     return;
   }
-  g->grainLength = 0L;
-  g->grainLengthMS = (mdefloat)0.0;
-  g->rampLenSamples = 0L;
-  g->rampLenMS = (mdefloat)0.0;
-  mdeGranular_tildeSet(x, s);
-  mdeGranularSetGrainLengthMS(g, (mdefloat)grain_len);
-  mdeGranularSetRampLenMS(g, (mdefloat)ramp_len);
+  g->cpuBudget = percent;
+  if (percent == 0.0) {
+    g->cpuLoad = 0.0;
+    g->govShed = 0.0;
+    g->govStage = 0;
+    g->govCheap = 0;
+    g->govVoices = (mdefloat)1.0;
+    g->govDensity = (mdefloat)1.0;
+  }
 }
 
 /*****************************************************************************/
 
-void mdeGranularWelcome(void)
+/** Called at the end of mdeGranularGo with how long it took. Work is shed in
+ *  stages, each one only once the last is used up: first linear instead of
+ *  cubic interpolation, then up to half the voices, then down to a quarter of
+ *  the density. Over budget, we go quickly down through these; well under
+ *  budget we come slowly back up, so that the cloud thins and fills out
+ *  smoothly rather than flapping. */
+
+void mdeGranularGovern(mdeGranular* g, double seconds)
 {
-  post("____________________________________________________");
-  post("mdeGranular~");
-  post("multi-channel, multi-voice, multi-transposition ");
-  post("granular synthesis external for Max/MSP and PD");
-  post("Version %s (%s %s)", VERSION, __TIME__, __DATE__);
-  post("Michael Edwards ~ m@michael-edwards.org");
-  post("____________________________________________________");
+  double tick = (double)g->nOutputSamples / (double)g->samplingRate;
+  double shed;
+  int stage;
+
+  if (tick <= 0.0)
+    return;
+  g->cpuLoad += 0.1 * (100.0 * seconds / tick - g->cpuLoad);
+  if (g->cpuLoad > g->cpuBudget)
+    g->govShed += GOVSHEDSTEP;
+  else if (g->cpuLoad < g->cpuBudget * 0.75)
+    g->govShed -= GOVRESTORESTEP;
+  if (g->govShed < 0.0)
+    g->govShed = 0.0;
+  else if (g->govShed > GOVSTAGES)
+    g->govShed = GOVSTAGES;
+  g->govCheap = g->govShed > 0.0;
+  shed = g->govShed - 1.0;
+  g->govVoices = (mdefloat)(1.0 - 0.5 * (shed < 0.0 ? 0.0 :
+                                         (shed > 1.0 ? 1.0 : shed)));
+  shed = g->govShed - 2.0;
+  g->govDensity = (mdefloat)(1.0 - 0.75 * (shed < 0.0 ? 0.0 : shed));
+  stage = (int)ceil(g->govShed);
+  if (stage != g->govStage && g->warnings) {
+    post("mdeGranular~:");
+    post("              CPU governor (%.1f%% of tick, budget %.1f%%): %s",
+         g->cpuLoad, g->cpuBudget,
+         stage == 0 ? "back to full quality" :
+         stage == 1 ? "linear interpolation" :
+         stage == 2 ? "linear interpolation, fewer voices" :
+         "linear interpolation, fewer voices, fewer grains");
+  }
+  g->govStage = stage;
 }
 
 /*****************************************************************************/
 
+/** Limit the number of grains all the instances in this process together can
+ *  start each second, so that the CPU they take stays bounded however many
+ *  there are. When the budget runs short the instances with the lowest
+ *  Priority go without first. 0 removes the limit. */
 
+void mdeGranularSetGrainBudget(mdeGranular* g, mdefloat grainsPerSecond)
+{
+  if (grainsPerSecond < 0.0) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              GrainBudget should be >= 0, not %f. Ignoring.",
+           grainsPerSecond);
+    }
+    return;
+  }
+  atomic_store(&BudgetRate, (long)grainsPerSecond);
+  /* start with a full bucket */
+  atomic_store(&BudgetMilliGrains,
+               (long)(grainsPerSecond * BUDGETBURSTSECS * 1000.0));
+  atomic_store(&BudgetStampNS, (long long)(mdeGranularSeconds() * 1e9));
+}
 
-/******************************************************************************
- *                    *********************************************************
- *  HELPER FUNCTIONS  *********************************************************
- *                    *********************************************************
- *****************************************************************************/
-
+/*****************************************************************************/
 
+void mdeGranularSetPriority(mdeGranular* g, mdefloat priority)
+{
+  if (priority < 0.0 || priority > 100.0) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              Priority should be between 0 and 100, not %f. ",
+           priority);
+      post("              Ignoring.");
+    }
+    return;
+  }
+  g->priority = priority;
+}
 
 /*****************************************************************************/
 
-/** Zero out a bunch of samples (starting at -where-), i.e. make them silent.
- *  */
+/** Top up the shared budget for the time that's passed since anyone last did
+ *  so. Called by every instance at the start of mdeGranularGo; whoever gets
+ *  the time stamp does the topping up. */
 
-void silence(mdefloat* where, int numSamples)
+void mdeGranularBudgetRefill(void)
 {
-  if (where)
-    memset(where, 0, numSamples * sizeof(mdefloat));
+  long rate = atomic_load(&BudgetRate);
+  long long now;
+  long long then;
+  long capacity;
+  long add;
+
+  if (!rate)
+    return;
+  now = (long long)(mdeGranularSeconds() * 1e9);
+  then = atomic_load(&BudgetStampNS);
+  add = (long)((double)(now - then) * 1e-6 * (double)rate);
+  /* a tick's worth should always be at least one thousandth of a grain, but
+   * don't move the stamp on until it is */
+  if (add <= 0 ||
+      !atomic_compare_exchange_strong(&BudgetStampNS, &then, now))
+    return;
+  capacity = (long)(rate * BUDGETBURSTSECS * 1000.0);
+  if (capacity < 1000)
+    capacity = 1000;
+  if (atomic_fetch_add(&BudgetMilliGrains, add) + add > capacity)
+    atomic_store(&BudgetMilliGrains, capacity);
 }
 
 /*****************************************************************************/
 
-/** Randomly deviate -number- by maxDeviation; this can be > or < than
- *  -number-; maxDeviation is a percentage 
- *  */
+/** Take a grain from the shared budget, if there's no budget or enough left
+ *  for this instance's priority: the lower the priority, the more of the
+ *  bucket has to be left for the others (up to BUDGETRESERVE of it). */
 
-mdefloat randomlyDeviate(mdefloat number, mdefloat maxDeviation)
+int mdeGranularBudgetTake(mdeGranular* g)
 {
-  mdefloat dev = between((mdefloat)0.0, maxDeviation);
-  mdefloat ndev = number * (dev * (mdefloat)0.01);
+  long rate = atomic_load(&BudgetRate);
+  long capacity;
+  long reserve;
+  long have;
 
-  if (flip())
-    ndev = -ndev;
-  return number + ndev;
+  if (!rate)
+    return 1;
+  capacity = (long)(rate * BUDGETBURSTSECS * 1000.0);
+  if (capacity < 1000)
+    capacity = 1000;
+  reserve = (long)((double)capacity * BUDGETRESERVE *
+                   (100.0 - g->priority) * 0.01);
+  have = atomic_load(&BudgetMilliGrains);
+  while (have - 1000 >= reserve)
+    if (atomic_compare_exchange_weak(&BudgetMilliGrains, &have, have - 1000))
+      return 1;
+  return 0;
 }
 
 /*****************************************************************************/
 
-/** The original straight ramp, called now from makeWindow.
- *  Given the length of a ramp, create the ramp up and ramp down values between
- *  0 and 1. Space for the ramps has already been allocated.
- *  */
+/** Onset mode: rather than each voice starting a new grain as soon as its last
+ *  one is over (perhaps after a delay), grains are started at onsetRate per
+ *  second in whichever voice is free, and the voice is given back when the
+ *  grain is over. So only the grains actually sounding cost anything, and
+ *  maxVoices is just a ceiling on the overlap. When all the voices are busy,
+ *  one is stolen (see stealMode) and the new grain starts once it has faded
+ *  out. */
 
-void makeRamps(int rampLen, mdefloat* rampUp, mdefloat* rampDown)
+void mdeGranularSetOnsets(mdeGranular* g, mdefloat rate, mdefloat jitter)
+{
+  int was = g->onsetRate > 0.0;
+
+  if (rate < 0.0 || jitter < 0.0 || jitter > 100.0) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              Onsets rate should be >= 0 and jitter between 0 ");
+      post("              and 100%%. Ignoring.");
+    }
+    return;
+  }
+  g->onsetJitter = jitter;
+  g->onsetRate = rate;
+  if (rate > 0.0 && !was) {
+    /* the voices' grains are cut off here, as when MaxVoices is changed */
+    mdeGranularResetPool(g);
+    g->onsetPhase = 0.0;
+  }
+  else if (rate == 0.0 && was) {
+    /* back to voices, staggered as at the start */
+    mdeGranularSetActiveVoices(g, (mdefloat)g->activeVoices);
+    mdeGranularInitGrains(g);
+  }
+}
+
+/*****************************************************************************/
+
+void mdeGranularSetSteal(mdeGranular* g, char* mode)
+{
+  if (!strcmp(mode, "oldest"))
+    g->stealMode = STEAL_OLDEST;
+  else if (!strcmp(mode, "quietest"))
+    g->stealMode = STEAL_QUIETEST;
+  else if (!strcmp(mode, "ramp"))
+    g->stealMode = STEAL_RAMP;
+  else if (g->warnings) {
+    post("mdeGranular~:");
+    post("              Steal should be oldest, quietest or ramp, ");
+    post("              not %s. Ignoring.", mode);
+  }
+}
+
+/*****************************************************************************/
+
+/** Mark all the voices free. */
+
+void mdeGranularResetPool(mdeGranular* g)
 {
-  mdefloat inc = (mdefloat)1.0 / (mdefloat)(rampLen - 1);
   int i;
-  mdefloat f = (mdefloat)0.0;
 
-  for (i = 0; i < rampLen; ++i, f += inc, ++rampUp, ++rampDown) {
-    *rampUp = f;
-    *rampDown = 1.0f - f;
+  if (!g->pool || !g->grains)
+    return;
+  for (i = 0; i < g->maxVoices; ++i) {
+    g->pool[i] = i;
+    g->grains[i].status = OFF;
+    g->grains[i].nOuts = 0;
   }
+  g->nPlaying = 0;
+  g->pendingOnsets = 0;
 }
 
 /*****************************************************************************/
 
-/** Convert semitones to sampling-rate conversion factor 
- *  e.g. st2src(-12) -> 0.5,  st2src(12) -> 2,  st2src(0) -> 1
+/** Called from mdeGranularGo instead of looping through all the voices when
+ *  we're in onset mode. */
+
+void mdeGranularOnsets(mdeGranular* g)
+{
+  long tickSize = g->nOutputSamples;
+  double period = (double)g->samplingRate / (double)g->onsetRate;
+  double next;
+  mdeGranularGrain* gg;
+  int i;
+
+  /* one sample is as close together as grains can start */
+  if (period < 1.0)
+    period = 1.0;
+  /* no new grains once we've been told to stop */
+  if (g->status == STARTING || g->status == ON) {
+    /* the grains that were waiting for a stolen voice go first, at the start
+     * of the tick */
+    while (g->pendingOnsets && g->nPlaying < g->maxVoices) {
+      g->pendingOnsets--;
+      mdeGranularStartGrain(g, 0);
+    }
+    while (g->onsetPhase < (double)tickSize) {
+      mdeGranularStartGrain(g, (long)g->onsetPhase);
+      /* up to onsetJitter percent either way (see mdeGranularPlan) */
+      next = g->onsetJitter > 0.0 ?
+        period * (1.0 + g->onsetJitter * 0.01 *
+                  (2.0 * (double)mdeGranularRandom(g) - 1.0)) : period;
+      g->onsetPhase += next < 1.0 ? 1.0 : next;
+    }
+    g->onsetPhase -= (double)tickSize;
+  }
+  for (i = 0; i < g->nPlaying; ++i) {
+    gg = &g->grains[g->pool[i]];
+    mdeGranularGrainMixIn(gg, g, mdeGranularGrainWhere(gg, g), tickSize);
+  }
+  /* give the voices whose grains are over back to the pool: swap them with
+   * the last playing so the free ones stay together at the end */
+  for (i = 0; i < g->nPlaying; ) {
+    if (g->grains[g->pool[i]].status == OFF || g->status == OFF) {
+      int tmp = g->pool[i];
+      g->pool[i] = g->pool[--g->nPlaying];
+      g->pool[g->nPlaying] = tmp;
+    }
+    else ++i;
+  }
+  if (g->status == OFF)
+    g->pendingOnsets = 0;
+}
+
+/*****************************************************************************/
+
+/** Start a grain -offset- samples into this tick, in a free voice if there is
+ *  one, otherwise by stealing one. */
+
+void mdeGranularStartGrain(mdeGranular* g, long offset)
+{
+  mdeGranularGrain* gg;
+  PROF_VAR(t)
+
+  /* the CPU governor's limit: don't steal, just drop the grain */
+  if (g->govVoices < (mdefloat)1.0 &&
+      g->nPlaying >= (int)ceil(g->maxVoices * g->govVoices)) {
+    g->stats.skips[SKIP_GOVERNOR]++;
+    return;
+  }
+  if (g->nPlaying == g->maxVoices) {
+    /* the onset is put off until the stolen voice is free */
+    if (mdeGranularStealGrain(g))
+      g->pendingOnsets++;
+    else g->stats.skips[SKIP_NOVOICE]++;
+    return;
+  }
+  gg = &g->grains[g->pool[g->nPlaying]];
+  gg->activeStatus = ACTIVE;
+  gg->doDelay = 0;
+  gg->stolen = 0;
+  g->sigIndex = offset;
+  PROF_START(t)
+  mdeGranularReadSignals(g);
+  mdeGranularGrainInit(gg, g, 0);
+  PROF_STOP(g, PROF_GRAININIT, t)
+  /* a grain that won't be heard (density, too short etc.) doesn't need a
+   * voice */
+  if (gg->status != ON)
+    return;
+  gg->firstDelay = offset;
+  gg->firstDelayCounter = 0;
+  g->nPlaying++;
+}
+
+/*****************************************************************************/
+
+/** Choose a playing grain to give up its voice, according to stealMode, and
+ *  start it fading out. Returns 0 if there's none to be had. */
+
+int mdeGranularStealGrain(mdeGranular* g)
+{
+  mdeGranularGrain* gg;
+  mdeGranularGrain* victim = NULL;
+  mdefloat env;
+  mdefloat best = (mdefloat)0.0;
+  int i;
+
+  for (i = 0; i < g->nPlaying; ++i) {
+    gg = &g->grains[g->pool[i]];
+    if (gg->stolen)
+      continue;
+    switch (g->stealMode) {
+    case STEAL_OLDEST:
+      if (!victim || gg->icurrent > victim->icurrent)
+        victim = gg;
+      break;
+    case STEAL_QUIETEST:
+      env = mdeGranularGrainEnvelope(gg, g);
+      if (!victim || env < best ||
+          (env == best && gg->icurrent > victim->icurrent)) {
+        victim = gg;
+        best = env;
+      }
+      break;
+    case STEAL_RAMP:
+      /* the one nearest its end */
+      if (gg->icurrent >= gg->startRampDown &&
+          (!victim || gg->length - gg->icurrent <
+           victim->length - victim->icurrent))
+        victim = gg;
+      break;
+    }
+  }
+  if (!victim)
+    return 0;
+  mdeGranularGrainFadeOut(victim, g);
+  victim->stolen = 1;
+  return 1;
+}
+
+/*****************************************************************************/
+
+/** The grain's ramp value at the moment, without moving it on (cf.
+ *  mdeGranularGrainGetRampVal). */
+
+mdefloat mdeGranularGrainEnvelope(mdeGranularGrain* gg, mdeGranular* parent)
+{
+  if (!parent->rampUp)
+    return (mdefloat)0.0;
+  if (gg->icurrent < gg->endRampUp)
+    return parent->rampUp[gg->icurrent];
+  if (gg->icurrent >= gg->startRampDown)
+    return gg->rampi < parent->rampLenSamples ?
+      parent->rampDown[gg->rampi] : (mdefloat)0.0;
+  return (mdefloat)1.0;
+}
+
+/*****************************************************************************/
+
+/** Bring a grain's ramp down forward to now, so that it's over in (at most) a
+ *  ramp length. If it's still ramping up, start the ramp down at the same
+ *  level (the ramps are symmetrical) so there's no jump. */
+
+void mdeGranularGrainFadeOut(mdeGranularGrain* gg, mdeGranular* parent)
+{
+  long rampLen = parent->rampLenSamples;
+
+  if (gg->icurrent >= gg->startRampDown)
+    return;
+  gg->rampi = gg->icurrent < gg->endRampUp ? rampLen - 1 - gg->icurrent : 0;
+  if (gg->rampi < 0)
+    gg->rampi = 0;
+  gg->endRampUp = gg->icurrent;
+  gg->startRampDown = gg->icurrent;
+  gg->length = gg->icurrent + rampLen - gg->rampi;
+}
+
+/*****************************************************************************/
+
+/** Fill PanTable (once per process: it's the same for everyone). */
+
+void mdeGranularMakePanTable(void)
+{
+  static int made = 0;
+  int i;
+
+  if (made)
+    return;
+  for (i = 0; i <= PANTABLESIZE; ++i)
+    PanTable[i] = (mdefloat)sin((double)i / PANTABLESIZE * M_PI * 0.5);
+  made = 1;
+}
+
+/*****************************************************************************/
+
+/** Give a grain a random position within the parent's PanSpread and work out
+ *  which two output channels it goes to and with which equal-power gains.
+ *  -r- is the grain's two random numbers for this (0 to 1, from
+ *  mdeGranularGrainInit's), the second only used for Ambisonics. */
+
+void mdeGranularGrainPan(mdeGranularGrain* gg, mdeGranular* parent,
+                         const mdefloat* r)
+{
+  int n = parent->activeChannels;
+  mdefloat half = parent->panWidth * (mdefloat)0.5;
+  mdefloat pos = parent->panCentre + half * ((mdefloat)2.0 * r[0] -
+                                             (mdefloat)1.0);
+  int left;
+  int idx;
+
+  if (parent->panMode == PAN_AMBISONIC) {
+    mdeGranularGrainEncode(gg, parent, r);
+    return;
+  }
+  if (n < 2) {
+    gg->channel = 0;
+    gg->nOuts = 1;
+    gg->outChannels[0] = 0;
+    gg->outGains[0] = (mdefloat)1.0;
+    return;
+  }
+  if (parent->panMode == PAN_RING) {
+    pos = (mdefloat)fmod(pos, (double)n);
+    if (pos < 0.0)
+      pos += (mdefloat)n;
+  }
+  else if (pos < 0.0)
+    pos = (mdefloat)0.0;
+  else if (pos > (mdefloat)(n - 1))
+    pos = (mdefloat)(n - 1);
+  left = (int)pos;
+  if (left >= n)
+    left = n - 1;
+  idx = (int)((pos - (mdefloat)left) * PANTABLESIZE + (mdefloat)0.5);
+  /* the channel we're nearest to, e.g. for SourceChannel output */
+  gg->channel = idx > PANTABLESIZE / 2 ? (left + 1) % n : left;
+  gg->outChannels[0] = left;
+  gg->outGains[0] = PanTable[PANTABLESIZE - idx];
+  gg->outChannels[1] = (left + 1) % n;
+  gg->outGains[1] = PanTable[idx];
+  /* right on a channel: no need to mix into its neighbour */
+  gg->nOuts = idx ? 2 : 1;
+}
+
+/*****************************************************************************/
+
+/** Fill -coeffs- with the (order + 1)^2 real spherical harmonics for the given
+ *  direction (in radians), in ACN order with SN3D normalisation (i.e. AmbiX;
+ *  no Condon-Shortley phase). The associated Legendre functions are got by
+ *  the usual recurrences so any order up to MAXAMBIORDER is fine. */
+
+void mdeGranularSphericalHarmonics(int order, mdefloat azimuth,
+                                   mdefloat elevation, mdefloat* coeffs)
+{
+  double x = sin((double)elevation);
+  double c = cos((double)elevation);
+  double p[MAXAMBIORDER + 1][MAXAMBIORDER + 1];
+  double norm;
+  double ratio;
+  int l;
+  int m;
+  int i;
+
+  /* P(m, m) = (2m-1)!! c^m; P(m+1, m) = x (2m+1) P(m, m); then upwards */
+  for (m = 0; m <= order; ++m) {
+    p[m][m] = m ? p[m - 1][m - 1] * (2 * m - 1) * c : 1.0;
+    if (m < order)
+      p[m + 1][m] = x * (2 * m + 1) * p[m][m];
+    for (l = m + 2; l <= order; ++l)
+      p[l][m] = ((2 * l - 1) * x * p[l - 1][m] - (l + m - 1) * p[l - 2][m])
+        / (l - m);
+  }
+  for (l = 0; l <= order; ++l)
+    for (m = 0; m <= l; ++m) {
+      /* SN3D: sqrt((2 - delta(m)) (l-m)! / (l+m)!) */
+      ratio = 1.0;
+      for (i = l - m + 1; i <= l + m; ++i)
+        ratio /= i;
+      norm = sqrt((m ? 2.0 : 1.0) * ratio) * p[l][m];
+      coeffs[l * l + l + m] = (mdefloat)(norm * cos(m * (double)azimuth));
+      if (m)
+        coeffs[l * l + l - m] = (mdefloat)(norm * sin(m * (double)azimuth));
+    }
+}
+
+/*****************************************************************************/
+
+/** Give a grain a random direction within the parent's AmbiSpread and work
+ *  out its gain for each Ambisonic channel: done once per grain so that the
+ *  mixing is just a multiply-add per channel. */
+
+void mdeGranularGrainEncode(mdeGranularGrain* gg, mdeGranular* parent,
+                            const mdefloat* r)
+{
+  mdefloat aw = parent->ambiAzimuthWidth * (mdefloat)0.5;
+  mdefloat ew = parent->ambiElevationWidth * (mdefloat)0.5;
+  mdefloat azimuth = parent->ambiAzimuth + aw * ((mdefloat)2.0 * r[0] -
+                                                 (mdefloat)1.0);
+  mdefloat elevation = parent->ambiElevation + ew * ((mdefloat)2.0 * r[1] -
+                                                     (mdefloat)1.0);
+  int n = (parent->ambiOrder + 1) * (parent->ambiOrder + 1);
+  int k;
+
+  if (elevation > M_PI * 0.5)
+    elevation = M_PI * (mdefloat)0.5;
+  else if (elevation < -M_PI * 0.5)
+    elevation = -M_PI * (mdefloat)0.5;
+  mdeGranularSphericalHarmonics(parent->ambiOrder, azimuth, elevation,
+                                gg->outGains);
+  for (k = 0; k < n; ++k)
+    gg->outChannels[k] = k;
+  gg->nOuts = n;
+}
+
+/*****************************************************************************/
+
+/** Where a grain should mix its samples: straight into its output channel or,
+ *  if it's panned, into the scratch buffer. */
+
+mdefloat* mdeGranularGrainWhere(mdeGranularGrain* gg, mdeGranular* parent)
+{
+  return gg->nOuts ? parent->grainScratch : parent->channelBuffers[gg->channel];
+}
+
+/*****************************************************************************/
+
+/** Mix a panned grain's samples from -from- to -to- in the scratch buffer into
+ *  its output channels. One multiply-add per channel per sample, in a loop the
+ *  compiler can vectorise. */
+
+void mdeGranularGrainFlush(mdeGranularGrain* gg, mdeGranular* parent,
+                           int from, int to)
+{
+  mdefloat* scratch = parent->grainScratch + from;
+  mdefloat* out;
+  mdefloat gain;
+  int n = to - from;
+  int i;
+  int k;
+
+  for (k = 0; k < gg->nOuts; ++k) {
+    out = parent->channelBuffers[gg->outChannels[k]] + from;
+    gain = gg->outGains[k];
+    for (i = 0; i < n; ++i)
+      out[i] += scratch[i] * gain;
+  }
+}
+
+/*****************************************************************************/
+
+/** Get -howMany- samples from -samples- and mix them into -where- i.e. mix
+ *  with what's already there. Panned grains go via the scratch buffer (see
+ *  mdeGranularGrainWhere), which is flushed to the outputs whenever the grain
+ *  is reinitialised (and perhaps moved) and at the end.
+ *  
+ */
+
+void mdeGranularGrainMixIn(mdeGranularGrain* gg, mdeGranular* parent, 
+                           mdefloat* where, int howMany)
+{
+  mdefloat rampval;
+  mdefloat samp;
+  mdefloat out;
+  mdefloat* samples = parent->samples;
+  mdefloat inc = gg->inc;
+  mdefloat fraction;
+  mdelong index;
+  /* the phase wrap is a mask for power-of-two buffers (see
+   * mdeGranularPhaseIndex) */
+  mdelong mask = parent->nReadSamples > 0 &&
+    !(parent->nReadSamples & (parent->nReadSamples - 1)) ?
+    parent->nReadSamples - 1 : -1;
+  int i;
+  /* where the panned samples not yet flushed start */
+  int from = 0;
+  /* for the stats */
+  long integerReads = 0;
+  long interpolatedReads = 0;
+  PROF_VAR(t)
+  
+#if 0
+  if (gg == NULL)
+    post("gg is NULL!");
+  if (parent == NULL)
+    post("parent is NULL!");
+#endif
+
+  /* the grain might be panned now or become so when it's reinitialised */
+  if (parent->grainScratch && (gg->nOuts || parent->panMode != PAN_DISCRETE)) {
+    PROF_START(t)
+    silence(parent->grainScratch, howMany);
+    PROF_STOP(parent, PROF_SILENCE, t)
+  }
+  /* only do it if there are samples to granulate and a buffer to write into */
+  if (samples && where) {
+    for (i = 0; i < howMany; ++i) {
+      /* are we in the initial delay part for this grain? */
+      if (gg->firstDelayCounter < gg->firstDelay)
+        gg->firstDelayCounter++;
+      else {
+        if (mdeGranularGrainExhausted(gg)) {
+          /* so that signal inlets are read (and trace events timed) at the
+           * sample the grain ends and the next starts */
+          parent->sigIndex = i;
+          if (parent->trace)
+            mdeGranularTraceGrain(parent, gg, TRACE_END);
+          if (gg->nOuts) {
+            mdeGranularGrainFlush(gg, parent, from, i);
+            from = i;
+          }
+          /* in onset mode the voice goes back to the pool rather than
+           * starting another grain (see mdeGranularOnsets) */
+          if (parent->onsetRate > 0.0) {
+            gg->status = OFF;
+            gg->nOuts = 0;
+            break;
+          }
+          PROF_START(t)
+          mdeGranularReadSignals(parent);
+          mdeGranularGrainInit(gg, parent, 0);
+          PROF_STOP(parent, PROF_GRAININIT, t)
+          /* don't start back at the beginning--carry on from where we left
+           * off, i.e. plus i!!!!!  */
+          where = mdeGranularGrainWhere(gg, parent) + i;
+          /* 4/8/04: gg->inc will probably have changed!  Not updating
+           * the inc local variable to reflect this was almost
+           * certainly causing buffer overruns and perhaps even
+           * crashes!  */
+          inc = gg->inc;
+        }
+        if (!(gg->status == OFF || gg->status == SKIPGRAIN)) {
+          PROF_START(t)
+          if (inc == (mdefloat)1.0) {
+            /* MDE Wed Sep 18 19:47:49 2013 -- we're all 64bit float since Max
+             * 6 but buffer~s are still 32bit (damn!) so we'll have to fudge
+             * things a little here 
+            tmp = (long)gg->current % parent->nBufferSamples;
+            samp = parent->live ? *(samples + tmp) : *(fsamples + tmp);
+            */
+            samp = *(samples + mdeGranularPhaseIndex(gg->base, gg->phase,
+                                                     parent->nReadSamples,
+                                                     mask) *
+                     parent->sourceChannels + gg->srcChannel);
+            ++integerReads;
+          }
+          else {
+            index = mdeGranularPhaseIndex(gg->base, gg->phase,
+                                          parent->nReadSamples, mask);
+            fraction = (mdefloat)((double)(gg->phase & PHASEFRACMASK) /
+                                  PHASEONE);
+            if (parent->govCheap)
+              samp = interpolateLinear(index, fraction,
+                                       samples + gg->srcChannel,
+                                       parent->nReadSamples,
+                                       parent->sourceChannels, gg->backwards);
+            else samp = interpolate(index, fraction, samples + gg->srcChannel,
+                                    parent->nReadSamples,
+                                    parent->sourceChannels, gg->backwards);
+            ++interpolatedReads;
+          }
+          PROF_STOP(parent, PROF_READ, t)
+          PROF_START(t)
+          rampval = mdeGranularGrainGetRampVal(gg, parent->rampUp,
+                                               parent->rampDown, 
+                                               parent->rampLenSamples);
+          PROF_STOP(parent, PROF_RAMP, t)
+          out = samp * rampval * parent->grainAmps[i];
+          *where += out;    /* mix with what's already there */
+#ifdef DEBUG
+          if (rampval < (mdefloat)0.0 || rampval > (mdefloat)1.0)
+            post("rampval %f", rampval);
+          if (*where < (mdefloat)-1.0 || *where > (mdefloat)1.0)
+            post("%f", *where);
+#endif
+        }
+        /* let these go over the buffer size and modulo later to get the
+         * correct sample */
+        gg->phase += gg->phaseInc;
+        gg->icurrent++;
+      }
+      ++where;
+    }
+    if (gg->nOuts)
+      mdeGranularGrainFlush(gg, parent, from, howMany);
+    parent->stats.integerReads += integerReads;
+    parent->stats.interpolatedReads += interpolatedReads;
+  }
+}
+
+/*****************************************************************************/
+
+/** When we're granulating a live input rather than a static buffer use this
+ *  function to copy -nsamps- samples into our samples buffer, incrementing the
+ *  index as we go.
+ *
+ *  NB this always leaves g->LiveIndex at the place for the __next__ incoming
+ *  sample, not pointing to the last stored. 
  *  */
 
-mdefloat st2src(mdefloat st, mdefloat octaveSize, 
-                       mdefloat octaveDivisions)
+void mdeGranularCopyInputSamples(mdeGranular* g, mdefloat* in,
+                                 long nsamps) 
+{
+  mdeGranularLiveShare* share = g->liveShare;
+  mdefloat* ring = share ? share->samples : g->theSamples;
+  mdefloat* samples = ring;
+  long i;
+  mdelong li = share ?
+    atomic_load_explicit(&share->liveIndex, memory_order_acquire) :
+    g->liveIndex;
+  mdelong end = share ? share->nSamples : g->nBufferSamples;
+  mdeGranular* writer = NULL;
+
+  mdeGranularRecordInput(g, in, nsamps);
+  /* whoever gets here first after the writer left takes over */
+  if (share &&
+      !atomic_compare_exchange_strong_explicit(&share->writer, &writer, g,
+                                               memory_order_acq_rel,
+                                               memory_order_acquire) &&
+      writer != g)
+    return;
+  if (samples) {
+    samples += li;
+    for (i = 0; i < nsamps; ++i) {
+      *samples++ = *in++;
+      if (++li == end) {
+        li = 0;
+        samples = ring;
+      }
+    }
+    if (share)
+      atomic_store_explicit(&share->liveIndex, li, memory_order_release);
+    else g->liveIndex = li;
+  }
+}
+
+/*****************************************************************************/
+
+/** The write index into whichever live buffer we're granulating. */
+
+mdelong mdeGranularGetLiveIndex(mdeGranular* g)
+{
+  return g->liveShare ?
+    atomic_load_explicit(&g->liveShare->liveIndex, memory_order_acquire) :
+    g->liveIndex;
+}
+
+/*****************************************************************************/
+
+/** Whether the host should pass its signal input to
+ *  mdeGranularCopyInputSamples this tick. The writer of a shared ring keeps
+ *  writing even when it's off itself, as others may be granulating it. */
+
+int mdeGranularWantsInput(mdeGranular* g)
+{
+  mdeGranular* writer;
+
+  if (!g->live)
+    return 0;
+  if (g->liveShare) {
+    writer = atomic_load_explicit(&g->liveShare->writer,
+                                  memory_order_acquire);
+    return !writer || writer == g;
+  }
+  return g->status != OFF;
+}
+
+/*****************************************************************************/
+
+/** Join the shared live ring called -name-, creating it (with our present
+ *  live buffer length) if nobody else has yet. An empty name leaves the
+ *  present ring. Our own live buffer is freed whilst we're sharing, so only
+ *  do this when the object is off. */
+
+void mdeGranularSetLiveShare(mdeGranular* g, char* name)
+{
+  mdeGranularLiveShare* share;
+  mdeGranular* writer = NULL;
+
+  if (g->status != OFF) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              Can't change liveshare whilst object is running ");
+      post("              or ramping down. Ignoring.");
+    }
+    return;
+  }
+  if (!name || !*name) {
+    mdeGranularLeaveLiveShare(g);
+    return;
+  }
+  if (g->liveShare && !strcmp(g->liveShare->name, name))
+    return;
+  if (!g->live || g->nBufferSamples < 1) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              liveshare only works when granulating live input ");
+      post("              (e.g. 'setms 2000'). Ignoring.");
+    }
+    return;
+  }
+  if (g->liveShare)
+    mdeGranularDetachLiveShare(g);
+  for (share = LiveShares; share; share = share->next)
+    if (!strcmp(share->name, name))
+      break;
+  if (!share) {
+    share = mdeCalloc(1, sizeof(mdeGranularLiveShare),
+                      "mdeGranularSetLiveShare", g->warnings);
+    if (!share)
+      return;
+    share->samples = mdeCalloc(g->nBufferSamples, sizeof(mdefloat),
+                               "mdeGranularSetLiveShare", g->warnings);
+    if (!share->samples) {
+      mdeFree(share);
+      return;
+    }
+    strncpy(share->name, name, sizeof(share->name) - 1);
+    share->nSamples = g->nBufferSamples;
+    atomic_init(&share->liveIndex, (mdelong)0);
+    atomic_init(&share->writer, (mdeGranular*)NULL);
+    share->next = LiveShares;
+    LiveShares = share;
+  }
+  atomic_compare_exchange_strong_explicit(&share->writer, &writer, g,
+                                          memory_order_acq_rel,
+                                          memory_order_acquire);
+  share->refCount++;
+  g->liveShare = share;
+  if (g->theSamples) {
+    mdeFree(g->theSamples);
+    g->theSamples = NULL;
+  }
+  g->samples = share->samples;
+  g->sourceChannels = 1;
+  g->nBufferSamples = share->nSamples;
+  g->nReadSamples = share->nSamples;
+  g->BufferSamplesMS = samples2ms(g->samplingRate, share->nSamples);
+  mdeGranularSetSamplesEndMS(g, (mdefloat)DBL_MIN);
+  mdeGranularSetSamplesStartMS(g, (mdefloat)DBL_MIN);
+  mdeGranularInitGrains(g);
+}
+
+/*****************************************************************************/
+
+/** Stop using our shared live ring (if any) and go back to our own live
+ *  buffer, reallocating it at the last requested size. */
+
+void mdeGranularLeaveLiveShare(mdeGranular* g)
+{
+  if (!g->liveShare)
+    return;
+  mdeGranularDetachLiveShare(g);
+  if (!g->theSamples) {
+    g->theSamples = mdeCalloc(g->nAllocatedBufferSamples, sizeof(mdefloat),
+                              "mdeGranularLeaveLiveShare", g->warnings);
+    if (!g->theSamples)
+      g->nAllocatedBufferSamples = 0;
+  }
+  if (g->live) {
+    g->samples = g->theSamples;
+    g->sourceChannels = 1;
+    g->liveIndex = 0;
+    if (g->nBufferSamples > g->nAllocatedBufferSamples) {
+      g->nBufferSamples = g->nAllocatedBufferSamples;
+      g->nReadSamples = g->nBufferSamples;
+      g->BufferSamplesMS = g->AllocatedBufferMS;
+      mdeGranularSetSamplesEndMS(g, (mdefloat)DBL_MIN);
+      mdeGranularSetSamplesStartMS(g, (mdefloat)DBL_MIN);
+    }
+    mdeGranularInitGrains(g);
+  }
+}
+
+/*****************************************************************************/
+
+/** Drop our reference to the shared ring, freeing it if we were the last
+ *  instance using it. */
+
+void mdeGranularDetachLiveShare(mdeGranular* g)
+{
+  mdeGranularLiveShare* share = g->liveShare;
+  mdeGranularLiveShare** prev;
+  mdeGranular* writer = g;
+
+  if (!share)
+    return;
+  g->liveShare = NULL;
+  atomic_compare_exchange_strong_explicit(&share->writer, &writer, NULL,
+                                          memory_order_acq_rel,
+                                          memory_order_acquire);
+  if (--share->refCount > 0)
+    return;
+  for (prev = &LiveShares; *prev; prev = &(*prev)->next)
+    if (*prev == share) {
+      *prev = share->next;
+      break;
+    }
+  mdeFree(share->samples);
+  mdeFree(share);
+}
+
+/*****************************************************************************/
+
+/* MDE Thu Sep 19 09:24:13 2013 -- now that msp is 64 bit, we're still stuck
+ * with 32 bit float buffer~s so we'll need to copy samples over and promote to
+ * doubles. Multichannel buffer~s stay interleaved; returns the number of
+ * frames copied. */
+
+mdelong mdeGranularCopyFloatSamples(mdeGranular* g, float* in,
+                                    mdelong nframes, int channels)
+{
+  mdefloat* samples = g->theSamples;
+  mdelong i;
+  mdelong nsamps = nframes * channels;
+  mdelong num = nframes;
+
+  if (nsamps > g->nAllocatedBufferSamples && g->warnings) {
+    post("mdeGranular~:");
+    post("              The allocated live sample buffer is only ");
+    post("              %fms but your buffer~ length is %fms ",
+         g->AllocatedBufferMS, (mdefloat)nsamps / (g->samplingRate * .001));
+    if (channels > 1)
+      post("              (i.e. %d channels x %fms).", channels,
+           (mdefloat)nframes / (g->samplingRate * .001));
+    post("              (assuming the buffer~'s sampling rate is the ");
+    post("              same as the dac~'s).");
+    post("              Please send the object a \"MaxLiveBufferMS\" ");
+    post("              message to increase this (preferably do this at");
+    post("              the beginning of your performance, allocating ");
+    post("              enough for all the performance's needs).");
+  }
+  if (nsamps > g->nAllocatedBufferSamples)
+    num = g->nAllocatedBufferSamples / channels;
+  if (samples && in) {
+    for (i = 0; i < num * channels; ++i) {
+      *samples++ = (mdefloat)*in++;
+    }
+  }
+  return num;
+}
+
+/*****************************************************************************/
+
+/**  Get the amplitude scaler for the grain depending on whether we're in the
+ *  ramp up, steady state, or ramp down.
+ *  */
+
+mdefloat mdeGranularGrainGetRampVal(mdeGranularGrain* gg, 
+                                           mdefloat* rampUp, mdefloat* rampDown,
+                                           /* rampLen is in samples */
+                                           long rampLen)
+{
+  if (rampUp == NULL || rampDown == NULL)
+    return (mdefloat)0.0;
+  if (gg->icurrent < gg->endRampUp)
+    return rampUp[gg->icurrent];
+  else if (gg->icurrent >= gg->startRampDown) {
+    /* 10.9.10: to be honest we shouldn't have to do this check as we should
+     * never go over the ramp length but in certain circumstances, when
+     * changing ramp length we're getting crashes in accessing the ramp down,
+     * so just make sure */
+    if (gg->rampi < rampLen)
+      return rampDown[gg->rampi++];
+    else return (mdefloat)0.0;
+  }
+  else
+    return (mdefloat)1.0;
+}
+
+/*****************************************************************************/
+
+/** Do we need to reinitialise our grain, i.e. have we finished with the ramp
+ *  down?  
+ */
+
+int mdeGranularGrainExhausted(mdeGranularGrain* gg)
+{
+  return (gg->icurrent > gg->length);
+}
+
+/*****************************************************************************/
+/* 3.10.11 set buffer, grain and ramp lengths simultaneously, thus avoiding all
+ * of the length conflicts NB buffer is a symbol, not just a size e.g. ms1000*/ 
+void mdeGranularBufferGrainRamp(t_mdeGranular_tilde* x, t_symbol* s,
+                                double grain_len, double ramp_len)
+{
+  mdeGranular* g = &x->x_g;
+
+  if (g->status != OFF) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              BufferGrainRamp can only be called when off. ");
+    }
+    return;
+  }
+  g->grainLength = 0L;
+  g->grainLengthMS = (mdefloat)0.0;
+  g->rampLenSamples = 0L;
+  g->rampLenMS = (mdefloat)0.0;
+  mdeGranular_tildeSet(x, s);
+  mdeGranularSetGrainLengthMS(g, (mdefloat)grain_len);
+  mdeGranularSetRampLenMS(g, (mdefloat)ramp_len);
+}
+
+/*****************************************************************************/
+
+void mdeGranularWelcome(void)
+{
+  post("____________________________________________________");
+  post("mdeGranular~");
+  post("multi-channel, multi-voice, multi-transposition ");
+  post("granular synthesis external for Max/MSP and PD");
+  post("Version %s (%s %s)", VERSION, __TIME__, __DATE__);
+  post("Michael Edwards ~ m@michael-edwards.org");
+  post("____________________________________________________");
+}
+
+/*****************************************************************************/
+
+
+
+/******************************************************************************
+ *                    *********************************************************
+ *  HELPER FUNCTIONS  *********************************************************
+ *                    *********************************************************
+ *****************************************************************************/
+
+
+
+/*****************************************************************************/
+
+/** Zero out a bunch of samples (starting at -where-), i.e. make them silent.
+ *  */
+
+void silence(mdefloat* where, mdelong numSamples)
+{
+  if (where && numSamples > 0)
+    memset(where, 0, (size_t)numSamples * sizeof(mdefloat));
+}
+
+/*****************************************************************************/
+
+/** Randomly deviate -number- by maxDeviation; this can be > or < than
+ *  -number-; maxDeviation is a percentage 
+ *  */
+
+mdefloat randomlyDeviate(mdefloat number, mdefloat maxDeviation)
+{
+  mdefloat dev = between((mdefloat)0.0, maxDeviation);
+  mdefloat ndev = number * (dev * (mdefloat)0.01);
+
+  if (flip())
+    ndev = -ndev;
+  return number + ndev;
+}
+
+/*****************************************************************************/
+
+/** The original straight ramp, called now from makeWindow.
+ *  Given the length of a ramp, create the ramp up and ramp down values between
+ *  0 and 1. Space for the ramps has already been allocated.
+ *  */
+
+void makeRamps(int rampLen, mdefloat* rampUp, mdefloat* rampDown)
+{
+  mdefloat inc = (mdefloat)1.0 / (mdefloat)(rampLen - 1);
+  int i;
+  mdefloat f = (mdefloat)0.0;
+
+  for (i = 0; i < rampLen; ++i, f += inc, ++rampUp, ++rampDown) {
+    *rampUp = f;
+    *rampDown = 1.0f - f;
+  }
+}
+
+/*****************************************************************************/
+
+/** Convert semitones to sampling-rate conversion factor 
+ *  e.g. st2src(-12) -> 0.5,  st2src(12) -> 2,  st2src(0) -> 1
+ *  */
+
+mdefloat st2src(mdefloat st, mdefloat octaveSize, 
+                       mdefloat octaveDivisions)
+{
+  return (mdefloat)pow(octaveSize, st / octaveDivisions);
+}
+
+/*****************************************************************************/
+
+/** Convert milliseconds to samples using the given sampling rate.
+ *  */
+mdelong ms2samples(mdefloat samplingRate, mdefloat milliseconds)
+{
+  /* in double (and dividing last) so hours at high rates come out exactly */
+  return (mdelong)ceil((double)milliseconds * (double)samplingRate / 1000.0);
+}
+
+/*****************************************************************************/
+
+/** Convert samples to milliseconds using the given sampling rate.
+ *  */
+mdefloat samples2ms(mdefloat samplingRate, mdelong samples)
+{
+  return (mdefloat)(1000.0 * ((double)samples / (double)samplingRate));
+}
+
+/*****************************************************************************/
+
+/** 4-point interpolating table lookup nicked and modified from pd's d_array.c
+    (tabread4~)  */
+
+/* MDE Wed Sep 18 20:02:35 2013 -- added live arg: if this is 1 we have 32bit
+   float samples, otherwise they're 64bit */
+/* MDE Thu Feb 20 11:39:46 2020 -- 'live' arg doesn't seem to be used at all, so
+   removing  */
+/** -samples- may be one channel of an interleaved buffer, in which case
+ *  -stride- is the number of channels and -numSamples- the number of frames.
+ *  */
+
+/** -index- has already been wrapped into the buffer (see
+ *  mdeGranularPhaseIndex) and -fraction- is how far past it we are.
+ *  */
+
+mdefloat interpolate(mdelong index, mdefloat fraction, mdefloat* samples,
+                     mdelong numSamples, int stride, char backwards)
+{
+  mdelong indexTrunc = index;
+  mdefloat a;
+  mdefloat b;
+  mdefloat c;
+  mdefloat d;
+  mdefloat cminusb;
+  mdefloat* fp;
+  mdefloat* lastsamp;
+  mdefloat lastsampval;
+  mdefloat result;
+
+  if (!samples)
+    return (mdefloat)0.0;
+  lastsamp = (mdefloat*)(samples + (numSamples - 1) * stride);
+  lastsampval = *lastsamp;
+  /* some of these saw samples cast to long but since going 64 bit that no
+     longer works (too small?) */ 
+  fp = (mdefloat*)(samples + indexTrunc * stride);
+  b = *fp;
+  if (backwards) {
+    a = *(samples + ((indexTrunc + 1) % numSamples) * stride);
+    c = indexTrunc ? *(fp - stride) : lastsampval;
+    d = !indexTrunc ? *(lastsamp - stride) : (indexTrunc == 1 ?
+                                              lastsampval : *(fp - 2 * stride));
+  }
+  else {
+    a = indexTrunc ? *(fp - stride) : lastsampval;
+    c = *(samples + ((indexTrunc + 1) % numSamples) * stride);
+    d = *(samples + ((indexTrunc + 2) % numSamples) * stride);
+  }
+
+  cminusb = c - b;
+  result = (b + fraction * (cminusb - (mdefloat)0.5 * (fraction - (mdefloat)1.0)
+                            * ((a - d + (mdefloat)3.0 * cminusb) * fraction + 
+                               (b - a - cminusb))));
+#ifdef DEBUG
+  if (result > 1.0)
+    post("%f at index %lld (numSamples: %lld, a,b,c,d=%f %f %f %f)\n", 
+         result, (long long)indexTrunc, (long long)numSamples, a, b, c, d);
+#endif
+
+  return result;
+}
+
+/*****************************************************************************/
+
+/** The same as interpolate but linear, i.e. cheaper and not so good: used
+ *  when the CPU governor is shedding work. */
+
+mdefloat interpolateLinear(mdelong index, mdefloat fraction, mdefloat* samples,
+                           mdelong numSamples, int stride, char backwards)
+{
+  mdelong indexTrunc = index;
+  mdefloat b;
+  mdefloat c;
+
+  if (!samples)
+    return (mdefloat)0.0;
+  b = *(samples + indexTrunc * stride);
+  /* the same neighbour interpolate uses */
+  if (backwards)
+    c = *(samples + (indexTrunc ? indexTrunc - 1 : numSamples - 1) * stride);
+  else c = *(samples + ((indexTrunc + 1) % numSamples) * stride);
+  return b + fraction * (c - b);
+}
+
+/*****************************************************************************/
+
+/** Convert a sample position to a phase (see mdePhase), rounding to the
+ *  nearest 2^-32 of a sample. */
+
+mdePhase mdeGranularToPhase(double position)
+{
+  return (mdePhase)floor(position * PHASEONE + 0.5);
+}
+
+/*****************************************************************************/
+
+/** The sample index of -phase- past -base-, wrapped into a buffer of
+ *  -numSamples-.  The shift floors, so a negative position (going backwards
+ *  off the start) lands at the correct frame from the end.  When the buffer
+ *  is a power of two long, -mask- is numSamples - 1 and the wrap is just an
+ *  and; otherwise it's -1 and we need the modulo. */
+
+mdelong mdeGranularPhaseIndex(mdelong base, mdePhase phase,
+                              mdelong numSamples, mdelong mask)
+{
+  mdelong index = base + (phase >> 32);
+
+  if (mask >= 0)
+    return index & mask;
+  index %= numSamples;
+  return index < 0 ? index + numSamples : index;
+}
+
+/*****************************************************************************/
+
+/** A monotonic clock in seconds, for timing ourselves. */
+
+double mdeGranularSeconds(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER count;
+  static LARGE_INTEGER frequency = { 0 };
+
+  if (!frequency.QuadPart)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+/*****************************************************************************/
+
+/** Return a random number between min (inclusive) and max (exclusive).
+ *  */
+
+mdefloat between(mdefloat min, mdefloat max)
+{
+  /* 2/4/08 the code used to be (mdefloat)(RAND_MAX + 1) but
+   * with MacIntel this obviously caused wraparound to a negative
+   * int and a negative number to be returned when min and
+   * max were both positive!  Should have seen that one coming....
+   */
+  static const mdefloat div = (mdefloat)RAND_MAX + (mdefloat)1.0;
+  
+  if (min == max)
+    return min;
+  else {
+    int r = rand();
+    mdefloat diff = max - min;
+    mdefloat scaler = diff / div;
+    return (min + (r * scaler));
+  }
+}
+
+/*****************************************************************************/
+
+/** The -n-th number (0 to 1, exclusive) in our stream of random numbers: a
+ *  hash of n (Chris Wellons' lowbias32), so any stretch of the stream can be
+ *  worked out at once, in any order, which is what lets the planner draw a
+ *  tick's worth in one vectorizable loop. */
+
+mdefloat mdeGranularHashRandom(uint32_t n)
+{
+  n ^= n >> 16;
+  n *= 0x7feb352dU;
+  n ^= n >> 15;
+  n *= 0x846ca68bU;
+  n ^= n >> 16;
+  /* 24 bits so it's exact as a float */
+  return (mdefloat)(n >> 8) * (mdefloat)(1.0 / 16777216.0);
+}
+
+/*****************************************************************************/
+
+/** The next random number for a new grain: from the planner if it drew it
+ *  already, otherwise (more grains ended than it expected) worked out now;
+ *  it's the same number either way. */
+
+mdefloat mdeGranularRandom(mdeGranular* g)
+{
+  if (g->planUsed < g->planFilled) {
+    g->rngCounter++;
+    return g->planRandoms[g->planUsed++];
+  }
+  return mdeGranularHashRandom(g->rngCounter++);
+}
+
+/*****************************************************************************/
+
+/** The grain planner, called at the start of each tick: count the grains
+ *  that will end during it (and in onset mode, the grains that are due to
+ *  start) and draw all the random numbers mdeGranularGrainInit will need for
+ *  them in one go, rather than a few rand()s at a time in the middle of
+ *  mixing. A grain that has to look elsewhere in a stream's cache draws
+ *  more as it goes; they're the same numbers either way (see
+ *  mdeGranularRandom). Only the random numbers are batched: the grains
+ *  themselves are still initialised one at a time, at the sample they end,
+ *  as the live index and the signal inlets are read there. */
+
+void mdeGranularPlan(mdeGranular* g, long tickSize)
+{
+  mdeGranularGrain* gg;
+  uint32_t base = g->rngCounter;
+  long left;
+  int grains = 0;
+  int draws = PLANDRAWS;
+  int n;
+  int i;
+
+  g->planFilled = g->planUsed = 0;
+  if (!g->planRandoms || !g->grains)
+    return;
+  if (g->onsetRate > 0.0) {
+    grains = g->pendingOnsets + 1 +
+      (int)(g->onsetRate * tickSize / g->samplingRate);
+    /* and one for each onset's jitter (see mdeGranularOnsets) */
+    draws = PLANDRAWS + 1;
+  }
+  else for (i = 0; i < g->maxVoices; ++i) {
+    gg = &g->grains[i];
+    if (gg->activeStatus == INACTIVE)
+      continue;
+    /* samples until mdeGranularGrainExhausted */
+    left = gg->firstDelay - gg->firstDelayCounter;
+    if (left < 0)
+      left = 0;
+    left += gg->length - gg->icurrent + 1;
+    if (left < tickSize)
+      ++grains;
+  }
+  if (grains > PLANMAXGRAINS * PLANDRAWS / draws)
+    grains = PLANMAXGRAINS * PLANDRAWS / draws;
+  n = grains * draws;
+  for (i = 0; i < n; ++i)
+    g->planRandoms[i] = mdeGranularHashRandom(base + (uint32_t)i);
+  g->planFilled = n;
+}
+
+/*****************************************************************************/
+
+/** Work out again what mdeGranularGrainInit needs from the parameters if any
+ *  of them have changed since last time. */
+
+void mdeGranularInitCacheUpdate(mdeGranular* g)
+{
+  mdeGranularInitCache* c = &g->initCache;
+  long n;
+
+  if (c->grainLength == g->grainLength &&
+      c->rampLenSamples == g->rampLenSamples &&
+      c->samplesStart == g->samplesStart && c->samplesEnd == g->samplesEnd &&
+      c->grainLengthDeviation == g->grainLengthDeviation &&
+      c->nOutputSamples == g->nOutputSamples)
+    return;
+  c->grainLength = g->grainLength;
+  c->rampLenSamples = g->rampLenSamples;
+  c->samplesStart = g->samplesStart;
+  c->samplesEnd = g->samplesEnd;
+  c->grainLengthDeviation = g->grainLengthDeviation;
+  c->nOutputSamples = g->nOutputSamples;
+  c->ramplength2 = (int)g->rampLenSamples * 2;
+  /* if the requested grain length is too low to get the ramps in, change it
+   *  accordingly. */
+  c->plen = g->grainLength < c->ramplength2 ? c->ramplength2 : g->grainLength;
+  c->deviation = g->grainLengthDeviation * (mdefloat)0.01;
+  c->backwards = g->samplesStart > g->samplesEnd;
+  c->start = c->backwards ? g->samplesEnd : g->samplesStart;
+  c->end = c->backwards ? g->samplesStart : g->samplesEnd;
+  c->outShift = -1;
+  for (n = 0; n < 31; ++n) {
+    if (1L << n == g->nOutputSamples) {
+      c->outShift = (int)n;
+      break;
+    }
+  }
+}
+
+/*****************************************************************************/
+
+/** Allocate the space for an alias table of up to -capacity- things (once:
+ *  building it never allocates). Returns 0 on success. */
+
+int mdeGranularAliasAlloc(mdeGranularAlias* a, int capacity, char warn)
+{
+  mdeGranularAliasFree(a);
+  a->prob = mdeCalloc(capacity, sizeof(mdefloat), "mdeGranularAliasAlloc",
+                      warn);
+  a->alias = mdeCalloc(capacity, sizeof(int), "mdeGranularAliasAlloc", warn);
+  a->work = mdeCalloc(capacity, sizeof(int), "mdeGranularAliasAlloc", warn);
+  if (!a->prob || !a->alias || !a->work) {
+    mdeGranularAliasFree(a);
+    return 1;
+  }
+  a->capacity = capacity;
+  return 0;
+}
+
+/*****************************************************************************/
+
+void mdeGranularAliasFree(mdeGranularAlias* a)
+{
+  if (a->prob)
+    mdeFree(a->prob);
+  if (a->alias)
+    mdeFree(a->alias);
+  if (a->work)
+    mdeFree(a->work);
+  a->prob = NULL;
+  a->alias = NULL;
+  a->work = NULL;
+  a->n = a->capacity = 0;
+}
+
+/*****************************************************************************/
+
+/** Build the table for choosing between -n- things, the first -nWeights- of
+ *  which have the given -weights- (negatives count as 0), the rest 1. With
+ *  no weights every prob is 1, so the choice is exactly the uniform one we
+ *  always made. Vose's way: scale the weights so they average 1, then fill
+ *  each slot that's short of 1 with the remainder of one that's over. */
+
+void mdeGranularAliasBuild(mdeGranularAlias* a, mdefloat* weights,
+                           int nWeights, int n)
+{
+  int i;
+  int s;
+  int l;
+  int nSmall = 0;
+  int nLarge = 0;
+  /* the small ones from the start of work, the large from the end */
+  int* small = a->work;
+  int* large = a->work + a->capacity;
+  double total = 0.0;
+  double w;
+
+  if (!a->prob)
+    return;
+  if (n > a->capacity)
+    n = a->capacity;
+  if (n < 1)
+    n = 1;
+  if (!weights)
+    nWeights = 0;
+  for (i = 0; i < n; ++i)
+    total += i < nWeights ? (weights[i] > 0.0 ? weights[i] : 0.0) : 1.0;
+  /* all zero: back to all equal */
+  if (total <= 0.0) {
+    nWeights = 0;
+    total = n;
+  }
+  for (i = 0; i < n; ++i) {
+    w = i < nWeights ? (weights[i] > 0.0 ? weights[i] : 0.0) : 1.0;
+    a->prob[i] = (mdefloat)(w * n / total);
+    a->alias[i] = i;
+    if (a->prob[i] < (mdefloat)1.0)
+      small[nSmall++] = i;
+    else
+      *(large - ++nLarge) = i;
+  }
+  while (nSmall && nLarge) {
+    s = small[--nSmall];
+    l = *(large - nLarge--);
+    a->alias[s] = l;
+    a->prob[l] -= (mdefloat)1.0 - a->prob[s];
+    if (a->prob[l] < (mdefloat)1.0)
+      small[nSmall++] = l;
+    else
+      *(large - ++nLarge) = l;
+  }
+  /* what's left is 1 but for rounding errors */
+  while (nSmall)
+    a->prob[small[--nSmall]] = (mdefloat)1.0;
+  while (nLarge)
+    a->prob[*(large - nLarge--)] = (mdefloat)1.0;
+  a->n = n;
+}
+
+/*****************************************************************************/
+
+/** Choose one of the table's things with -r-, a random number from 0 to 1
+ *  (exclusive): scaled up, its whole part gives the slot and the fraction
+ *  whether to take the slot or its alias. */
+
+int mdeGranularAliasPick(mdeGranularAlias* a, mdefloat r)
+{
+  int i;
+
+  if (a->n < 2)
+    return 0;
+  r *= (mdefloat)a->n;
+  i = (int)r;
+  if (i >= a->n)
+    i = a->n - 1;
+  return r - (mdefloat)i < a->prob[i] ? i : a->alias[i];
+}
+
+/*****************************************************************************/
+
+/** Flip of a coin, i.e. return randomly 0 or 1
+ *  */
+
+int flip(void)
+{
+  static const long thresh = (RAND_MAX / 2);
+  return (rand() > thresh);
+}
+
+/*****************************************************************************/
+
+/** Simple memory allocation for an array using stdlib's calloc (PD) or MaxMSP
+ *  API's sysmem_newptrclear but checking for out of memory problem. By using
+ *  calloc (PD) or the MAX function, the bytes are guaranteed to be initialized
+ *  to zero. */
+
+void* mdeCalloc(size_t howmany, size_t size, char* caller, char warn)
+{
+  void* ret = 0x0;
+
+  if (howmany < 1 || size < 1) {
+    if (warn)
+      post("mdeGranular~: request for 0 bytes (from %s)????", caller);
+    return NULL;
+  }
+  /* a negative count converted to size_t ends up here too */
+  if (howmany > SIZE_MAX / size) {
+    if (warn)
+      post("mdeGranular~: mdeCalloc: request for too many bytes (from %s)!",
+           caller);
+    return NULL;
+  }
+#ifdef MAXMSP
+  ret = sysmem_newptrclear(howmany * size);
+#else
+  ret = calloc(howmany, size);
+#endif
+  if (!ret && warn)
+    post("mdeGranular~: mdeCalloc: Out of memory (from %s)!", caller);
+  return ret;
+}
+
+/*****************************************************************************/
+
+void mdeFree(void* what)
+{
+#ifdef MAXMSP
+  sysmem_freeptr(what);
+#else
+  free(what);
+#endif
+}
+
+/*****************************************************************************/
+
+/** Check whether a string contains a number, i.e. only digits and dots.
+ *  */
+
+int isanum(char* input)
+{
+  int ok = 1;
+
+  do {
+    if (!isdigit(*input) && *input != '.' && *input != '\0') {
+      ok = 0;
+      break;
+    }
+  } while (*input++);
+  return ok;
+}
+
+/*****************************************************************************/
+
+/* Inlet methods just call portable object's methods */
+
+void mdeGranular_tildeTranspositionOffsetST(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetTranspositionOffsetST(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeGrainLengthMS(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetGrainLengthMS(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeGrainLengthDeviation(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetGrainLengthDeviation(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeSamplesStartMS(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetSamplesStartMS(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeSamplesEndMS(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetSamplesEndMS(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeDensity(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetDensity(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeActiveChannels(t_mdeGranular_tilde* x, long l)
+{
+  mdeGranularSetActiveChannels(&x->x_g, l);
+}
+void mdeGranular_tildeWarnings(t_mdeGranular_tilde* x, long l)
+{
+  mdeGranularSetWarnings(&x->x_g, l);
+}
+void mdeGranular_tildeGrainAmp(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetGrainAmp(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeGrainAmpSmoothing(t_mdeGranular_tilde* x, mdefloat ms,
+                                        t_symbol* s)
+{
+  mdeGranularSetGrainAmpSmoothing(&x->x_g, ms, (char*)s->s_name);
+}
+void mdeGranular_tildeMaxVoices(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetMaxVoices(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeActiveVoices(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetActiveVoices(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeRampLenMS(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSetRampLenMS(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeRampType(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  mdeGranularSetRampType(&x->x_g, (char*)s->s_name);
+}
+void mdeGranular_tildeOn(t_mdeGranular_tilde *x)
+{
+  mdeGranularOn(&x->x_g);
+}
+void mdeGranular_tildeOff(t_mdeGranular_tilde *x)
+{
+  mdeGranularOff(&x->x_g);
+}
+void mdeGranular_tildeSetLiveBufferSize(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSetLiveBufferSize(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeDoGrainDelays(t_mdeGranular_tilde *x)
+{
+  mdeGranularDoGrainDelays(&x->x_g);
+}
+void mdeGranular_tildeSmoothMode(t_mdeGranular_tilde *x)
+{
+  mdeGranularSmoothMode(&x->x_g);
+}
+void mdeGranular_tildeOctaveSize(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularOctaveSize(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildeOctaveDivisions(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularOctaveDivisions(&x->x_g, (mdefloat)f);
+}
+void mdeGranular_tildePortion(t_mdeGranular_tilde *x, mdefloat position, 
+                              mdefloat width)
+{
+  mdeGranularPortion(&x->x_g, (mdefloat)position, (mdefloat)width);
+}
+void mdeGranular_tildePortionPosition(t_mdeGranular_tilde *x, mdefloat position)
+{
+  mdeGranularPortionPosition(&x->x_g, (mdefloat)position);
+}
+void mdeGranular_tildePortionWidth(t_mdeGranular_tilde *x, mdefloat width)
+{
+  mdeGranularPortionWidth(&x->x_g, (mdefloat)width);
+}
+void mdeGranular_tildeBufferGrainRamp(t_mdeGranular_tilde *x, t_symbol *s,
+                                      mdefloat grain_len, mdefloat ramp_len)
+{
+  mdeGranularBufferGrainRamp(x, s, grain_len, ramp_len);
+}
+void mdeGranular_tildeLiveShare(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  mdeGranularSetLiveShare(&x->x_g, (char*)s->s_name);
+}
+void mdeGranular_tildeSourceChannel(t_mdeGranular_tilde *x, t_symbol *s,
+                                    mdefloat channel)
+{
+  mdeGranularSetSourceChannel(&x->x_g, (char*)s->s_name, (int)channel);
+}
+void mdeGranular_tildePanMode(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  mdeGranularSetPanMode(&x->x_g, (char*)s->s_name);
+}
+void mdeGranular_tildePanSpread(t_mdeGranular_tilde *x, mdefloat centre,
+                                mdefloat width)
+{
+  mdeGranularSetPanSpread(&x->x_g, centre, width);
+}
+void mdeGranular_tildeAmbiSpread(t_mdeGranular_tilde *x, mdefloat azimuth,
+                                 mdefloat azimuthWidth, mdefloat elevation,
+                                 mdefloat elevationWidth)
+{
+  mdeGranularSetAmbiSpread(&x->x_g, azimuth, azimuthWidth, elevation,
+                           elevationWidth);
+}
+void mdeGranular_tildeOnsets(t_mdeGranular_tilde *x, mdefloat rate,
+                             mdefloat jitter)
+{
+  mdeGranularSetOnsets(&x->x_g, rate, jitter);
+}
+void mdeGranular_tildeSteal(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  mdeGranularSetSteal(&x->x_g, (char*)s->s_name);
+}
+void mdeGranular_tildeProfile(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  mdeGranularProfile(&x->x_g, (char*)s->s_name);
+}
+void mdeGranular_tildeSnapshot(t_mdeGranular_tilde *x, mdefloat scene,
+                               t_symbol *s)
+{
+  mdeGranularSnapshot(&x->x_g, (int)scene, (char*)s->s_name);
+}
+void mdeGranular_tildeRecall(t_mdeGranular_tilde *x, mdefloat scene)
+{
+  mdeGranularRecall(&x->x_g, (int)scene);
+}
+void mdeGranular_tildeMorph(t_mdeGranular_tilde *x, mdefloat a, mdefloat b,
+                            mdefloat t)
+{
+  mdeGranularMorph(&x->x_g, (int)a, (int)b, t);
+}
+void mdeGranular_tildeLayers(t_mdeGranular_tilde *x, mdefloat num)
+{
+  mdeGranularSetLayers(&x->x_g, (int)num);
+}
+void mdeGranular_tildeStop(t_mdeGranular_tilde *x)
+{
+  mdeGranularRecordStop(&x->x_g);
+}
+void mdeGranular_tildeCPUBudget(t_mdeGranular_tilde *x, mdefloat percent)
+{
+  mdeGranularSetCPUBudget(&x->x_g, percent);
+}
+void mdeGranular_tildeIdleAfter(t_mdeGranular_tilde *x, mdefloat ms)
+{
+  mdeGranularSetIdleAfter(&x->x_g, ms);
+}
+void mdeGranular_tildeGrainBudget(t_mdeGranular_tilde *x, mdefloat rate)
+{
+  mdeGranularSetGrainBudget(&x->x_g, rate);
+}
+void mdeGranular_tildePriority(t_mdeGranular_tilde *x, mdefloat priority)
+{
+  mdeGranularSetPriority(&x->x_g, priority);
+}
+/* mdeGranular_tildeOpen and mdeGranular_tildeStream are in the PD/Max files
+ * as they have to find the file */
+
+/*****************************************************************************/
+
+
+/****************************************************************************
+ *************************                    *********************************
+ *************************    SOUND FILES     *********************************
+ *************************                    *********************************
+ *****************************************************************************/
+
+
+/*****************************************************************************/
+
+/** Little-endian integers as found in WAV headers. */
+
+unsigned long mdeGetLE16(const unsigned char* p)
+{
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8);
+}
+
+unsigned long mdeGetLE32(const unsigned char* p)
+{
+  return mdeGetLE16(p) | ((unsigned long)p[2] << 16) |
+    ((unsigned long)p[3] << 24);
+}
+
+/** And the other way, for the recorder. */
+
+void mdePutLE16(unsigned char* p, unsigned long v)
+{
+  p[0] = (unsigned char)(v & 0xff);
+  p[1] = (unsigned char)((v >> 8) & 0xff);
+}
+
+void mdePutLE32(unsigned char* p, unsigned long v)
+{
+  mdePutLE16(p, v);
+  mdePutLE16(p + 2, v >> 16);
+}
+
+void mdePutLE64(unsigned char* p, unsigned long long v)
+{
+  mdePutLE32(p, (unsigned long)(v & 0xFFFFFFFFULL));
+  mdePutLE32(p + 4, (unsigned long)(v >> 32));
+}
+
+/*****************************************************************************/
+
+/** Find out where the samples are in -path- and what format they're in. We
+ *  only understand WAV headers, and RF64's (EBU Tech 3306: a WAV whose
+ *  sizes are in a ds64 chunk as they're past 32 bits). Returns 0 on
+ *  success, -1 if the file can't be read, -2 if its sample format isn't
+ *  supported and -3 if it isn't a WAV file at all (see SoundFileInfo).
+ *  */
+
+int mdeGranularReadSoundFileInfo(char* path, mdeGranularSoundFile* sf)
+{
+  FILE* fp = fopen(path, "rb");
+  unsigned char hdr[40];
+  mdelong fileBytes;
+  mdelong dataBytes = 0;
+  mdelong ds64Bytes = 0;
+  mdelong chunkBytes;
+  mdelong pos = 12;
+  size_t n;
+  int tag = 0;
+  int bits = 0;
+
+  memset(sf, 0, sizeof(mdeGranularSoundFile));
+  if (!fp)
+    return -1;
+  mdeSeek(fp, 0, SEEK_END);
+  fileBytes = mdeTell(fp);
+  mdeSeek(fp, 0, SEEK_SET);
+  if (fread(hdr, 1, 12, fp) != 12 ||
+      (memcmp(hdr, "RIFF", 4) && memcmp(hdr, "RF64", 4)) ||
+      memcmp(hdr + 8, "WAVE", 4)) {
+    fclose(fp);
+    return -3;
+  }
+  /* go through the chunks until we get to the samples */
+  while (fread(hdr, 1, 8, fp) == 8) {
+    chunkBytes = (mdelong)mdeGetLE32(hdr + 4);
+    pos += 8;
+    if (!memcmp(hdr, "data", 4)) {
+      sf->dataOffset = pos;
+      /* files still being written (or > 4GB) can have a bogus size here:
+       * 0xFFFFFFFF is the usual way of saying it's too big to say */
+      dataBytes = chunkBytes == 0xFFFFFFFFLL && ds64Bytes > 0 ? ds64Bytes :
+        chunkBytes;
+      if (dataBytes <= 0 || dataBytes == 0xFFFFFFFFLL ||
+          dataBytes > fileBytes - pos)
+        dataBytes = fileBytes - pos;
+      break;
+    }
+    /* RF64: the data chunk's real size follows the RIFF's */
+    if (!memcmp(hdr, "ds64", 4) && chunkBytes >= 16) {
+      if (fread(hdr, 1, 16, fp) != 16)
+        break;
+      ds64Bytes = (mdelong)mdeGetLE32(hdr + 8) |
+        ((mdelong)mdeGetLE32(hdr + 12) << 32);
+    }
+    if (!memcmp(hdr, "fmt ", 4)) {
+      n = chunkBytes < 40 ? (size_t)chunkBytes : 40;
+      if (n < 16 || fread(hdr, 1, n, fp) != n)
+        break;
+      tag = (int)mdeGetLE16(hdr);
+      sf->channels = (int)mdeGetLE16(hdr + 2);
+      sf->samplingRate = (mdefloat)mdeGetLE32(hdr + 4);
+      bits = (int)mdeGetLE16(hdr + 14);
+      /* WAVE_FORMAT_EXTENSIBLE: the real tag starts the sub-format GUID */
+      if (tag == 0xFFFE && n >= 26)
+        tag = (int)mdeGetLE16(hdr + 24);
+    }
+    pos += chunkBytes + (chunkBytes & 1);
+    mdeSeek(fp, pos, SEEK_SET);
+  }
+  fclose(fp);
+  if (!sf->dataOffset || sf->channels < 1 || bits < 8)
+    return -1;
+  if (tag == 1)
+    sf->format = bits == 16 ? SF_PCM16 : bits == 24 ? SF_PCM24 :
+      bits == 32 ? SF_PCM32 : SF_UNKNOWN;
+  else if (tag == 3)
+    sf->format = bits == 32 ? SF_FLOAT32 : bits == 64 ? SF_FLOAT64 :
+      SF_UNKNOWN;
+  if (sf->format == SF_UNKNOWN)
+    return -2;
+  sf->bytesPerSample = bits / 8;
+  sf->nFrames = dataBytes / (sf->bytesPerSample * sf->channels);
+  return sf->nFrames > 0 ? 0 : -1;
+}
+
+/*****************************************************************************/
+
+/** Take -path- to be a headerless dump of interleaved 32-bit floats with
+ *  -channels- channels at -rate- Hz (0 for ours). Returns 0 on success, -1
+ *  if the file can't be read or is too short to hold a single frame.
+ *  */
+
+int mdeGranularRawSoundFileInfo(char* path, int channels, mdefloat rate,
+                                mdeGranularSoundFile* sf)
+{
+  FILE* fp;
+  mdelong fileBytes;
+
+  memset(sf, 0, sizeof(mdeGranularSoundFile));
+  if (channels < 1 || !(fp = fopen(path, "rb")))
+    return -1;
+  mdeSeek(fp, 0, SEEK_END);
+  fileBytes = mdeTell(fp);
+  fclose(fp);
+  sf->format = SF_FLOAT32;
+  sf->channels = channels;
+  sf->bytesPerSample = 4;
+  sf->samplingRate = rate > 0 ? rate : 0;
+  sf->nFrames = fileBytes / (4 * channels);
+  return sf->nFrames > 0 ? 0 : -1;
+}
+
+/*****************************************************************************/
+
+/** What open and stream use to find out about -path-, complaining if it's no
+ *  good. Files without a WAV header used to be taken for raw mono floats
+ *  whatever they were, which for anything but a headerless dump just gave
+ *  noise; now they're refused unless -rawChannels- says how many
+ *  interleaved float channels there are (and -rawRate- their rate, if it's
+ *  not ours). Returns 0 on success.
+ *  */
+
+int mdeGranularSoundFileInfo(char* path, int rawChannels, mdefloat rawRate,
+                             mdeGranularSoundFile* sf)
+{
+  int err = mdeGranularReadSoundFileInfo(path, sf);
+
+  if (err == -3 && rawChannels > 0)
+    err = mdeGranularRawSoundFileInfo(path, rawChannels, rawRate, sf);
+  if (err)
+    mdeGranularError(err == -2 ? "mdeGranular~: %s: unsupported sample format"
+                     : err == -3 ? "mdeGranular~: %s: not a WAV file (give "
+                     "the number of channels to read it as raw floats)"
+                     : "mdeGranular~: %s: can't read sound file", path);
+  return err ? 1 : 0;
+}
+
+/*****************************************************************************/
+
+/** Convert one sample of the sound file data at -src- into an mdefloat. */
+
+mdefloat mdeGranularDecodeSample(const unsigned char* src, t_sfformat format)
+{
+  float f;
+  double d;
+
+  switch (format) {
+  case SF_PCM16:
+    return (mdefloat)((int16_t)mdeGetLE16(src) / 32768.0);
+  case SF_PCM24:
+    /* put the 24 bits at the top of an int32 so the sign comes for free */
+    return (mdefloat)((int32_t)(((uint32_t)src[0] << 8) |
+                                ((uint32_t)src[1] << 16) |
+                                ((uint32_t)src[2] << 24))
+                      / 2147483648.0);
+  case SF_PCM32:
+    return (mdefloat)((int32_t)mdeGetLE32(src) / 2147483648.0);
+  case SF_FLOAT32:
+    memcpy(&f, src, sizeof(float));
+    return (mdefloat)f;
+  case SF_FLOAT64:
+    memcpy(&d, src, sizeof(double));
+    return (mdefloat)d;
+  default:
+    return (mdefloat)0.0;
+  }
+}
+
+/*****************************************************************************/
+
+/** Convert -nFrames- frames of the sound file data at -src- (which points to
+ *  the start of a frame) into mdefloats in -dst-, keeping the channels
+ *  interleaved.
+ *  */
+
+void mdeGranularDecodeSamples(const unsigned char* src,
+                              mdeGranularSoundFile* sf, mdelong nFrames,
+                              mdefloat* dst)
+{
+  mdelong n = nFrames * sf->channels;
+  mdelong i;
+
+  for (i = 0; i < n; ++i, src += sf->bytesPerSample)
+    *dst++ = mdeGranularDecodeSample(src, sf->format);
+}
+
+/*****************************************************************************/
+
+/** Map the whole of m->path read-only into memory. Returns 0 on success. */
+
+int mdeGranularMapFile(mdeGranularMapping* m)
+{
+#ifdef _WIN32
+  LARGE_INTEGER size;
+  HANDLE file = CreateFileA(m->path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+  HANDLE map;
+
+  if (file == INVALID_HANDLE_VALUE)
+    return -1;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart < 1 ||
+      !(map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL))) {
+    CloseHandle(file);
+    return -1;
+  }
+  m->base = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+  if (!m->base) {
+    CloseHandle(map);
+    CloseHandle(file);
+    return -1;
+  }
+  m->bytes = (size_t)size.QuadPart;
+  m->file = file;
+  m->map = map;
+#else
+  struct stat st;
+  int fd = open(m->path, O_RDONLY);
+
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) || st.st_size < 1) {
+    close(fd);
+    return -1;
+  }
+  m->base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  /* the mapping keeps its own reference to the file */
+  close(fd);
+  if (m->base == MAP_FAILED) {
+    m->base = NULL;
+    return -1;
+  }
+  m->bytes = (size_t)st.st_size;
+  /* grains jump about all over the place so reading ahead is wasted
+   * (mdeGranularAdviseMapping asks for the part we'll actually use) */
+  madvise(m->base, m->bytes, MADV_RANDOM);
+#endif
+  return 0;
+}
+
+/*****************************************************************************/
+
+void mdeGranularUnmapFile(mdeGranularMapping* m)
+{
+  if (!m->base)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(m->base);
+  CloseHandle((HANDLE)m->map);
+  CloseHandle((HANDLE)m->file);
+#else
+  munmap(m->base, m->bytes);
+#endif
+  m->base = NULL;
+}
+
+/*****************************************************************************/
+
+/** Just enough threading for the background workers (e.g. the streaming
+ *  reader): native threads on Windows, pthreads elsewhere. */
+
+typedef struct _mdeThreadArgs
+{
+  void (*fn)(void*);
+  void* arg;
+} mdeThreadArgs;
+
+#ifdef _WIN32
+static DWORD WINAPI mdeThreadTrampoline(LPVOID p)
+#else
+static void* mdeThreadTrampoline(void* p)
+#endif
+{
+  mdeThreadArgs args = *(mdeThreadArgs*)p;
+
+  free(p);
+  /* only the main thread can post */
+  LogDefer = 1;
+  args.fn(args.arg);
+  return 0;
+}
+
+/** Start -fn(arg)- in a new thread. Returns 0 on success. */
+
+static int mdeThreadStart(mdeThread* t, void (*fn)(void*), void* arg)
+{
+  mdeThreadArgs* args = malloc(sizeof(mdeThreadArgs));
+
+  if (!args)
+    return 1;
+  args->fn = fn;
+  args->arg = arg;
+#ifdef _WIN32
+  *t = CreateThread(NULL, 0, mdeThreadTrampoline, args, 0, NULL);
+  if (*t)
+    return 0;
+#else
+  if (!pthread_create(t, NULL, mdeThreadTrampoline, args))
+    return 0;
+#endif
+  free(args);
+  return 1;
+}
+
+static void mdeThreadJoin(mdeThread t)
+{
+#ifdef _WIN32
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+#else
+  pthread_join(t, NULL);
+#endif
+}
+
+static void mdeSleepMS(int ms)
+{
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep(&ts, NULL);
+#endif
+}
+
+/*****************************************************************************/
+
+/** Streaming: for files too big even to map, a reader thread keeps a cache of
+ *  decoded blocks around the part of the file we're granulating. Block b of
+ *  the file is always kept in cache slot b % STREAMCACHEBLOCKS, which means
+ *  file frame f is at cache[f % cacheFrames] so grains can read the cache
+ *  exactly as they would a circular live buffer. The audio thread never
+ *  waits for the disk: grains are only started in blocks that are already
+ *  resident (see mdeGranularGrainInit), and pin them whilst they play so that
+ *  the reader can't reuse their slots from under them. */
+
+struct _mdeGranularStream
+{
+  char path[MAXSOUNDFILEPATH];
+  mdeGranularSoundFile info;
+  /** STREAMCACHEBLOCKS * STREAMBLOCKFRAMES decoded (interleaved) frames */
+  mdefloat* cache;
+  mdelong cacheFrames;
+  /** which file block each cache slot holds: -1 if empty or being loaded */
+  _Atomic(mdelong) slotBlock[STREAMCACHEBLOCKS];
+  /** how many grains are reading from each slot (audio thread only writes) */
+  atomic_int slotPins[STREAMCACHEBLOCKS];
+  /** the range of file frames the engine would like to have resident */
+  _Atomic(mdelong) wantStart;
+  _Atomic(mdelong) wantEnd;
+  atomic_int quit;
+  /** the rest is only touched by the reader thread */
+  FILE* fp;
+  unsigned char* readBuf;
+  mdeThread thread;
+};
+
+/*****************************************************************************/
+
+/** Read block -b- of the file into its cache slot, unless grains are still
+ *  reading the block that's there. Returns 1 if it was loaded. */
+
+int mdeGranularStreamLoad(mdeGranularStream* s, mdelong b)
+{
+  mdelong slot = b % STREAMCACHEBLOCKS;
+  mdelong old;
+  mdelong frameBytes = s->info.bytesPerSample * s->info.channels;
+  mdelong frames = s->info.nFrames - b * STREAMBLOCKFRAMES;
+  mdefloat* dst = s->cache + slot * STREAMBLOCKFRAMES * s->info.channels;
+  size_t got = 0;
+
+  if (frames > STREAMBLOCKFRAMES)
+    frames = STREAMBLOCKFRAMES;
+  /* mark the slot as in flux before we overwrite it, then look for pins:
+   * a grain pins before it checks residency (mdeGranularStreamPin) so either
+   * it sees the -1 and goes elsewhere or we see its pin and back off */
+  old = atomic_exchange(&s->slotBlock[slot], (mdelong)-1);
+  if (atomic_load(&s->slotPins[slot])) {
+    atomic_store(&s->slotBlock[slot], old);
+    return 0;
+  }
+  if (!mdeSeek(s->fp, s->info.dataOffset + b * STREAMBLOCKFRAMES * frameBytes,
+               SEEK_SET))
+    got = fread(s->readBuf, (size_t)frameBytes, (size_t)frames, s->fp);
+  mdeGranularDecodeSamples(s->readBuf, &s->info, (mdelong)got, dst);
+  silence(dst + got * s->info.channels,
+          (STREAMBLOCKFRAMES - (mdelong)got) * s->info.channels);
+  atomic_store(&s->slotBlock[slot], b);
+  return 1;
+}
+
+/*****************************************************************************/
+
+/** The reader thread: keep loading whichever wanted block is missing,
+ *  nearest the middle of the wanted range first, and nap when there's
+ *  nothing to do. */
+
+void mdeGranularStreamReader(void* arg)
+{
+  mdeGranularStream* s = (mdeGranularStream*)arg;
+  mdelong first;
+  mdelong last;
+  mdelong mid;
+  mdelong b;
+  mdelong i;
+  mdelong missing;
+
+  while (!atomic_load(&s->quit)) {
+    first = atomic_load(&s->wantStart) / STREAMBLOCKFRAMES;
+    last = atomic_load(&s->wantEnd) / STREAMBLOCKFRAMES;
+    mid = (first + last) / 2;
+    missing = -1;
+    for (i = 0; i <= last - first && missing < 0; ++i) {
+      /* mid, mid+1, mid-1, mid+2... */
+      b = mid + ((i & 1) ? (i + 1) / 2 : -(i / 2));
+      if (b >= first && b <= last &&
+          atomic_load(&s->slotBlock[b % STREAMCACHEBLOCKS]) != b)
+        missing = b;
+    }
+    /* if its slot's still pinned, wait for the grains to move on */
+    if (missing < 0 || !mdeGranularStreamLoad(s, missing))
+      mdeSleepMS(5);
+  }
+}
+
+/*****************************************************************************/
+
+/** Ask the reader thread for file frames -start- to -end-: as many of them as
+ *  the cache will hold (less a block so that the one being loaded never
+ *  belongs to the range), centred on the middle of the range. */
+
+void mdeGranularStreamWant(mdeGranularStream* s, mdelong start, mdelong end)
+{
+  mdelong max = s->cacheFrames - STREAMBLOCKFRAMES;
+  mdelong mid;
+
+  if (start > end) {
+    mid = start;
+    start = end;
+    end = mid;
+  }
+  /* room for the interpolation either side */
+  start = start > 2 ? start - 2 : 0;
+  end += 3;
+  if (end - start > max) {
+    mid = start + (end - start) / 2;
+    start = mid - max / 2;
+    end = start + max;
+  }
+  if (end >= s->info.nFrames)
+    end = s->info.nFrames - 1;
+  atomic_store(&s->wantStart, start);
+  atomic_store(&s->wantEnd, end);
+}
+
+/*****************************************************************************/
+
+/** Whether all file frames from -first- to -last- are in the cache. */
+
+int mdeGranularStreamResident(mdeGranularStream* s, mdelong first,
+                              mdelong last)
+{
+  mdelong b;
+
+  if (first < atomic_load(&s->wantStart) || last > atomic_load(&s->wantEnd))
+    return 0;
+  for (b = first / STREAMBLOCKFRAMES; b <= last / STREAMBLOCKFRAMES; ++b)
+    if (atomic_load(&s->slotBlock[b % STREAMCACHEBLOCKS]) != b)
+      return 0;
+  return 1;
+}
+
+/*****************************************************************************/
+
+/** Pin the cache slots holding file frames -first- to -last- for grain -gg-
+ *  (audio thread). Returns 1 if they're all resident, otherwise leaves
+ *  nothing pinned and returns 0. */
+
+int mdeGranularStreamPin(mdeGranularStream* s, mdeGranularGrain* gg,
+                         mdelong first, mdelong last)
+{
+  mdelong b;
+
+  /* the slots go by block, but what's wanted (and so resident) needn't
+   * start or end on one */
+  gg->pinFirst = first / STREAMBLOCKFRAMES;
+  gg->pinLast = last / STREAMBLOCKFRAMES;
+  for (b = gg->pinFirst; b <= gg->pinLast; ++b)
+    atomic_fetch_add(&s->slotPins[b % STREAMCACHEBLOCKS], 1);
+  gg->pinned = 1;
+  if (mdeGranularStreamResident(s, first, last))
+    return 1;
+  mdeGranularStreamUnpin(s, gg);
+  return 0;
+}
+
+/*****************************************************************************/
+
+/** Let the reader have grain -gg-'s cache slots back (if it has any). */
+
+void mdeGranularStreamUnpin(mdeGranularStream* s, mdeGranularGrain* gg)
+{
+  mdelong b;
+
+  if (!gg->pinned)
+    return;
+  gg->pinned = 0;
+  if (s)
+    for (b = gg->pinFirst; b <= gg->pinLast; ++b)
+      atomic_fetch_sub(&s->slotPins[b % STREAMCACHEBLOCKS], 1);
+}
+
+/*****************************************************************************/
+
+/** Unpin all our grains: before they're freed, or the stream is. Only call
+ *  this when we're OFF (i.e. no grains are being initialised). */
+
+void mdeGranularStreamUnpinAll(mdeGranular* g)
+{
+  int i;
+
+  if (g->grains)
+    for (i = 0; i < g->maxVoices; ++i)
+      mdeGranularStreamUnpin(g->stream, &g->grains[i]);
+}
+
+/*****************************************************************************/
+
+/** The range of file frames the cache is presently being filled with. */
+
+void mdeGranularStreamWindow(mdeGranularStream* s, mdelong* start,
+                             mdelong* end)
+{
+  *start = atomic_load(&s->wantStart);
+  *end = atomic_load(&s->wantEnd);
+}
+
+/*****************************************************************************/
+
+/** Granulate -path- by streaming it from disk rather than loading or mapping
+ *  it, for sound files bigger than memory. Any sample format that open
+ *  accepts will do, raw floats included. Returns 0 on success.
+ *  */
+
+int mdeGranularStreamFile(mdeGranular* g, char* path, int rawChannels,
+                          mdefloat rawRate)
+{
+  mdeGranularStream* s;
+  mdeGranularSoundFile sf;
+  int i;
+
+  if (g->status != OFF) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              Can't stream a sound file whilst object is running ");
+      post("              or ramping down. Ignoring.");
+    }
+    return 1;
+  }
+  if (mdeGranularSoundFileInfo(path, rawChannels, rawRate, &sf))
+    return 1;
+  s = mdeCalloc(1, sizeof(mdeGranularStream), "mdeGranularStreamFile",
+                g->warnings);
+  if (!s)
+    return 1;
+  strncpy(s->path, path, MAXSOUNDFILEPATH - 1);
+  s->info = sf;
+  s->cacheFrames = (mdelong)STREAMCACHEBLOCKS * STREAMBLOCKFRAMES;
+  s->cache = mdeCalloc(s->cacheFrames * sf.channels, sizeof(mdefloat),
+                       "mdeGranularStreamFile", g->warnings);
+  s->readBuf = mdeCalloc(STREAMBLOCKFRAMES, sf.bytesPerSample * sf.channels,
+                         "mdeGranularStreamFile", g->warnings);
+  s->fp = fopen(path, "rb");
+  for (i = 0; i < STREAMCACHEBLOCKS; ++i) {
+    atomic_init(&s->slotBlock[i], (mdelong)-1);
+    atomic_init(&s->slotPins[i], 0);
+  }
+  atomic_init(&s->wantStart, (mdelong)0);
+  atomic_init(&s->wantEnd, (mdelong)0);
+  atomic_init(&s->quit, 0);
+  if (!s->cache || !s->readBuf || !s->fp ||
+      mdeThreadStart(&s->thread, mdeGranularStreamReader, s)) {
+    mdeGranularError("mdeGranular~: %s: can't start streaming", path);
+    if (s->fp)
+      fclose(s->fp);
+    if (s->cache)
+      mdeFree(s->cache);
+    if (s->readBuf)
+      mdeFree(s->readBuf);
+    mdeFree(s);
+    return 1;
+  }
+  if (sf.samplingRate && sf.samplingRate != g->samplingRate && g->warnings)
+    post("mdeGranular~: %s is at %fHz but we're running at %fHz", path,
+         sf.samplingRate, g->samplingRate);
+  mdeGranularCloseFile(g);
+  g->stream = s;
+  strncpy(g->BufferName, path, sizeof(g->BufferName) - 1);
+  return mdeGranularReopenFile(g, path) ? 0 : 1;
+}
+
+/*****************************************************************************/
+
+void mdeGranularStreamFree(mdeGranularStream* s)
+{
+  atomic_store(&s->quit, 1);
+  mdeThreadJoin(s->thread);
+  fclose(s->fp);
+  mdeFree(s->readBuf);
+  mdeFree(s->cache);
+  mdeFree(s);
+}
+
+/*****************************************************************************/
+
+/** Granulate the sound file at -path- straight from a memory mapping, so that
+ *  even multi-gigabyte files are available immediately and share their pages
+ *  with anything else reading them. The samples can only be used in place if
+ *  they're 32-bit floats and mdefloat is the same (i.e. in PD); anything else
+ *  is converted into our live buffer, as with Max buffer~s. Multichannel
+ *  files stay interleaved (see SourceChannel). A file without a WAV header
+ *  is only accepted if -rawChannels- is given (see SoundFileInfo). Returns 0
+ *  on success.
+ *  */
+
+int mdeGranularOpenFile(mdeGranular* g, char* path, int rawChannels,
+                        mdefloat rawRate)
+{
+  mdeGranularMapping* m;
+  mdeGranularSoundFile sf;
+
+  if (g->status != OFF) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              Can't open a sound file whilst object is running ");
+      post("              or ramping down. Ignoring.");
+    }
+    return 1;
+  }
+  if (mdeGranularSoundFileInfo(path, rawChannels, rawRate, &sf))
+    return 1;
+  m = mdeCalloc(1, sizeof(mdeGranularMapping), "mdeGranularOpenFile",
+                g->warnings);
+  if (!m)
+    return 1;
+  strncpy(m->path, path, MAXSOUNDFILEPATH - 1);
+  m->info = sf;
+  if (mdeGranularMapFile(m) ||
+      (size_t)(sf.dataOffset + sf.nFrames * sf.bytesPerSample * sf.channels)
+      > m->bytes) {
+    mdeGranularError("mdeGranular~: %s: can't map sound file", path);
+    mdeGranularUnmapFile(m);
+    mdeFree(m);
+    return 1;
+  }
+  if (sizeof(mdefloat) == sizeof(float) && sf.format == SF_FLOAT32 &&
+      !(sf.dataOffset % sizeof(float)))
+    m->samples = (mdefloat*)((char*)m->base + sf.dataOffset);
+  else if (g->warnings) {
+    post("mdeGranular~: %s can't be granulated in place ", path);
+    post("              (only 32-bit float files can, in PD) so it ");
+    post("              will be copied into the live sample buffer.");
+  }
+  if (sf.samplingRate && sf.samplingRate != g->samplingRate && g->warnings)
+    post("mdeGranular~: %s is at %fHz but we're running at %fHz", path,
+         sf.samplingRate, g->samplingRate);
+  mdeGranularCloseFile(g);
+  g->mapping = m;
+  strncpy(g->BufferName, path, sizeof(g->BufferName) - 1);
+  return mdeGranularReopenFile(g, path) ? 0 : 1;
+}
+
+/*****************************************************************************/
+
+/** If -path- is the file we already have mapped or are streaming,
+ *  (re)initialise granulation of it (e.g. when the audio is restarted) and
+ *  return 1, otherwise 0. */
+
+int mdeGranularReopenFile(mdeGranular* g, char* path)
+{
+  mdeGranularMapping* m = g->mapping;
+  mdeGranularStream* s = g->stream;
+  mdelong n;
+
+  if (s && !strcmp(s->path, path)) {
+    /* start and end are in file frames, but we read from the cache */
+    mdeGranularInit3(g, s->cache, samples2ms(g->samplingRate, s->info.nFrames),
+                     s->info.nFrames, s->info.channels);
+    g->nReadSamples = s->cacheFrames;
+    return 1;
+  }
+  if (!m || strcmp(m->path, path))
+    return 0;
+  if (m->samples)
+    mdeGranularInit3(g, m->samples,
+                     samples2ms(g->samplingRate, m->info.nFrames),
+                     m->info.nFrames, m->info.channels);
+  else {
+    /* as with Max buffer~s, copy into our own buffer */
+    mdeGranularLeaveLiveShare(g);
+    n = m->info.nFrames;
+    /* whilst we're off nothing's reading the live buffer so grow it to hold
+     * the whole file rather than cutting it short */
+    if (n * m->info.channels > g->nAllocatedBufferSamples &&
+        g->status == OFF) {
+      mdefloat* grown = mdeCalloc(n * m->info.channels, sizeof(mdefloat),
+                                  "mdeGranularReopenFile", g->warnings);
+      if (grown) {
+        if (g->theSamples)
+          mdeFree(g->theSamples);
+        g->theSamples = grown;
+        g->nAllocatedBufferSamples = n * m->info.channels;
+        g->AllocatedBufferMS = samples2ms(g->samplingRate,
+                                          g->nAllocatedBufferSamples);
+      }
+    }
+    if (n * m->info.channels > g->nAllocatedBufferSamples) {
+      mdeGranularError("mdeGranular~: %s: the live sample buffer is only "
+                       "%fms so only its start will be used", m->path,
+                       g->AllocatedBufferMS);
+      n = g->nAllocatedBufferSamples / m->info.channels;
+    }
+    if (!g->theSamples || n < 1)
+      return 0;
+    mdeGranularDecodeSamples((unsigned char*)m->base + m->info.dataOffset,
+                             &m->info, n, g->theSamples);
+    mdeGranularInit3(g, g->theSamples, samples2ms(g->samplingRate, n),
+                     n, m->info.channels);
+  }
+  return 1;
+}
+
+/*****************************************************************************/
+
+/** Forget about our mapped or streamed sound file (if any). */
+
+void mdeGranularCloseFile(mdeGranular* g)
+{
+  mdeGranularMapping* m = g->mapping;
+
+  if (g->stream) {
+    if (g->samples == g->stream->cache)
+      g->samples = NULL;
+    mdeGranularStreamUnpinAll(g);
+    mdeGranularStreamFree(g->stream);
+    g->stream = NULL;
+  }
+  if (!m)
+    return;
+  /* don't leave grains reading from memory that's no longer there */
+  if (m->samples && g->samples == m->samples)
+    g->samples = NULL;
+  g->mapping = NULL;
+  mdeGranularUnmapFile(m);
+  mdeFree(m);
+}
+
+/*****************************************************************************/
+
+/** Tell the kernel (or our reader thread, if streaming) which part of the
+ *  file grains will be read from (i.e. the samplesStart/samplesEnd or Portion
+ *  window) so it can page it in before the grains get there. */
+
+void mdeGranularAdviseMapping(mdeGranular* g)
+{
+#ifndef _WIN32
+  mdeGranularMapping* m = g->mapping;
+  long page = sysconf(_SC_PAGESIZE);
+  mdelong first;
+  mdelong last;
+  char* start;
+  char* end;
+#endif
+
+  if (g->stream) {
+    mdeGranularStreamWant(g->stream, g->samplesStart, g->samplesEnd);
+    return;
+  }
+#ifndef _WIN32
+  if (!m || !m->samples || g->samples != m->samples || page < 1)
+    return;
+  first = g->samplesStart < g->samplesEnd ? g->samplesStart : g->samplesEnd;
+  last = g->samplesStart < g->samplesEnd ? g->samplesEnd : g->samplesStart;
+  /* the 4-point interpolation reads a couple of samples either side */
+  first = first > 2 ? first - 2 : 0;
+  last = last + 3 < m->info.nFrames ? last + 3 : m->info.nFrames;
+  start = (char*)(m->samples + first * m->info.channels);
+  end = (char*)(m->samples + last * m->info.channels);
+  start -= (start - (char*)m->base) % page;
+  madvise(start, (size_t)(end - start), MADV_WILLNEED);
+#endif
+}
+
+/*****************************************************************************/
+
+
+/****************************************************************************
+ *************************                    *********************************
+ *************************     SMOOTHING      *********************************
+ *************************                    *********************************
+ *****************************************************************************/
+
+
+/*****************************************************************************/
+
+/** Go (and stay) straight to -value-. */
+
+void mdeSmootherJump(mdeSmoother* s, mdefloat value)
+{
+  s->value = s->from = s->target = value;
+  s->length = s->remaining = 0;
+  s->shape = SMOOTH_LINEAR;
+  s->table = NULL;
+  s->step = s->coef = (mdefloat)0.0;
+}
+
+/*****************************************************************************/
+
+/** Move from wherever we are now to -target- over -samples- samples in the
+ *  given -shape- (SMOOTH_TABLE needs a -table- of that many samples rising
+ *  from 0 to 1, SMOOTH_TABLEDOWN one falling from 1 to 0). Can be called
+ *  whilst we're still moving somewhere else. */
+
+void mdeSmootherSetTarget(mdeSmoother* s, mdefloat target, long samples,
+                          t_smoothshape shape, const mdefloat* table)
+{
+  if (samples < 1 || (shape >= SMOOTH_TABLE && !table)) {
+    mdeSmootherJump(s, target);
+    return;
+  }
+  s->from = s->value;
+  s->target = target;
+  s->length = s->remaining = samples;
+  s->shape = shape;
+  s->table = table;
+  s->step = (target - s->value) / (mdefloat)samples;
+  s->coef = (mdefloat)exp(log(SMOOTHEXPFLOOR) / (double)samples);
+}
+
+/*****************************************************************************/
+
+int mdeSmootherMoving(mdeSmoother* s)
+{
+  return s->remaining > 0;
+}
+
+/*****************************************************************************/
+
+/** Write the next -n- values into -out-. Each shape is one loop with no
+ *  branches or (bar the exponential) dependencies between samples, so the
+ *  compiler can vectorize it; once the target's reached the rest of the block
+ *  is filled with it. Returns whether we're still moving. */
+
+int mdeSmootherBlock(mdeSmoother* s, mdefloat* out, long n)
+{
+  long i;
+  long m = s->remaining < n ? s->remaining : n;
+  mdefloat from = s->value;
+  mdefloat distance;
+  mdefloat p;
+  const mdefloat* table;
+
+  if (m > 0) {
+    switch (s->shape) {
+    case SMOOTH_LINEAR:
+      for (i = 0; i < m; ++i)
+        out[i] = from + s->step * (mdefloat)(i + 1);
+      break;
+    case SMOOTH_EXPONENTIAL:
+      distance = from - s->target;
+      p = s->coef;
+      for (i = 0; i < m; ++i) {
+        out[i] = s->target + distance * p;
+        p *= s->coef;
+      }
+      break;
+    case SMOOTH_TABLE:
+      table = s->table + (s->length - s->remaining);
+      distance = s->target - s->from;
+      for (i = 0; i < m; ++i)
+        out[i] = s->from + distance * table[i];
+      break;
+    case SMOOTH_TABLEDOWN:
+      table = s->table + (s->length - s->remaining);
+      distance = s->from - s->target;
+      for (i = 0; i < m; ++i)
+        out[i] = s->target + distance * table[i];
+      break;
+    }
+    s->remaining -= m;
+    if (s->remaining)
+      s->value = out[m - 1];
+    else
+      /* no rounding errors at the end */
+      out[m - 1] = s->value = s->target;
+  }
+  for (i = m; i < n; ++i)
+    out[i] = s->value;
+  return s->remaining > 0;
+}
+
+/*****************************************************************************/
+
+
+/****************************************************************************
+ *************************                    *********************************
+ *************************       SCENES       *********************************
+ *************************                    *********************************
+ *****************************************************************************/
+
+
+/*****************************************************************************/
+
+/** Keep g's parameters (and, with -grains-, its voices) in -sc-, and its
+ *  layers' in sc's layers, allocating whatever's needed: see
+ *  mdeGranularSnapshot. Returns 0 on success. */
+
+static int mdeGranularSceneFill(mdeGranular* g, mdeGranularScene* sc,
+                                int grains)
+{
+  long rampSize = g->rampLenSamples * 2;
+  int i;
+
+  if (!sc->channelWeights)
+    sc->channelWeights = mdeCalloc(g->numChannels, sizeof(mdefloat),
+                                   "mdeGranularSnapshot", g->warnings);
+  if (rampSize > sc->rampCapacity) {
+    if (sc->ramp)
+      mdeFree(sc->ramp);
+    sc->ramp = mdeCalloc(rampSize, sizeof(mdefloat), "mdeGranularSnapshot",
+                         g->warnings);
+    sc->rampCapacity = sc->ramp ? rampSize : 0;
+  }
+  if (grains && sc->maxVoices != g->maxVoices) {
+    if (sc->grains)
+      mdeFree(sc->grains);
+    if (sc->pool)
+      mdeFree(sc->pool);
+    sc->grains = mdeCalloc(g->maxVoices, sizeof(mdeGranularGrain),
+                           "mdeGranularSnapshot", g->warnings);
+    sc->pool = mdeCalloc(g->maxVoices, sizeof(int), "mdeGranularSnapshot",
+                         g->warnings);
+    sc->maxVoices = sc->grains && sc->pool ? g->maxVoices : 0;
+  }
+  if (!sc->channelWeights || (rampSize && !sc->ramp))
+    return 1;
+  if (sc->numLayers != g->numLayers) {
+    for (i = 0; i < sc->numLayers; ++i)
+      mdeGranularSceneClear(&sc->layers[i]);
+    if (sc->layers)
+      mdeFree(sc->layers);
+    sc->layers = NULL;
+    sc->numLayers = 0;
+    if (g->numLayers) {
+      sc->layers = mdeCalloc(g->numLayers, sizeof(mdeGranularScene),
+                             "mdeGranularSnapshot", g->warnings);
+      if (!sc->layers)
+        return 1;
+      sc->numLayers = g->numLayers;
+    }
+  }
+  for (i = 0; i < sc->numLayers; ++i)
+    if (mdeGranularSceneFill(&g->layers[i], &sc->layers[i], grains))
+      return 1;
+  sc->activeVoices = g->activeVoices;
+  sc->transpositionOffsetST = g->transpositionOffsetST;
+  sc->transpositionOffset = g->transpositionOffset;
+  sc->numTranspositions = g->numTranspositions;
+  memcpy(sc->transpositions, g->transpositions, sizeof(g->transpositions));
+  memcpy(sc->srcs, g->srcs, sizeof(g->srcs));
+  memcpy(sc->transpositionWeights, g->transpositionWeights,
+         sizeof(g->transpositionWeights));
+  sc->numTranspositionWeights = g->numTranspositionWeights;
+  sc->octaveSize = g->octaveSize;
+  sc->octaveDivisions = g->octaveDivisions;
+  sc->grainLengthMS = g->grainLengthMS;
+  sc->grainLength = g->grainLength;
+  sc->grainLengthDeviation = g->grainLengthDeviation;
+  sc->activeChannels = g->activeChannels;
+  if (g->channelWeights)
+    memcpy(sc->channelWeights, g->channelWeights,
+           g->numChannels * sizeof(mdefloat));
+  sc->numChannelWeights = g->numChannelWeights;
+  sc->samplesStartMS = g->samplesStartMS;
+  sc->samplesEndMS = g->samplesEndMS;
+  sc->portionPosition = g->portionPosition;
+  sc->portionWidth = g->portionWidth;
+  memcpy(sc->rampType, g->rampType, RAMPTYPELEN);
+  sc->rampLenMS = g->rampLenMS;
+  sc->rampLenSamples = g->rampUp ? g->rampLenSamples : 0;
+  if (g->rampUp)
+    memcpy(sc->ramp, g->rampUp, rampSize * sizeof(mdefloat));
+  sc->density = g->density;
+  sc->grainAmp = g->grainAmp.target;
+  sc->grainAmpSmoothMS = g->grainAmpSmoothMS;
+  sc->grainAmpShape = g->grainAmpShape;
+  sc->sourceChannelMode = g->sourceChannelMode;
+  sc->sourceChannel = g->sourceChannel;
+  sc->panMode = g->panMode;
+  sc->panCentre = g->panCentre;
+  sc->panWidth = g->panWidth;
+  sc->ambiOrder = g->ambiOrder;
+  sc->ambiAzimuth = g->ambiAzimuth;
+  sc->ambiAzimuthWidth = g->ambiAzimuthWidth;
+  sc->ambiElevation = g->ambiElevation;
+  sc->ambiElevationWidth = g->ambiElevationWidth;
+  sc->onsetRate = g->onsetRate;
+  sc->onsetJitter = g->onsetJitter;
+  sc->stealMode = g->stealMode;
+  sc->idleAfterMS = g->idleAfterMS;
+  sc->hasGrains = grains && sc->maxVoices && g->grains && g->pool;
+  if (sc->hasGrains) {
+    memcpy(sc->grains, g->grains, g->maxVoices * sizeof(mdeGranularGrain));
+    memcpy(sc->pool, g->pool, g->maxVoices * sizeof(int));
+    sc->nPlaying = g->nPlaying;
+    sc->pendingOnsets = g->pendingOnsets;
+    sc->onsetPhase = g->onsetPhase;
+  }
+  return 0;
+}
+
+/*****************************************************************************/
+
+/** snapshot <scene> [grains]: keep the parameters as they are now in -scene-
+ *  (1 to MAXSCENES) so that recall can bring them all back at once. With
+ *  grains the voices are kept too, so that recall carries on exactly from
+ *  here. Each layer's are kept as well, and recall and morph see to the
+ *  layers the scene has. This is where all the allocation happens. Returns 0
+ *  on success. */
+
+int mdeGranularSnapshot(mdeGranular* g, int scene, char* what)
+{
+  mdeGranularScene* sc;
+  mdeGranularScene* old;
+  int grains = what && !strcmp(what, "grains");
+  int i;
+
+  if (scene < 1 || scene > MAXSCENES) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              snapshot: scene should be between 1 and %d, not %d."
+           " Ignoring.", MAXSCENES, scene);
+    }
+    return 1;
+  }
+  if (what && *what && !grains && g->warnings) {
+    post("mdeGranular~:");
+    post("              snapshot: unknown option %s (grains). Ignoring it.",
+         what);
+  }
+  /* fill the spare, which the audio thread can't see, then publish it */
+  if (!g->sceneSpare)
+    g->sceneSpare = mdeCalloc(1, sizeof(mdeGranularScene),
+                              "mdeGranularSnapshot", g->warnings);
+  sc = g->sceneSpare;
+  if (!sc)
+    return 1;
+  if (mdeGranularSceneFill(g, sc, grains))
+    return 1;
+  old = atomic_exchange_explicit(&g->scenes[scene - 1], sc,
+                                 memory_order_acq_rel);
+  /* the audio thread can only have picked the old one up before the swap, so
+   * this waits for the rest of one tick at most */
+  for (i = 0; old && i < SCENEREADERS; ++i)
+    while (atomic_load(&g->sceneReaders[i]) == old)
+      mdeSleepMS(1);
+  g->sceneSpare = old;
+  return 0;
+}
+
+/*****************************************************************************/
+
+/** Get hold of scene -n- (0-based) for the audio thread, or NULL if there
+ *  isn't one: -reader- (0 to SCENEREADERS-1) says which of our sceneReaders
+ *  slots to announce it in, so that snapshot won't reuse it until
+ *  mdeGranularSceneRelease. */
+
+mdeGranularScene* mdeGranularSceneAcquire(mdeGranular* g, int n, int reader)
+{
+  mdeGranularScene* sc;
+
+  /* if snapshot swapped it before we'd announced it, it might not have seen
+   * us: look again */
+  do {
+    sc = atomic_load_explicit(&g->scenes[n], memory_order_acquire);
+    atomic_store(&g->sceneReaders[reader], sc);
+  } while (sc != atomic_load(&g->scenes[n]));
+  return sc;
+}
+
+/*****************************************************************************/
+
+void mdeGranularSceneRelease(mdeGranular* g, int reader)
+{
+  atomic_store_explicit(&g->sceneReaders[reader], (mdeGranularScene*)NULL,
+                        memory_order_release);
+}
+
+/*****************************************************************************/
+
+/** recall <scene>: go to what snapshot kept in -scene-. Nothing is checked
+ *  (it all was when it was set) or allocated, so the change happens in one
+ *  go at the start of the next tick, or straight away if we're off. */
+
+void mdeGranularRecall(mdeGranular* g, int scene)
+{
+  if (scene < 1 || scene > MAXSCENES ||
+      !atomic_load_explicit(&g->scenes[scene - 1], memory_order_acquire)) {
+    if (g->warnings)
+      post("mdeGranular~: recall: there's no scene %d. Ignoring.", scene);
+    return;
+  }
+  atomic_store_explicit(&g->recallScene, scene - 1, memory_order_release);
+  if (g->status == OFF)
+    mdeGranularRecallNow(g);
+}
+
+/*****************************************************************************/
+
+/** Copy scene -sc- into g (the object or one of its layers): see
+ *  mdeGranularRecallNow. */
+
+static void mdeGranularSceneApply(mdeGranular* g, mdeGranularScene* sc)
+{
+  mdeGranularGrain* gg;
+  int i;
+  long len;
+  int restoreGrains;
+
+  restoreGrains = sc->hasGrains && sc->maxVoices == g->maxVoices &&
+    g->grains && g->pool;
+  g->transpositionOffsetST = sc->transpositionOffsetST;
+  g->transpositionOffset = sc->transpositionOffset;
+  g->numTranspositions = sc->numTranspositions;
+  memcpy(g->transpositions, sc->transpositions, sizeof(g->transpositions));
+  memcpy(g->srcs, sc->srcs, sizeof(g->srcs));
+  memcpy(g->transpositionWeights, sc->transpositionWeights,
+         sizeof(g->transpositionWeights));
+  g->numTranspositionWeights = sc->numTranspositionWeights;
+  g->morphedTranspositions = 0;
+  mdeGranularAliasBuild(&g->transpositionAlias, g->transpositionWeights,
+                        g->numTranspositionWeights, g->numTranspositions);
+  g->octaveSize = sc->octaveSize;
+  g->octaveDivisions = sc->octaveDivisions;
+  g->grainLengthMS = sc->grainLengthMS;
+  g->grainLength = sc->grainLength;
+  g->grainLengthDeviation = sc->grainLengthDeviation;
+  g->activeChannels = sc->activeChannels;
+  if (g->channelWeights)
+    memcpy(g->channelWeights, sc->channelWeights,
+           g->numChannels * sizeof(mdefloat));
+  g->numChannelWeights = sc->numChannelWeights;
+  mdeGranularAliasBuild(&g->channelAlias, g->channelWeights,
+                        g->numChannelWeights, g->activeChannels);
+  /* the buffer may have changed since, so this clamps */
+  mdeGranularSetWindow(g, sc->samplesStartMS, sc->samplesEndMS);
+  g->portionPosition = sc->portionPosition;
+  g->portionWidth = sc->portionWidth;
+  /* there's always room: rampCapacity never shrinks */
+  len = sc->rampLenSamples;
+  if (g->rampUp && len && len * 2 <= g->rampCapacity) {
+    memcpy(g->rampUp, sc->ramp, len * 2 * sizeof(mdefloat));
+    memcpy(g->rampType, sc->rampType, RAMPTYPELEN);
+    g->rampLenMS = sc->rampLenMS;
+    g->rampDown = g->rampUp + len;
+    if (len != g->rampLenSamples && !restoreGrains && g->grains) {
+      /* grains in their ramp up jump to the top of the new one if it's
+       * shorter; those not yet ramping down start to at the new distance
+       * from their end (mdeGranularGrainGetRampVal stops at the end of the
+       * ramp down) */
+      for (i = 0; i < g->maxVoices; ++i) {
+        gg = &g->grains[i];
+        if (gg->endRampUp > len)
+          gg->endRampUp = len;
+        if (gg->icurrent < gg->startRampDown) {
+          gg->startRampDown = gg->length - len;
+          if (gg->startRampDown < gg->icurrent)
+            gg->startRampDown = gg->icurrent;
+        }
+      }
+    }
+    g->rampLenSamples = len;
+    if (mdeSmootherMoving(&g->statusAmp))
+      mdeGranularStatusTarget(g, g->statusAmp.target);
+  }
+  g->density = sc->density;
+  g->grainAmpSmoothMS = sc->grainAmpSmoothMS;
+  g->grainAmpShape = sc->grainAmpShape;
+  mdeGranularSetGrainAmp(g, sc->grainAmp);
+  g->sourceChannelMode = sc->sourceChannelMode;
+  g->sourceChannel = sc->sourceChannel;
+  g->panMode = sc->panMode;
+  g->panCentre = sc->panCentre;
+  g->panWidth = sc->panWidth;
+  g->ambiOrder = sc->ambiOrder;
+  g->ambiAzimuth = sc->ambiAzimuth;
+  g->ambiAzimuthWidth = sc->ambiAzimuthWidth;
+  g->ambiElevation = sc->ambiElevation;
+  g->ambiElevationWidth = sc->ambiElevationWidth;
+  g->stealMode = sc->stealMode;
+  g->idleAfterMS = sc->idleAfterMS;
+  if (restoreGrains) {
+    memcpy(g->grains, sc->grains, g->maxVoices * sizeof(mdeGranularGrain));
+    memcpy(g->pool, sc->pool, g->maxVoices * sizeof(int));
+    g->nPlaying = sc->nPlaying;
+    g->pendingOnsets = sc->pendingOnsets;
+    g->onsetPhase = sc->onsetPhase;
+    g->onsetRate = sc->onsetRate;
+    g->onsetJitter = sc->onsetJitter;
+    g->activeVoices = sc->activeVoices;
+  }
+  else {
+    /* these see to the voices when we switch between onsets and voices */
+    mdeGranularSetOnsets(g, sc->onsetRate, sc->onsetJitter);
+    if (sc->activeVoices != g->activeVoices)
+      mdeGranularSetActiveVoices(g, (mdefloat)(sc->activeVoices < g->maxVoices
+                                               ? sc->activeVoices :
+                                               g->maxVoices));
+  }
+}
+
+/*****************************************************************************/
+
+/** Copy the scene recall asked for into the object: called between ticks
+ *  (see mdeGranularGo) so that no grain sees half of one scene and half of
+ *  another. Grains that were playing carry on (unless the scene kept its
+ *  own), fitted to the new ramp if its length has changed. */
+
+void mdeGranularRecallNow(mdeGranular* g)
+{
+  mdeGranularScene* sc;
+  /* only one of us (the main thread when we're off) gets to recall it */
+  int n = atomic_exchange_explicit(&g->recallScene, -1, memory_order_acq_rel);
+  int i;
+
+  if (n < 0 || n >= MAXSCENES)
+    return;
+  sc = mdeGranularSceneAcquire(g, n, 0);
+  if (!sc) {
+    mdeGranularSceneRelease(g, 0);
+    return;
+  }
+  mdeGranularSceneApply(g, sc);
+  /* layers added since the snapshot keep what they have */
+  for (i = 0; i < sc->numLayers && i < g->numLayers; ++i)
+    mdeGranularSceneApply(&g->layers[i], &sc->layers[i]);
+  mdeGranularSceneRelease(g, 0);
+}
+
+/*****************************************************************************/
+
+/** morph <a> <b> <t>: somewhere between scenes -a- and -b-, -t- being 0 for
+ *  all a and 1 for all b. As with recall, nothing happens here but checking:
+ *  the in-between values are worked out once at the start of the next tick,
+ *  however many morph messages arrive before then, so a line sending -t-
+ *  every millisecond costs no more than one every tick. */
+
+void mdeGranularMorph(mdeGranular* g, int a, int b, mdefloat t)
+{
+  if (a < 1 || a > MAXSCENES || b < 1 || b > MAXSCENES ||
+      !atomic_load_explicit(&g->scenes[a - 1], memory_order_acquire) ||
+      !atomic_load_explicit(&g->scenes[b - 1], memory_order_acquire)) {
+    if (g->warnings)
+      post("mdeGranular~: morph: there's no scene %d or %d. Ignoring.",
+           a, b);
+    return;
+  }
+  if (t < (mdefloat)0.0)
+    t = (mdefloat)0.0;
+  else if (t > (mdefloat)1.0)
+    t = (mdefloat)1.0;
+  atomic_store_explicit(&g->morphA, a - 1, memory_order_relaxed);
+  atomic_store_explicit(&g->morphB, b - 1, memory_order_relaxed);
+  atomic_store_explicit(&g->morphT, t, memory_order_relaxed);
+  atomic_store_explicit(&g->morphPending, 1, memory_order_release);
+}
+
+/*****************************************************************************/
+
+/** Add a scene's transpositions, their weights scaled to add up to -amount-,
+ *  to those already in g (see mdeGranularMorphNow). Returns how many there
+ *  now are. */
+
+static int mdeGranularMorphTranspositions(mdeGranular* g, int num,
+                                          mdeGranularScene* sc,
+                                          mdefloat amount)
+{
+  int i;
+  int j;
+  double w;
+  double total = 0.0;
+
+  for (i = 0; i < sc->numTranspositions; ++i) {
+    w = i < sc->numTranspositionWeights ? sc->transpositionWeights[i] : 1.0;
+    if (w > 0.0)
+      total += w;
+  }
+  if (total <= 0.0 || amount <= (mdefloat)0.0)
+    return num;
+  for (i = 0; i < sc->numTranspositions; ++i) {
+    w = i < sc->numTranspositionWeights ? sc->transpositionWeights[i] : 1.0;
+    if (w <= 0.0)
+      continue;
+    w *= amount / total;
+    /* both scenes may have it */
+    for (j = 0; j < num; ++j)
+      if (g->srcs[j] == sc->srcs[i])
+        break;
+    if (j < num)
+      g->transpositionWeights[j] += (mdefloat)w;
+    else if (num < MAXTRANSPOSITIONS) {
+      g->transpositions[num] = sc->transpositions[i];
+      g->srcs[num] = sc->srcs[i];
+      g->transpositionWeights[num++] = (mdefloat)w;
+    }
+  }
+  return num;
+}
+
+/*****************************************************************************/
+
+/** Set g (the object or one of its layers) to -t- of the way from scene -a-
+ *  to scene -b-: see mdeGranularMorphNow. */
+
+static void mdeGranularMorphApply(mdeGranular* g, mdeGranularScene* a,
+                                  mdeGranularScene* b, mdefloat t)
+{
+  mdeGranularScene* end;
+  mdefloat u = (mdefloat)1.0 - t;
+  int num;
+
+  /* at either end it's just that scene's transpositions, as recall would
+   * have them, weights and all */
+  end = t <= (mdefloat)0.0 ? a : (t >= (mdefloat)1.0 ? b : NULL);
+  if (end) {
+    g->numTranspositions = end->numTranspositions;
+    memcpy(g->transpositions, end->transpositions, sizeof(g->transpositions));
+    memcpy(g->srcs, end->srcs, sizeof(g->srcs));
+    memcpy(g->transpositionWeights, end->transpositionWeights,
+           sizeof(g->transpositionWeights));
+    g->numTranspositionWeights = end->numTranspositionWeights;
+    g->morphedTranspositions = 0;
+    mdeGranularAliasBuild(&g->transpositionAlias, g->transpositionWeights,
+                          g->numTranspositionWeights, g->numTranspositions);
+  }
+  else {
+    num = mdeGranularMorphTranspositions(g, 0, a, u);
+    num = mdeGranularMorphTranspositions(g, num, b, t);
+    if (num) {
+      g->numTranspositions = num;
+      g->numTranspositionWeights = num;
+      g->morphedTranspositions = 1;
+      mdeGranularAliasBuild(&g->transpositionAlias, g->transpositionWeights,
+                            num, num);
+    }
+  }
+  mdeGranularSignalParam(g, SIG_TRANSPOSITION,
+                         u * a->transpositionOffsetST +
+                         t * b->transpositionOffsetST);
+  mdeGranularSignalParam(g, SIG_GRAINLENGTH,
+                         u * a->grainLengthMS + t * b->grainLengthMS);
+  mdeGranularSignalParam(g, SIG_DEVIATION,
+                         u * a->grainLengthDeviation +
+                         t * b->grainLengthDeviation);
+  mdeGranularSignalParam(g, SIG_DENSITY, u * a->density + t * b->density);
+  mdeGranularSetWindow(g, u * a->samplesStartMS + t * b->samplesStartMS,
+                       u * a->samplesEndMS + t * b->samplesEndMS);
+  g->portionPosition = u * a->portionPosition + t * b->portionPosition;
+  g->portionWidth = u * a->portionWidth + t * b->portionWidth;
+  mdeGranularSetGrainAmp(g, u * a->grainAmp + t * b->grainAmp);
+}
+
+/*****************************************************************************/
+
+/** Set the parameters that morph interpolates to their in-between values:
+ *  grain length, deviation, density, the window (and portion), transposition
+ *  offset and grain amp are interpolated, and the transpositions of both
+ *  scenes are put together, those of one weighted by 1-t, of the other by t.
+ *  The rest stays as it was. Out of range values are dealt with as for
+ *  signal inlets (see mdeGranularSignalParam) as we're in the DSP tick. */
+
+void mdeGranularMorphNow(mdeGranular* g)
+{
+  mdeGranularScene* a;
+  mdeGranularScene* b;
+  /* a morph message arriving whilst we read these sets morphPending again,
+   * so a mixture of two messages lasts no more than a tick */
+  int n = atomic_exchange_explicit(&g->morphPending, 0, memory_order_acq_rel);
+  int an = atomic_load_explicit(&g->morphA, memory_order_relaxed);
+  int bn = atomic_load_explicit(&g->morphB, memory_order_relaxed);
+  mdefloat t = atomic_load_explicit(&g->morphT, memory_order_relaxed);
+  int i;
+
+  if (!n || an < 0 || bn < 0)
+    return;
+  a = mdeGranularSceneAcquire(g, an, 1);
+  b = mdeGranularSceneAcquire(g, bn, 2);
+  if (!a || !b) {
+    mdeGranularSceneRelease(g, 1);
+    mdeGranularSceneRelease(g, 2);
+    return;
+  }
+  mdeGranularMorphApply(g, a, b, t);
+  /* a layer morphs if both scenes have it */
+  for (i = 0; i < a->numLayers && i < b->numLayers && i < g->numLayers; ++i)
+    mdeGranularMorphApply(&g->layers[i], &a->layers[i], &b->layers[i], t);
+  mdeGranularSceneRelease(g, 1);
+  mdeGranularSceneRelease(g, 2);
+}
+
+/*****************************************************************************/
+
+void mdeGranularScenesFree(mdeGranular* g)
+{
+  int i;
+
+  for (i = 0; i < MAXSCENES; ++i)
+    mdeGranularSceneFree(atomic_exchange(&g->scenes[i],
+                                         (mdeGranularScene*)NULL));
+  mdeGranularSceneFree(g->sceneSpare);
+  g->sceneSpare = NULL;
+  atomic_store(&g->recallScene, -1);
+}
+
+/*****************************************************************************/
+
+void mdeGranularSceneFree(mdeGranularScene* sc)
+{
+  if (!sc)
+    return;
+  mdeGranularSceneClear(sc);
+  mdeFree(sc);
+}
+
+/*****************************************************************************/
+
+/** Free what a scene points to (its layers' too) but not the scene itself. */
+
+void mdeGranularSceneClear(mdeGranularScene* sc)
+{
+  int i;
+
+  if (sc->channelWeights)
+    mdeFree(sc->channelWeights);
+  if (sc->ramp)
+    mdeFree(sc->ramp);
+  if (sc->grains)
+    mdeFree(sc->grains);
+  if (sc->pool)
+    mdeFree(sc->pool);
+  for (i = 0; i < sc->numLayers; ++i)
+    mdeGranularSceneClear(&sc->layers[i]);
+  if (sc->layers)
+    mdeFree(sc->layers);
+  memset(sc, 0, sizeof(mdeGranularScene));
+}
+
+/*****************************************************************************/
+
+
+/***\f*************************************************************************
+ *************************                    *********************************
+ *************************       LAYERS       *********************************
+ *************************                    *********************************
+ *****************************************************************************/
+
+
+/*****************************************************************************/
+
+/** Layers <n>: as well as its own, granulate with -n- more sets of
+ *  parameters (0 to MAXLAYERS), each with as many voices as we have now,
+ *  set with layer messages. Layers read from our source (whatever it is, but
+ *  a streamed file, whose cache only follows our own window) and mix into our
+ *  outputs in the same tick, so there's no per-object overhead for each one.
+ *  Allocates, so only when we're off. */
+
+void mdeGranularSetLayers(mdeGranular* g, int num)
+{
+  mdeGranular* l;
+  int i;
+
+  if (g->status != OFF) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              Can't change the number of layers whilst object ");
+      post("              is running or ramping down. Ignoring.");
+    }
+    return;
+  }
+  if (num < 0 || num > MAXLAYERS) {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              Layers should be between 0 and %d, not %d. "
+           "Ignoring.", MAXLAYERS, num);
+    }
+    return;
+  }
+  mdeGranularLayersFree(g);
+  if (!num)
+    return;
+  g->layers = mdeCalloc(num, sizeof(mdeGranular), "mdeGranularSetLayers",
+                        g->warnings);
+  if (!g->layers)
+    return;
+  for (i = 0; i < num; ++i) {
+    l = &g->layers[i];
+    l->samplingRate = g->samplingRate;
+    mdeGranularInit1(l, g->maxVoices, g->numChannels);
+    l->warnings = g->warnings;
+    l->layer = i + 1;
+    /* Init1 seeded from the clock, so all layers would have the same random
+     * numbers */
+    l->rngCounter = g->rngCounter + (uint32_t)(i + 1) * 0x6C8E9CF5U;
+    if (mdeGranularDidInit(g))
+      mdeGranularInit2(l, g->nOutputSamples, g->rampLenMS,
+                       g->channelBuffers);
+    mdeGranularLayerSource(g, l);
+  }
+  g->numLayers = num;
+}
+
+/*****************************************************************************/
+
+/** layer <k> <message> <args>: send one of the parameter messages to layer
+ *  -k- (from 1) rather than to the object itself. Returns 0 if it was
+ *  understood. */
+
+int mdeGranularLayerMessage(mdeGranular* g, int layer, char* name, int argc,
+                            mdefloat* argv)
+{
+  mdeGranular* l;
+  mdefloat a = argc > 0 ? argv[0] : (mdefloat)0.0;
+  mdefloat b = argc > 1 ? argv[1] : (mdefloat)0.0;
+
+  if (layer < 1 || layer > g->numLayers) {
+    if (g->warnings)
+      post("mdeGranular~: layer: there's no layer %d (see Layers). "
+           "Ignoring.", layer);
+    return 1;
+  }
+  l = &g->layers[layer - 1];
+  if (!strcmp(name, "Transpositions"))
+    mdeGranularSetTranspositions(l, argc, argv);
+  else if (!strcmp(name, "TranspositionWeights"))
+    mdeGranularSetTranspositionWeights(l, argc, argv);
+  else if (!strcmp(name, "TranspositionOffsetST"))
+    mdeGranularSetTranspositionOffsetST(l, a);
+  else if (!strcmp(name, "GrainLengthMS"))
+    mdeGranularSetGrainLengthMS(l, a);
+  else if (!strcmp(name, "GrainLengthDeviation"))
+    mdeGranularSetGrainLengthDeviation(l, a);
+  else if (!strcmp(name, "SamplesStartMS"))
+    mdeGranularSetSamplesStartMS(l, a);
+  else if (!strcmp(name, "SamplesEndMS"))
+    mdeGranularSetSamplesEndMS(l, a);
+  else if (!strcmp(name, "Portion"))
+    mdeGranularPortion(l, a, b);
+  else if (!strcmp(name, "PortionPosition"))
+    mdeGranularPortionPosition(l, a);
+  else if (!strcmp(name, "PortionWidth"))
+    mdeGranularPortionWidth(l, a);
+  else if (!strcmp(name, "Density"))
+    mdeGranularSetDensity(l, a);
+  else if (!strcmp(name, "GrainAmp"))
+    mdeGranularSetGrainAmp(l, a);
+  else if (!strcmp(name, "ActiveVoices"))
+    mdeGranularSetActiveVoices(l, a);
+  else if (!strcmp(name, "Onsets"))
+    mdeGranularSetOnsets(l, a, b);
+  else if (!strcmp(name, "ActiveChannels"))
+    mdeGranularSetActiveChannels(l, (long)a);
+  else if (!strcmp(name, "ChannelWeights"))
+    mdeGranularSetChannelWeights(l, argc, argv);
+  else if (!strcmp(name, "PanSpread"))
+    mdeGranularSetPanSpread(l, a, b);
+  else {
+    if (g->warnings) {
+      post("mdeGranular~:");
+      post("              layer: %s can't be sent to a layer. Ignoring.",
+           name);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/*****************************************************************************/
+
+/** Point layer -l- at our source, as mdeGranularInit3 would have done had it
+ *  been given it (the whole buffer as the window) but without posting
+ *  anything, as this is also called from mdeGranularLayersGo when our source
+ *  has changed. */
+
+void mdeGranularLayerSource(mdeGranular* g, mdeGranular* l)
+{
+  l->samples = g->samples;
+  l->sourceChannels = g->sourceChannels;
+  l->live = g->live;
+  l->nBufferSamples = g->nBufferSamples;
+  l->nReadSamples = g->nReadSamples;
+  l->BufferSamplesMS = g->BufferSamplesMS;
+  l->liveIndex = mdeGranularGetLiveIndex(g);
+  if (!l->samples || l->nBufferSamples <= 0)
+    return;
+  mdeGranularSetWindow(l, (mdefloat)0.0, l->BufferSamplesMS);
+  if (l->nBufferSamples < l->grainLength) {
+    l->grainLength = (mdelong)((double)l->nBufferSamples * 0.9);
+    l->grainLengthMS = samples2ms(l->samplingRate, l->grainLength);
+  }
+  mdeGranularInitGrains(l);
+}
+
+/*****************************************************************************/
+
+/** The layers' part of mdeGranularGo: after our own grains and before the
+ *  start/stop ramp, which applies to them all. The layers follow our status
+ *  and what the governor leaves us with. */
+
+void mdeGranularLayersGo(mdeGranular* g, long tickSize)
+{
+  mdeGranular* l;
+  mdeGranularGrain* gg;
+  int i;
+  int j;
+
+  /* a stream's cache only holds our own window */
+  if (g->stream)
+    return;
+  for (i = 0; i < g->numLayers; ++i) {
+    l = &g->layers[i];
+    if (l->samples != g->samples || l->nBufferSamples != g->nBufferSamples ||
+        l->nReadSamples != g->nReadSamples ||
+        l->sourceChannels != g->sourceChannels)
+      mdeGranularLayerSource(g, l);
+    if (!l->samples || !l->grains || !mdeGranularDidInit(l))
+      continue;
+    /* Max gives us new ones each tick */
+    for (j = 0; j < g->numChannels; ++j)
+      l->channelBuffers[j] = g->channelBuffers[j];
+    l->liveIndex = mdeGranularGetLiveIndex(g);
+    l->status = g->status;
+    l->sampleClock = g->sampleClock;
+    l->govCheap = g->govCheap;
+    l->govVoices = g->govVoices;
+    l->govDensity = g->govDensity;
+    l->priority = g->priority;
+    /* our trace has the layers' grains too; its ring has just the one
+     * producer, as they're played in our tick */
+    l->trace = g->trace;
+    l->sigIndex = 0;
+    if (mdeSmootherMoving(&l->grainAmp) ||
+        l->grainAmps[0] != l->grainAmp.value ||
+        l->grainAmps[tickSize - 1] != l->grainAmp.value)
+      mdeSmootherBlock(&l->grainAmp, l->grainAmps, tickSize);
+    mdeGranularPlan(l, tickSize);
+    if (l->onsetRate > 0.0 && l->pool)
+      mdeGranularOnsets(l);
+    else for (j = 0; j < l->maxVoices; ++j) {
+      gg = &l->grains[j];
+      mdeGranularGrainMixIn(gg, l, mdeGranularGrainWhere(gg, l), tickSize);
+    }
+    l->sigIndex = -1;
+    l->planFilled = l->planUsed = 0;
+  }
+}
+
+/*****************************************************************************/
+
+void mdeGranularLayersFree(mdeGranular* g)
+{
+  int i;
+
+  if (!g->layers)
+    return;
+  for (i = 0; i < g->numLayers; ++i) {
+    /* the source and trace are ours, so don't let Free see them */
+    g->layers[i].samples = NULL;
+    g->layers[i].trace = NULL;
+    mdeGranularFree(&g->layers[i]);
+  }
+  mdeFree(g->layers);
+  g->layers = NULL;
+  g->numLayers = 0;
+}
+
+/*****************************************************************************/
+
+
+/****************************************************************************
+ *************************                    *********************************
+ *************************      MESSAGES      *********************************
+ *************************                    *********************************
+ *****************************************************************************/
+
+
+/*****************************************************************************/
+
+/** Messages that have to wait for the main thread, in a ring shared by all
+ *  the instances in this process. Any thread may push (Max can run instances
+ *  in several audio threads, and there are our background threads) so each
+ *  slot says whether it's free to write or ready to read: for the -lap-th
+ *  time round the ring, 2 * lap when free, 2 * lap + 1 when ready. Only the
+ *  main thread pops. */
+
+typedef struct _mdeGranularLogSlot
+{
+  atomic_ulong turn;
+  int error;
+  char text[LOGMSGLEN];
+} mdeGranularLogSlot;
+
+static mdeGranularLogSlot LogRing[LOGRINGSIZE];
+static atomic_ulong LogHead = 0;
+static atomic_ulong LogTail = 0;
+static atomic_int LogReady = 0;
+/** messages dropped because the ring was full or we were over LOGRATE */
+static atomic_ulong LogDropped = 0;
+/** the second (since mdeGranularSeconds' epoch) we're counting messages for,
+ *  and how many there've been in it */
+static atomic_llong LogSecond = 0;
+static atomic_int LogThisSecond = 0;
+
+/*****************************************************************************/
+
+/** Post on the main thread, straight away. */
+
+static void mdeGranularLogPost(int error, char* text)
+{
+  if (error)
+    mdeHostError("%s", text);
+  else
+    /* the parentheses call the host's post rather than our macro */
+    (post)("%s", text);
+}
+
+/*****************************************************************************/
+
+/** Everything the engine posts comes here (post and mdeGranularError are
+ *  macros for it). In the main thread it's posted as ever, but whilst
+ *  processing audio (see mdeGranularDeferLog) or in our background threads
+ *  the message is only formatted into LogRing, without locking or
+ *  allocating, and posted by mdeGranularLogFlush when the host gets round to
+ *  it. No more than LOGRATE a second are queued, so a misconfigured patch
+ *  complaining every tick can't swamp the console (or the audio thread). */
+
+void mdeGranularLog(int error, const char* format, ...)
+{
+  va_list args;
+  char text[LOGMSGLEN];
+  mdeGranularLogSlot* slot;
+  unsigned long pos, lap;
+  long diff;
+  long long second, was;
+
+  if (!LogDefer) {
+    va_start(args, format);
+    vsnprintf(text, LOGMSGLEN, format, args);
+    va_end(args);
+    mdeGranularLogPost(error, text);
+    return;
+  }
+  second = (long long)mdeGranularSeconds();
+  was = atomic_load(&LogSecond);
+  if (second != was &&
+      atomic_compare_exchange_strong(&LogSecond, &was, second))
+    atomic_store(&LogThisSecond, 0);
+  if (atomic_fetch_add(&LogThisSecond, 1) >= LOGRATE) {
+    atomic_fetch_add(&LogDropped, 1UL);
+    return;
+  }
+  pos = atomic_load(&LogHead);
+  for (;;) {
+    slot = LogRing + (pos & (LOGRINGSIZE - 1));
+    lap = pos / LOGRINGSIZE;
+    diff = (long)(atomic_load(&slot->turn) - 2 * lap);
+    if (!diff) {
+      if (atomic_compare_exchange_weak(&LogHead, &pos, pos + 1))
+        break;
+    }
+    else if (diff < 0) {
+      /* full */
+      atomic_fetch_add(&LogDropped, 1UL);
+      return;
+    }
+    else
+      pos = atomic_load(&LogHead);
+  }
+  va_start(args, format);
+  vsnprintf(slot->text, LOGMSGLEN, format, args);
+  va_end(args);
+  slot->error = error;
+  atomic_store(&slot->turn, 2 * lap + 1);
+  atomic_store(&LogReady, 1);
+}
+
+/*****************************************************************************/
+
+/** Whether messages from this thread have to wait (mdeGranularLog): call with
+ *  1 before processing audio and 0 afterwards (they can nest).
+ *  mdeGranularGo does this itself; the hosts do it around the rest of their
+ *  perform routines. */
+
+void mdeGranularDeferLog(int defer)
+{
+  LogDefer += defer ? 1 : -1;
+}
+
+/*****************************************************************************/
+
+/** Whether there's anything for mdeGranularLogFlush to post. Cheap enough to
+ *  call after every tick; the hosts then schedule a flush on the main
+ *  thread. */
+
+int mdeGranularLogPending(void)
+{
+  return atomic_load(&LogReady) || atomic_load(&LogDropped);
+}
+
+/*****************************************************************************/
+
+/** Post everything waiting in LogRing, and how many messages were dropped.
+ *  Main thread only. */
+
+void mdeGranularLogFlush(void)
+{
+  mdeGranularLogSlot* slot;
+  unsigned long pos, lap, dropped;
+
+  atomic_store(&LogReady, 0);
+  pos = atomic_load(&LogTail);
+  for (;;) {
+    slot = LogRing + (pos & (LOGRINGSIZE - 1));
+    lap = pos / LOGRINGSIZE;
+    if (atomic_load(&slot->turn) != 2 * lap + 1)
+      break;
+    mdeGranularLogPost(slot->error, slot->text);
+    atomic_store(&slot->turn, 2 * (lap + 1));
+    atomic_store(&LogTail, ++pos);
+  }
+  dropped = atomic_exchange(&LogDropped, 0UL);
+  if (dropped) {
+    (post)("mdeGranular~:");
+    (post)("              %lu messages from the audio thread weren't "
+           "posted (too many)", dropped);
+  }
+}
+
+/*****************************************************************************/
+
+/** Whether any of our background threads (stream reader, trace or record
+ *  writer) are running, i.e. whether messages might be queued when no tick
+ *  is coming (e.g. with the audio off) to get the host to flush them. */
+
+int mdeGranularHasWorkers(mdeGranular* g)
+{
+  return g->stream || g->trace || atomic_load(&g->recorder);
+}
+
+/*****************************************************************************/
+
+
+/****************************************************************************
+ *************************                    *********************************
+ *************************      TRACING       *********************************
+ *************************                    *********************************
+ *****************************************************************************/
+
+
+/*****************************************************************************/
+
+/** What's written to a trace file: a header, then one of these for each
+ *  grain event. The fixed sizes are so that tools/mdeGranularTrace.c can read
+ *  them (which has its own copies of these; keep them in step). */
+
+typedef struct _mdeGranularTraceHeader
+{
+  /* "MDETRACE" */
+  char magic[8];
+  int32_t version;
+  int32_t eventSize;
+  double samplingRate;
+} mdeGranularTraceHeader;
+
+typedef struct _mdeGranularTraceEvent
+{
+  /** when, in samples since the object started */
+  uint64_t sample;
+  /** the grain's start and end in the source (in frames), and increment */
+  double start;
+  double end;
+  double inc;
+  /** a t_traceevent */
+  int32_t type;
+  /** which of the grains (voices) */
+  int32_t voice;
+  int32_t channel;
+  int32_t srcChannel;
+  /** in samples: what it will be at TRACE_INIT, what it was at TRACE_END */
+  int32_t length;
+  /** a t_status: ON or SKIPGRAIN */
+  int32_t status;
+  /** whose voice: 0 for the object's own, otherwise the layer (from 1) */
+  int32_t layer;
+  int32_t unused;
+} mdeGranularTraceEvent;
+
+/** The audio thread pushes events into the ring, the writer thread pops them
+ *  and writes them to disk: one of each, so all it takes is two counters. */
+
+struct _mdeGranularTrace
+{
+  char path[MAXSOUNDFILEPATH];
+  FILE* fp;
+  mdeGranularTraceEvent ring[TRACERINGSIZE];
+  /** the next event to be pushed and popped: they only ever go up */
+  atomic_ulong head;
+  atomic_ulong tail;
+  /** events the ring had no room for */
+  atomic_ulong dropped;
+  /** whether we're tracing; the writer thread stops when this goes to 0 */
+  atomic_int on;
+  mdeThread thread;
+  int running;
+};
+
+/*****************************************************************************/
+
+/** Start writing every grain's beginning and end to -path- (see
+ *  mdeGranularTraceEvent), stopping any trace already going. The events are
+ *  queued by the audio thread without locking or blocking and written by a
+ *  background thread, so the trace can run at full load. If the queue ever
+ *  fills up, events are dropped and we say how many when the trace stops.
+ *  Returns 0 on success. */
+
+int mdeGranularTraceStart(mdeGranular* g, char* path)
+{
+  mdeGranularTrace* t = g->trace;
+  mdeGranularTraceHeader header;
+
+  mdeGranularTraceStop(g);
+  if (!t) {
+    t = mdeCalloc(1, sizeof(mdeGranularTrace), "mdeGranularTraceStart",
+                  g->warnings);
+    if (!t)
+      return 1;
+    atomic_init(&t->head, 0UL);
+    atomic_init(&t->tail, 0UL);
+    atomic_init(&t->dropped, 0UL);
+    atomic_init(&t->on, 0);
+    g->trace = t;
+  }
+  t->fp = fopen(path, "wb");
+  if (!t->fp) {
+    mdeGranularError("mdeGranular~: %s: can't open trace file", path);
+    return 1;
+  }
+  strncpy(t->path, path, MAXSOUNDFILEPATH - 1);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "MDETRACE", 8);
+  header.version = 2;
+  header.eventSize = (int32_t)sizeof(mdeGranularTraceEvent);
+  header.samplingRate = (double)g->samplingRate;
+  fwrite(&header, sizeof(header), 1, t->fp);
+  /* anything left over from last time would be out of place */
+  atomic_store(&t->tail, atomic_load(&t->head));
+  atomic_store(&t->dropped, 0UL);
+  atomic_store(&t->on, 1);
+  if (mdeThreadStart(&t->thread, mdeGranularTraceWriter, t)) {
+    atomic_store(&t->on, 0);
+    fclose(t->fp);
+    t->fp = NULL;
+    mdeGranularError("mdeGranular~: %s: can't start tracing", path);
+    return 1;
+  }
+  t->running = 1;
+  return 0;
+}
+
+/*****************************************************************************/
+
+/** Stop tracing: the writer thread writes what's left and closes the file.
+ *  The ring stays allocated (the audio thread might still be looking at it)
+ *  until mdeGranularTraceFree. */
+
+void mdeGranularTraceStop(mdeGranular* g)
+{
+  mdeGranularTrace* t = g->trace;
+  unsigned long dropped;
+
+  if (!t || !t->running)
+    return;
+  atomic_store(&t->on, 0);
+  mdeThreadJoin(t->thread);
+  t->running = 0;
+  dropped = atomic_load(&t->dropped);
+  if (dropped && g->warnings) {
+    post("mdeGranular~:");
+    post("              %s: %lu grain events were dropped as the ", t->path,
+         dropped);
+    post("              disk couldn't keep up.");
+  }
+}
+
+/*****************************************************************************/
+
+void mdeGranularTraceFree(mdeGranular* g)
+{
+  if (g->trace) {
+    mdeGranularTraceStop(g);
+    mdeFree(g->trace);
+    g->trace = NULL;
+  }
+}
+
+/*****************************************************************************/
+
+/** The writer thread: every 10ms, write whatever's in the ring. */
+
+void mdeGranularTraceWriter(void* arg)
+{
+  mdeGranularTrace* t = (mdeGranularTrace*)arg;
+  unsigned long head;
+  unsigned long tail;
+  unsigned long n;
+  int on;
+
+  for (;;) {
+    /* look at -on- first so that we write everything pushed before it went
+     * to 0 */
+    on = atomic_load(&t->on);
+    head = atomic_load_explicit(&t->head, memory_order_acquire);
+    tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+    while (tail != head) {
+      /* as far as the end of the ring in one go */
+      n = TRACERINGSIZE - (tail & (TRACERINGSIZE - 1));
+      if (n > head - tail)
+        n = head - tail;
+      fwrite(&t->ring[tail & (TRACERINGSIZE - 1)],
+             sizeof(mdeGranularTraceEvent), n, t->fp);
+      tail += n;
+      atomic_store_explicit(&t->tail, tail, memory_order_release);
+    }
+    if (!on)
+      break;
+    mdeSleepMS(10);
+  }
+  fclose(t->fp);
+  t->fp = NULL;
+}
+
+/*****************************************************************************/
+
+/** Called by the audio thread (only: it's the ring's single producer) when a
+ *  grain is initialised or comes to an end. Events outside mdeGranularGo,
+ *  e.g. when the grains are all reinitialised by a message, aren't traced. */
+
+void mdeGranularTraceGrain(mdeGranular* g, mdeGranularGrain* gg,
+                           t_traceevent type)
 {
-  return (mdefloat)pow(octaveSize, st / octaveDivisions);
+  mdeGranularTrace* t = g->trace;
+  mdeGranularTraceEvent* e;
+  unsigned long head;
+
+  if (!atomic_load_explicit(&t->on, memory_order_relaxed) || g->sigIndex < 0)
+    return;
+  head = atomic_load_explicit(&t->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&t->tail, memory_order_acquire) >=
+      TRACERINGSIZE) {
+    atomic_fetch_add_explicit(&t->dropped, 1UL, memory_order_relaxed);
+    return;
+  }
+  e = &t->ring[head & (TRACERINGSIZE - 1)];
+  e->sample = g->sampleClock + (uint64_t)g->sigIndex;
+  e->start = (double)gg->start;
+  e->end = (double)gg->end;
+  e->inc = (double)gg->inc;
+  e->type = (int32_t)type;
+  e->voice = (int32_t)(gg - g->grains);
+  e->channel = (int32_t)gg->channel;
+  e->srcChannel = (int32_t)gg->srcChannel;
+  e->length = (int32_t)(type == TRACE_INIT ? gg->length : gg->icurrent);
+  e->status = (int32_t)gg->status;
+  e->layer = (int32_t)g->layer;
+  e->unused = 0;
+  atomic_store_explicit(&t->head, head + 1, memory_order_release);
 }
 
 /*****************************************************************************/
 
-/** Convert milliseconds to samples using the given sampling rate.
- *  */
-long ms2samples(mdefloat samplingRate, mdefloat milliseconds)
-{
-  return (long)ceil((milliseconds * (mdefloat)0.001) * samplingRate);
-}
+
+/***\f*************************************************************************
+ *************************                    *********************************
+ *************************     RECORDING      *********************************
+ *************************                    *********************************
+ *****************************************************************************/
+
 
 /*****************************************************************************/
 
-/** Convert samples to milliseconds using the given sampling rate.
- *  */
-mdefloat samples2ms(mdefloat samplingRate, int samples)
+/** The audio thread pushes a block (each channel's tick one after the other,
+ *  so each is a memcpy) into the ring, the writer thread pops blocks,
+ *  interleaves them and writes them to a 32-bit float WAV file (RF64 once
+ *  it's past 4GB). As with tracing, one of each, so two counters are all the
+ *  locking there is. */
+
+struct _mdeGranularRecorder
 {
-  return (mdefloat)1000.0 * ((mdefloat)samples / samplingRate);
-}
+  char path[MAXSOUNDFILEPATH];
+  FILE* fp;
+  float* ring;
+  /** the next sample to be pushed and popped: they only ever go up */
+  atomic_ulong head;
+  atomic_ulong tail;
+  /** blocks the ring had no room for */
+  atomic_ulong dropped;
+  /** whether we're recording; the writer thread stops when this goes to 0 */
+  atomic_int on;
+  /** the outputs, plus the live input if we're recording that too */
+  int channels;
+  /** samples per channel in a block: nOutputSamples when we started */
+  long blockSize;
+  /** this tick's live input (copied by mdeGranularCopyInputSamples, as the
+   *  host may give us the same memory for it as for an outlet) and whether
+   *  there was any */
+  mdefloat* in;
+  char gotIn;
+  /** the writer thread's interleaved block */
+  float* frames;
+  /** for the header, and how much has been written */
+  mdefloat samplingRate;
+  unsigned long long dataBytes;
+  /** set by the writer thread when the disk won't take any more: we then
+   *  stop writing but keep emptying the ring */
+  int failed;
+  mdeThread thread;
+  int running;
+  /** the next in mdeGranular's recordersRetired */
+  struct _mdeGranularRecorder* next;
+};
 
 /*****************************************************************************/
 
-/** 4-point interpolating table lookup nicked and modified from pd's d_array.c
-    (tabread4~)  */
+/** Start recording our outputs (and, if -what- is live, the live input after
+ *  them) to -path- as a WAV file, stopping any recording already going. DSP
+ *  has to be on as we need the block size. Returns 0 on success. */
 
-/* MDE Wed Sep 18 20:02:35 2013 -- added live arg: if this is 1 we have 32bit
-   float samples, otherwise they're 64bit */
-/* MDE Thu Feb 20 11:39:46 2020 -- 'live' arg doesn't seem to be used at all, so
-   removing  */
-mdefloat interpolate(mdefloat findex, mdefloat* samples, long numSamples,
-                     char backwards) /*, char live)*/
+int mdeGranularRecordStart(mdeGranular* g, char* path, char* what)
 {
-  long indexTrunc = (long)findex;
-  mdefloat fraction =  fabs(findex - (mdefloat)indexTrunc);
-  mdefloat a;
-  mdefloat b;
-  mdefloat c;
-  mdefloat d;
-  mdefloat cminusb;
-  mdefloat* fp;
-  mdefloat* lastsamp;
-  mdefloat lastsampval;
-  mdefloat result;
+  mdeGranularRecorder* r;
+  int live = what && !strcmp(what, "live");
+  int channels = g->numChannels + (live ? 1 : 0);
 
-  if (!samples)
-    return (mdefloat)0.0;
-  /* do boundary sanity for circular buffer case */
-  indexTrunc %= numSamples;
-  /* could be the case if going backwards (% doesn't wrap as lisp's mod does so
-   * negative numbers remain negative)
-   */
-  if (indexTrunc < 0) {
-    indexTrunc = numSamples + indexTrunc;
+  mdeGranularRecordStop(g);
+  if (what && *what && !live && g->warnings) {
+    post("mdeGranular~:");
+    post("              record: unknown option %s (live). Ignoring it.", what);
   }
-  lastsamp = (mdefloat*)(samples + numSamples - 1);
-  lastsampval = *lastsamp;
-  /* some of these saw samples cast to long but since going 64 bit that no
-     longer works (too small?) */ 
-  fp = (mdefloat*)(samples + indexTrunc);
-  b = *fp;
-  if (backwards) {
-    a = *(samples + ((indexTrunc + 1) % numSamples));
-    c = indexTrunc ? *(fp - 1) : lastsampval;
-    d = !indexTrunc ? *(lastsamp - 1) : (indexTrunc == 1 ?
-                                         lastsampval : *(fp - 2));
+  if (!mdeGranularDidInit(g) || g->nOutputSamples <= 0) {
+    mdeGranularError("mdeGranular~: %s: turn DSP on before recording", path);
+    return 1;
   }
-  else {
-    a = indexTrunc ? *(fp - 1) : lastsampval;
-    c = *(samples + ((indexTrunc + 1) % numSamples));
-    d = *(samples + ((indexTrunc + 2) % numSamples));
+  if ((unsigned long)(channels * g->nOutputSamples) > RECORDRINGSIZE / 2) {
+    mdeGranularError("mdeGranular~: %s: too many channels to record", path);
+    return 1;
+  }
+  /* keep the last one if it's the right shape */
+  r = atomic_load(&g->recorder);
+  if (r && (r->channels != channels || r->blockSize != g->nOutputSamples))
+    r = NULL;
+  if (!r) {
+    r = mdeCalloc(1, sizeof(mdeGranularRecorder), "mdeGranularRecordStart",
+                  g->warnings);
+    if (!r)
+      return 1;
+    atomic_init(&r->head, 0UL);
+    atomic_init(&r->tail, 0UL);
+    atomic_init(&r->dropped, 0UL);
+    atomic_init(&r->on, 0);
+    r->channels = channels;
+    r->blockSize = g->nOutputSamples;
+    r->ring = mdeCalloc(RECORDRINGSIZE, sizeof(float),
+                        "mdeGranularRecordStart", g->warnings);
+    r->frames = mdeCalloc(channels * r->blockSize, sizeof(float),
+                          "mdeGranularRecordStart", g->warnings);
+    if (live)
+      r->in = mdeCalloc(r->blockSize, sizeof(mdefloat),
+                        "mdeGranularRecordStart", g->warnings);
+    if (!r->ring || !r->frames || (live && !r->in)) {
+      mdeGranularRecorderDelete(r);
+      return 1;
+    }
+    /* the audio thread may be in the middle of a tick with the old one, so
+     * that waits for DSP to stop (or mdeGranularFree) */
+    r->next = atomic_exchange(&g->recorder, r);
+    if (r->next) {
+      r->next->next = g->recordersRetired;
+      g->recordersRetired = r->next;
+      r->next = NULL;
+    }
+  }
+  r->fp = fopen(path, "wb");
+  if (!r->fp) {
+    mdeGranularError("mdeGranular~: %s: can't open file for recording", path);
+    return 1;
+  }
+  strncpy(r->path, path, MAXSOUNDFILEPATH - 1);
+  r->samplingRate = g->samplingRate;
+  r->dataBytes = 0;
+  r->failed = 0;
+  if (mdeGranularRecordHeader(r)) {
+    fclose(r->fp);
+    r->fp = NULL;
+    mdeGranularError("mdeGranular~: %s: can't write to file for recording",
+                     path);
+    return 1;
+  }
+  /* anything left over from last time would be out of place */
+  atomic_store(&r->tail, atomic_load(&r->head));
+  atomic_store(&r->dropped, 0UL);
+  r->gotIn = 0;
+  atomic_store(&r->on, 1);
+  if (mdeThreadStart(&r->thread, mdeGranularRecordWriter, r)) {
+    atomic_store(&r->on, 0);
+    fclose(r->fp);
+    r->fp = NULL;
+    mdeGranularError("mdeGranular~: %s: can't start recording", path);
+    return 1;
   }
+  r->running = 1;
+  return 0;
+}
 
-  cminusb = c - b;
-  result = (b + fraction * (cminusb - (mdefloat)0.5 * (fraction - (mdefloat)1.0)
-                            * ((a - d + (mdefloat)3.0 * cminusb) * fraction + 
-                               (b - a - cminusb))));
-#ifdef DEBUG
-  if (result > 1.0)
-    post("%f at index %d (numSamples: %d, a,b,c,d=%f %f %f %f)\n", 
-         result, indexTrunc, numSamples, a, b, c, d);
-#endif
+/*****************************************************************************/
 
-  return result;
+/** Write (or, once the writer thread is done, rewrite with the right sizes)
+ *  the WAV header: 32-bit floats, WAVE_FORMAT_EXTENSIBLE when there are more
+ *  than two channels. Room is left (in a JUNK chunk) for the ds64 chunk
+ *  that turns it into an RF64 file if it ends up too big for the 32-bit
+ *  sizes. Returns 0 on success. */
+
+int mdeGranularRecordHeader(mdeGranularRecorder* r)
+{
+  /* KSDATAFORMAT_SUBTYPE_IEEE_FLOAT after its first two bytes */
+  static const unsigned char guid[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38,
+    0x9B, 0x71
+  };
+  unsigned char hdr[104];
+  int ext = r->channels > 2;
+  unsigned long fmtBytes = ext ? 40 : 16;
+  unsigned long sr = (unsigned long)r->samplingRate;
+  unsigned long align = (unsigned long)r->channels * 4;
+  unsigned long long data = r->dataBytes;
+  unsigned long long riff = 4 + 36 + 8 + fmtBytes + 8 + data;
+  int rf64 = riff > 0xFFFFFFFFULL;
+  unsigned char* p = hdr;
+
+  memset(hdr, 0, sizeof(hdr));
+  memcpy(p, rf64 ? "RF64" : "RIFF", 4);
+  mdePutLE32(p + 4, rf64 ? 0xFFFFFFFFUL : (unsigned long)riff);
+  memcpy(p + 8, rf64 ? "WAVEds64" : "WAVEJUNK", 8);
+  mdePutLE32(p + 16, 28);
+  if (rf64) {
+    mdePutLE64(p + 20, riff);
+    mdePutLE64(p + 28, data);
+    mdePutLE64(p + 36, data / align);
+    /* and no table of other chunks' sizes */
+  }
+  /* the fmt chunk comes after the 36 bytes of ds64 (or JUNK) */
+  p += 36;
+  memcpy(p + 12, "fmt ", 4);
+  mdePutLE32(p + 16, fmtBytes);
+  mdePutLE16(p + 20, ext ? 0xFFFE : 3);
+  mdePutLE16(p + 22, (unsigned long)r->channels);
+  mdePutLE32(p + 24, sr);
+  mdePutLE32(p + 28, sr * align);
+  mdePutLE16(p + 32, align);
+  mdePutLE16(p + 34, 32);
+  p += 36;
+  if (ext) {
+    mdePutLE16(p, 22);
+    mdePutLE16(p + 2, 32);
+    /* no speaker positions */
+    mdePutLE32(p + 4, 0);
+    mdePutLE16(p + 8, 3);
+    memcpy(p + 10, guid, 14);
+    p += 24;
+  }
+  memcpy(p, "data", 4);
+  mdePutLE32(p + 4, rf64 ? 0xFFFFFFFFUL : (unsigned long)data);
+  p += 8;
+  return mdeSeek(r->fp, 0, SEEK_SET) ||
+    fwrite(hdr, 1, (size_t)(p - hdr), r->fp) != (size_t)(p - hdr);
 }
 
 /*****************************************************************************/
 
-/** Return a random number between min (inclusive) and max (exclusive).
- *  */
+/** Stop recording: the writer thread writes what's left, the header gets the
+ *  right sizes and the file is closed. The recorder stays allocated (the
+ *  audio thread might still be looking at it) until mdeGranularRecordFree,
+ *  or is retired by a record that needs a different number of channels or
+ *  block size. */
 
-mdefloat between(mdefloat min, mdefloat max)
+void mdeGranularRecordStop(mdeGranular* g)
 {
-  /* 2/4/08 the code used to be (mdefloat)(RAND_MAX + 1) but
-   * with MacIntel this obviously caused wraparound to a negative
-   * int and a negative number to be returned when min and
-   * max were both positive!  Should have seen that one coming....
-   */
-  static const mdefloat div = (mdefloat)RAND_MAX + (mdefloat)1.0;
-  
-  if (min == max)
-    return min;
-  else {
-    int r = rand();
-    mdefloat diff = max - min;
-    mdefloat scaler = diff / div;
-    return (min + (r * scaler));
+  mdeGranularRecorder* r = atomic_load(&g->recorder);
+  unsigned long dropped;
+
+  if (!r || !r->running)
+    return;
+  atomic_store(&r->on, 0);
+  mdeThreadJoin(r->thread);
+  r->running = 0;
+  dropped = atomic_load(&r->dropped);
+  if (dropped && g->warnings) {
+    post("mdeGranular~:");
+    post("              %s: %lu blocks were dropped as the ", r->path,
+         dropped);
+    post("              disk couldn't keep up.");
   }
 }
 
 /*****************************************************************************/
 
-/** Flip of a coin, i.e. return randomly 0 or 1
- *  */
+/** Only when the audio thread can't be using the recorder: see
+ *  mdeGranularFree. */
 
-int flip(void)
+void mdeGranularRecordFree(mdeGranular* g)
 {
-  static const long thresh = (RAND_MAX / 2);
-  return (rand() > thresh);
+  mdeGranularRecordStop(g);
+  mdeGranularRecorderDelete(atomic_exchange(&g->recorder,
+                                            (mdeGranularRecorder*)NULL));
+  mdeGranularRecordFreeRetired(g);
 }
 
 /*****************************************************************************/
 
-/** Simple memory allocation for an array using stdlib's calloc (PD) or MaxMSP
- *  API's sysmem_newptrclear but checking for out of memory problem. By using
- *  calloc (PD) or the MAX function, the bytes are guaranteed to be initialized
- *  to zero. */
+/** Free the recorders that record swapped out (their writer threads have
+ *  already stopped). The hosts call this from their DSP methods, as DSP has
+ *  been off (so our perform routine isn't running) when those are called. */
 
-void* mdeCalloc(int howmany, size_t size, char* caller, char warn)
+void mdeGranularRecordFreeRetired(mdeGranular* g)
 {
-  void* ret = 0x0;
+  mdeGranularRecorder* r;
 
-  if (howmany < 1 || size < 1) {
-    if (warn)
-      post("mdeGranular~: request for 0 bytes (from %s)????", caller);
-    return NULL;
+  while ((r = g->recordersRetired)) {
+    g->recordersRetired = r->next;
+    mdeGranularRecorderDelete(r);
   }
-#ifdef MAXMSP
-  ret = sysmem_newptrclear(howmany * size);
-#else
-  ret = calloc(howmany, size);
-#endif
-  if (!ret && warn)
-    post("mdeGranular~: mdeCalloc: Out of memory (from %s)!", caller);
-  return ret;
 }
 
 /*****************************************************************************/
 
-void mdeFree(void* what)
+void mdeGranularRecorderDelete(mdeGranularRecorder* r)
 {
-#ifdef MAXMSP
-  sysmem_freeptr(what);
-#else
-  free(what);
-#endif
+  if (!r)
+    return;
+  if (r->ring)
+    mdeFree(r->ring);
+  if (r->frames)
+    mdeFree(r->frames);
+  if (r->in)
+    mdeFree(r->in);
+  mdeFree(r);
 }
 
 /*****************************************************************************/
 
-/** Check whether a string contains a number, i.e. only digits and dots.
- *  */
+/** The writer thread: every 10ms, write whatever whole blocks are in the
+ *  ring. If the disk won't take them we say so (once) and carry on emptying
+ *  the ring, so that the file is as long as what got written. */
 
-int isanum(char* input)
+void mdeGranularRecordWriter(void* arg)
 {
-  int ok = 1;
-
-  do {
-    if (!isdigit(*input) && *input != '.' && *input != '\0') {
-      ok = 0;
-      break;
+  mdeGranularRecorder* r = (mdeGranularRecorder*)arg;
+  unsigned long block = (unsigned long)(r->channels * r->blockSize);
+  unsigned long head;
+  unsigned long tail;
+  unsigned long k;
+  long i;
+  int c;
+  int on;
+  int err;
+  float* f;
+
+  for (;;) {
+    /* look at -on- first so that we write everything pushed before it went
+     * to 0 */
+    on = atomic_load(&r->on);
+    head = atomic_load_explicit(&r->head, memory_order_acquire);
+    tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    while (head - tail >= block) {
+      f = r->frames;
+      for (i = 0; i < r->blockSize; ++i)
+        for (c = 0, k = tail + i; c < r->channels;
+             ++c, k += (unsigned long)r->blockSize)
+          *f++ = r->ring[k & (RECORDRINGSIZE - 1)];
+      if (!r->failed) {
+        if (fwrite(r->frames, sizeof(float), block, r->fp) == block)
+          r->dataBytes += block * sizeof(float);
+        else {
+          r->failed = 1;
+          mdeGranularError("mdeGranular~: %s: can't write any more (is the "
+                           "disk full?); the recording stops here", r->path);
+        }
+      }
+      tail += block;
+      atomic_store_explicit(&r->tail, tail, memory_order_release);
     }
-  } while (*input++);
-  return ok;
+    if (!on)
+      break;
+    mdeSleepMS(10);
+  }
+  /* now we know how long it is (if the header can't be written, readers
+   * will take the data to go to the end of the file) */
+  err = mdeGranularRecordHeader(r);
+  if (fclose(r->fp))
+    err = 1;
+  if (err && !r->failed)
+    mdeGranularError("mdeGranular~: %s: couldn't finish the recording's "
+                     "header", r->path);
+  r->fp = NULL;
 }
 
 /*****************************************************************************/
 
-/* Inlet methods just call portable object's methods */
+/** Called by mdeGranularCopyInputSamples: keep this tick's live input for
+ *  mdeGranularRecordBlock, if we're recording it. */
 
-void mdeGranular_tildeTranspositionOffsetST(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetTranspositionOffsetST(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeGrainLengthMS(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetGrainLengthMS(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeGrainLengthDeviation(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetGrainLengthDeviation(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeSamplesStartMS(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetSamplesStartMS(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeSamplesEndMS(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetSamplesEndMS(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeDensity(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetDensity(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeActiveChannels(t_mdeGranular_tilde* x, long l)
-{
-  mdeGranularSetActiveChannels(&x->x_g, l);
-}
-void mdeGranular_tildeWarnings(t_mdeGranular_tilde* x, long l)
-{
-  mdeGranularSetWarnings(&x->x_g, l);
-}
-void mdeGranular_tildeGrainAmp(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetGrainAmp(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeMaxVoices(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetMaxVoices(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeActiveVoices(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetActiveVoices(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeRampLenMS(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetRampLenMS(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeRampType(t_mdeGranular_tilde *x, t_symbol *s)
-{
-  mdeGranularSetRampType(&x->x_g, (char*)s->s_name);
-}
-void mdeGranular_tildeOn(t_mdeGranular_tilde *x)
-{
-  mdeGranularOn(&x->x_g);
-}
-void mdeGranular_tildeOff(t_mdeGranular_tilde *x)
-{
-  mdeGranularOff(&x->x_g);
-}
-void mdeGranular_tildeSetLiveBufferSize(t_mdeGranular_tilde *x, mdefloat f)
-{
-  mdeGranularSetLiveBufferSize(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeDoGrainDelays(t_mdeGranular_tilde *x)
-{
-  mdeGranularDoGrainDelays(&x->x_g);
-}
-void mdeGranular_tildeSmoothMode(t_mdeGranular_tilde *x)
-{
-  mdeGranularSmoothMode(&x->x_g);
-}
-void mdeGranular_tildeOctaveSize(t_mdeGranular_tilde *x, mdefloat f)
-{
-  mdeGranularOctaveSize(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeOctaveDivisions(t_mdeGranular_tilde *x, mdefloat f)
-{
-  mdeGranularOctaveDivisions(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildePortion(t_mdeGranular_tilde *x, mdefloat position, 
-                              mdefloat width)
-{
-  mdeGranularPortion(&x->x_g, (mdefloat)position, (mdefloat)width);
-}
-void mdeGranular_tildePortionPosition(t_mdeGranular_tilde *x, mdefloat position)
+void mdeGranularRecordInput(mdeGranular* g, mdefloat* in, long n)
 {
-  mdeGranularPortionPosition(&x->x_g, (mdefloat)position);
+  mdeGranularRecorder* r = atomic_load_explicit(&g->recorder,
+                                                memory_order_acquire);
+
+  if (!r || !r->in || n != r->blockSize ||
+      !atomic_load_explicit(&r->on, memory_order_relaxed))
+    return;
+  memcpy(r->in, in, n * sizeof(mdefloat));
+  r->gotIn = 1;
 }
-void mdeGranular_tildePortionWidth(t_mdeGranular_tilde *x, mdefloat width)
+
+/*****************************************************************************/
+
+/** Copy -n- samples to the ring from -head- on, as floats. */
+
+void mdeGranularRecordPut(mdeGranularRecorder* r, unsigned long head,
+                          const mdefloat* samples, long n)
 {
-  mdeGranularPortionWidth(&x->x_g, (mdefloat)width);
+  unsigned long at = head & (RECORDRINGSIZE - 1);
+  long first = (long)(RECORDRINGSIZE - at);
+  long i;
+
+  if (first > n)
+    first = n;
+  if (sizeof(mdefloat) == sizeof(float)) {
+    memcpy(r->ring + at, samples, first * sizeof(float));
+    memcpy(r->ring, samples + first, (n - first) * sizeof(float));
+  }
+  else {
+    for (i = 0; i < first; ++i)
+      r->ring[at + i] = (float)samples[i];
+    for (; i < n; ++i)
+      r->ring[i - first] = (float)samples[i];
+  }
 }
-void mdeGranular_tildeBufferGrainRamp(t_mdeGranular_tilde *x, t_symbol *s,
-                                      mdefloat grain_len, mdefloat ramp_len)
+
+/*****************************************************************************/
+
+/** Called by the audio thread (only: it's the ring's single producer) at the
+ *  end of mdeGranularGo, when the outputs are what they'll be. */
+
+void mdeGranularRecordBlock(mdeGranular* g)
 {
-  mdeGranularBufferGrainRamp(x, s, grain_len, ramp_len);
+  mdeGranularRecorder* r = atomic_load_explicit(&g->recorder,
+                                                memory_order_acquire);
+  unsigned long head;
+  long n;
+  int c;
+
+  if (!r || !atomic_load_explicit(&r->on, memory_order_relaxed))
+    return;
+  n = r->blockSize;
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (g->nOutputSamples != n ||
+      head - atomic_load_explicit(&r->tail, memory_order_acquire) >
+      RECORDRINGSIZE - (unsigned long)(r->channels * n)) {
+    atomic_fetch_add_explicit(&r->dropped, 1UL, memory_order_relaxed);
+    r->gotIn = 0;
+    return;
+  }
+  for (c = 0; c < g->numChannels; ++c, head += (unsigned long)n)
+    mdeGranularRecordPut(r, head, g->channelBuffers[c], n);
+  if (r->in) {
+    /* no input this tick (we're off, or it's idle) is silence */
+    if (!r->gotIn)
+      silence(r->in, n);
+    mdeGranularRecordPut(r, head, r->in, n);
+    head += (unsigned long)n;
+    r->gotIn = 0;
+  }
+  atomic_store_explicit(&r->head, head, memory_order_release);
 }
 
 /*****************************************************************************/
@@ -2005,13 +6730,6 @@ double mus_bessi0(mdefloat x)
 
 /*****************************************************************************/
 
-#ifndef M_PI
-#define M_PI (mdefloat)3.14159265358979323846264338327
-#endif
-#ifndef TWO_PI
-#define TWO_PI ((mdefloat)2.0 * M_PI)
-#endif
-
 /*****************************************************************************/
 
 /** The Kaiser, Cauchy, Poisson, Gaussian, and Tukey windows all use the beta
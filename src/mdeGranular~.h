@@ -40,6 +40,8 @@
 /* #define MAXMSP */
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #ifdef MAXMSP
 #include "ext.h"
@@ -47,15 +49,19 @@
 #include "z_dsp.h"
 #include "buffer.h"
 #define VERSION "1.2 (Max API 8.2, with M1 support)"
-#define mdeGranularError(...) object_error(NULL, __VA_ARGS__)
+#define mdeHostError(...) object_error(NULL, __VA_ARGS__)
 #endif
 
 #ifdef PD
 #include "m_pd.h"
 #define VERSION "1.2"
-#define mdeGranularError(...) pd_error(NULL, __VA_ARGS__)
+#define mdeHostError(...) pd_error(NULL, __VA_ARGS__)
 #endif
 
+/* errors go through mdeGranularLog so that they're never posted from the
+ * audio thread */
+#define mdeGranularError(...) mdeGranularLog(1, __VA_ARGS__)
+
 #ifdef WIN32
 #define inline __inline
 #endif
@@ -82,6 +88,17 @@ typedef t_float mdefloat;
 typedef double mdefloat;
 #endif
 
+/** Sample counts, buffer lengths and indexes into buffers: 64 bits whatever
+ *  the platform (a long is only 32 on Windows), so hours of audio fit. */
+typedef int64_t mdelong;
+
+/** A grain's read position in the sample buffer as 32.32 fixed point: the
+ *  top 32 bits are the (signed) sample index, the bottom 32 the fraction.
+ *  Adding the increment every sample never loses the accuracy a float does
+ *  far into a long buffer. The index is relative to the grain's base sample
+ *  so that buffers longer than 2^31 samples can still be addressed. */
+typedef int64_t mdePhase;
+
 /*****************************************************************************/
 
 /** Enumeration for holding the status of the granulator and the grains. */
@@ -89,6 +106,60 @@ typedef enum
   { OFF, ON, STARTING, STOPPING, ACTIVE, INACTIVE, SKIPGRAIN }
   t_status;
 
+/** The parameters that can be given signals rather than floats (when the
+ *  object's third argument is non-zero), in inlet order. */
+typedef enum
+  { SIG_TRANSPOSITION, SIG_GRAINLENGTH, SIG_DEVIATION, SIG_START, SIG_END,
+    SIG_DENSITY, SIG_GRAINAMP, SIG_PORTION, NUMSIGPARAMS }
+  t_sigparam;
+
+/** How grains choose which channel of a multichannel source to read: always
+ *  the same one, the one with the same number as their output channel
+ *  (wrapping), or any at random. */
+typedef enum
+  { SRC_FIXED, SRC_OUTPUT, SRC_RANDOM }
+  t_srcmode;
+
+/** How grains are placed in the output channels: each on one channel chosen
+ *  at random (the original behaviour), panned with equal power between two
+ *  adjacent channels, the channels being in a line or a ring, or encoded into
+ *  Ambisonic B-format, the outputs being the harmonics (ACN order, SN3D). */
+typedef enum
+  { PAN_DISCRETE, PAN_LINE, PAN_RING, PAN_AMBISONIC }
+  t_panmode;
+
+/** In onset mode, which playing grain to give up when a new one is due and
+ *  all the voices are busy: the one that's been playing longest, the one whose
+ *  envelope is lowest at the moment, or only one that's already ramping down
+ *  (the new grain being dropped if there's none). */
+typedef enum
+  { STEAL_OLDEST, STEAL_QUIETEST, STEAL_RAMP }
+  t_stealmode;
+
+/** The shapes of mdeSmoother's segments: a straight line, an exponential
+ *  curve (fast at first, then settling), or the shape of a table rising from
+ *  0 to 1 (e.g. the ramp window's rampUp) or falling from 1 to 0 (its
+ *  rampDown). */
+typedef enum
+  { SMOOTH_LINEAR, SMOOTH_EXPONENTIAL, SMOOTH_TABLE, SMOOTH_TABLEDOWN }
+  t_smoothshape;
+
+/** Why a grain didn't sound: density, not enough samples between start and
+ *  end for its length and transposition, too short for its ramps, not read
+ *  from disk yet, the CPU governor, the process-wide grain budget, or (in
+ *  onset mode) no voice free or to steal. */
+typedef enum
+  { SKIP_DENSITY, SKIP_WINDOW, SKIP_SHORT, SKIP_STREAM, SKIP_GOVERNOR,
+    SKIP_BUDGET, SKIP_NOVOICE, NUMSKIPS }
+  t_skip;
+
+/** The stages of mdeGranularGo that are timed separately when we're compiled
+ *  with MDEPROFILE #defined (see the profile message). */
+typedef enum
+  { PROF_GO, PROF_GRAINAMPS, PROF_SILENCE, PROF_GRAININIT, PROF_READ,
+    PROF_RAMP, PROF_STATUSRAMP, NUMPROFSTAGES }
+  t_profstage;
+
 /*****************************************************************************/
 
 /** the maximum number of transpositions the granulator can handle */
@@ -98,8 +169,73 @@ typedef enum
 #define MINLIVEBUFSIZE 6.0
 
 #define DEFAULT_RAMP_TYPE "HANNING"
+/* the longest ramp type name we keep (they're all much shorter) */
+#define RAMPTYPELEN 32
 #define DEFAULT_RAMP_LEN 10
 #define RAMPLENMINMS 0.5
+/* an exponential smoothing segment has come this close (-60dB) to its target
+ * by its end, when it jumps there */
+#define SMOOTHEXPFLOOR 0.001
+/* how many random numbers mdeGranularGrainInit uses (pan and Ambisonic
+ * direction included), and for how many grains ending in one tick the
+ * planner draws them in advance (see mdeGranularPlan) */
+#define PLANDRAWS 9
+#define PLANMAXGRAINS 1024
+/* how many scenes the snapshot message can store */
+#define MAXSCENES 32
+/* how many scenes the audio thread can be reading at once (recall, and the
+ * two of a morph; see mdeGranularSceneAcquire) */
+#define SCENEREADERS 3
+/* how many layers (see the Layers message) one object can have */
+#define MAXLAYERS 16
+/* set in statsMiddle when the audio thread has left new stats there */
+#define STATSFRESH 4
+/* one sample in a phase (see mdePhase) */
+#define PHASEONE 4294967296.0
+#define PHASEFRACMASK 0xffffffffLL
+
+/* the longest path we'll accept for sound files */
+#define MAXSOUNDFILEPATH 1024
+/* the highest Ambisonic order we can encode */
+#define MAXAMBIORDER 5
+/* the most output channels a single grain can be mixed into: all the
+ * harmonics of the highest order */
+#define MAXGRAINOUTS ((MAXAMBIORDER + 1) * (MAXAMBIORDER + 1))
+/* the resolution of the equal-power panning table */
+#define PANTABLESIZE 1024
+/* the streaming cache: how many frames are read from disk at once and how
+ * many such blocks are kept in memory */
+#define STREAMBLOCKFRAMES 65536
+#define STREAMCACHEBLOCKS 64
+/* the CPU governor: how quickly (per tick) work is shed when we're over
+ * budget and restored when we're comfortably under it, and the number of
+ * stages of shedding (see mdeGranularGovern) */
+#define GOVSHEDSTEP 0.05
+#define GOVRESTORESTEP 0.002
+#define GOVSTAGES 3
+/* the process-wide grain budget: how many seconds' worth of grains can be
+ * saved up for a burst, and how much of that saving the lowest priority
+ * instances have to leave for the others */
+#define BUDGETBURSTSECS 0.1
+#define BUDGETRESERVE 0.5
+/* how many grain events the trace can hold before the writer thread gets to
+ * them (a power of 2) */
+#define TRACERINGSIZE 16384
+/* how many samples (all channels) the recorder's ring holds before the writer
+ * thread gets to them (a power of 2): 8MB, seconds of output */
+#define RECORDRINGSIZE (1UL << 21)
+/* the live input is silent (see IdleAfter) when no sample is louder than this
+ * (-100dB) */
+#define IDLESILENCE 0.00001
+/* how many messages from the audio thread can wait to be posted (a power of
+ * 2), how long each may be, and how many a second we'll post at most: the
+ * rest are dropped and counted */
+#define LOGRINGSIZE 256
+#define LOGMSGLEN 256
+#define LOGRATE 50
+/* how often (ms) the hosts look for messages whilst a background thread is
+ * running, as no tick might come along to prompt them */
+#define LOGPOLLMS 250
 
 /* to suppress warnings about unused arguments */
 #define UNUSED(x) (void)(x)
@@ -109,19 +245,22 @@ typedef enum
 typedef struct _mdeGranularGrain
 {
   /** grain length in samples */
-  long length;        
-  /** start sample */
-  mdefloat start;     
+  mdelong length;
+  /** start sample (double as a float can't address far into a long buffer) */
+  double start;
   /** end sample */
-  mdefloat end;       
+  double end;
   /** at which value of icurrent does the ramp up end */
-  long endRampUp;     
+  mdelong endRampUp;
   /** at which value of icurrent does the ramp down start */
-  long startRampDown; 
-  /** current sample index (partial) into the sample buffer */
-  mdefloat current;   
+  mdelong startRampDown;
+  /** current sample index (partial) into the sample buffer: base + phase */
+  mdelong base;
+  mdePhase phase;
+  /** inc as a phase, added to phase each sample */
+  mdePhase phaseInc;
   /** sample counter for the grain (from 0 to length) */
-  long icurrent;      
+  mdelong icurrent;
   /** index into ramp */
   long rampi;         
   /** sample increment */
@@ -137,19 +276,275 @@ typedef struct _mdeGranularGrain
   t_status activeStatus;
   /** which channel the grain will be played on */
   int channel; 
+  /** which channel of the (interleaved) source the grain reads from */
+  int srcChannel;
+  /** when panning, how many output channels the grain is mixed into (0 when
+   *  it goes straight to -channel-), which ones, and with what gains */
+  int nOuts;
+  int outChannels[MAXGRAINOUTS];
+  mdefloat outGains[MAXGRAINOUTS];
   /** whether to introduce a delay the next time the grain is initialised.
    * 4/4/08:  0 = no delay; 1 = random delay; anything else is the number of
    * samples to delay */
-  int doDelay;
+  mdelong doDelay;
   /** when the grains are initialized at the beginning, we make it wait for a
    *  while until it actually starts output */
-  long firstDelay;
+  mdelong firstDelay;
   /** this is the counter up to firstDelay */
-  long firstDelayCounter;
+  mdelong firstDelayCounter;
+  /** in onset mode, whether the grain's voice has been claimed by a new
+   *  grain, i.e. it's fading out early */
+  char stolen;
+  /** when streaming, whether the grain has pinned the cache blocks
+   *  pinFirst to pinLast it's reading from, so that the reader thread leaves
+   *  their slots alone until it's done with them */
+  char pinned;
+  mdelong pinFirst;
+  mdelong pinLast;
 } mdeGranularGrain;
 
 /*****************************************************************************/
 
+/** Counters for the stats message, kept up to date as we go (cheaply enough
+ *  to leave on) and reset each time they're read. */
+typedef struct _mdeGranularStats
+{
+  long grainsStarted;
+  long skips[NUMSKIPS];
+  /** samples read without and with interpolation */
+  long integerReads;
+  long interpolatedReads;
+  /** how many times mdeGranularGo was called and how long it took */
+  long ticks;
+  double minNS;
+  double maxNS;
+  double totalNS;
+} mdeGranularStats;
+
+/*****************************************************************************/
+
+/** The sample formats we can read from sound files. */
+typedef enum
+  { SF_UNKNOWN, SF_PCM16, SF_PCM24, SF_PCM32, SF_FLOAT32, SF_FLOAT64 }
+  t_sfformat;
+
+/** What we need to know about a sound file's sample data: parsed from a WAV
+ *  header or, for raw float files, given with the open or stream message. */
+typedef struct _mdeGranularSoundFile
+{
+  t_sfformat format;
+  int channels;
+  /** bytes per sample (not per frame) */
+  int bytesPerSample;
+  mdefloat samplingRate;
+  /** where the first sample frame is, in bytes from the start of the file */
+  mdelong dataOffset;
+  mdelong nFrames;
+} mdeGranularSoundFile;
+
+/** A sound file mapped read-only into memory by the open message. */
+typedef struct _mdeGranularMapping
+{
+  char path[MAXSOUNDFILEPATH];
+  mdeGranularSoundFile info;
+  /** the start of the mapping, i.e. of the file */
+  void* base;
+  size_t bytes;
+  /** the first sample frame, when we can granulate the mapping directly;
+   *  NULL when the file's data had to be converted into theSamples */
+  mdefloat* samples;
+  /* Windows file and file-mapping HANDLEs */
+  void* file;
+  void* map;
+} mdeGranularMapping;
+
+/** A sound file being streamed from disk by the stream message: private to
+ *  mdeGranular~.c as it's shared with the reader thread. */
+typedef struct _mdeGranularStream mdeGranularStream;
+
+/** The grain events being traced to a file by the trace message: also
+ *  private to mdeGranular~.c, as it's shared with the writer thread. */
+typedef struct _mdeGranularTrace mdeGranularTrace;
+
+/** The outputs being recorded to a file by the record message: likewise. */
+typedef struct _mdeGranularRecorder mdeGranularRecorder;
+
+/** What happened to a grain, for the trace. */
+typedef enum
+  { TRACE_INIT, TRACE_END }
+  t_traceevent;
+
+/*****************************************************************************/
+
+/** A live input ring that several instances can granulate at once. Instances
+ *  join a ring by name with the liveshare message; the first to join (or
+ *  whoever joins after it has left) writes its signal inlet into the ring,
+ *  all the others just read from it along with its write index. The ring is
+ *  freed when the last instance leaves. */
+
+typedef struct _mdeGranularLiveShare
+{
+  /** the name given to the liveshare message */
+  char name[128];
+  /** the circular buffer of live samples */
+  mdefloat* samples;
+  /** the length of the circular buffer in samples */
+  mdelong nSamples;
+  /** index of the next sample to be written (see mdeGranular's liveIndex).
+   *  The instances sharing the ring may be on different audio threads (in
+   *  Max), so this is stored with release once the samples are in and
+   *  loaded with acquire. */
+  _Atomic(mdelong) liveIndex;
+  /** how many instances are reading from (or writing to) this ring */
+  int refCount;
+  /** the instance that copies its input into the ring: NULL until claimed,
+   *  which is done with a compare-and-swap so only one can */
+  _Atomic(struct _mdeGranular*) writer;
+  struct _mdeGranularLiveShare* next;
+} mdeGranularLiveShare;
+
+/*****************************************************************************/
+
+/** A table for choosing one of -n- things with given weights using a single
+ *  random number, whatever n is (Walker's alias method): take a random slot
+ *  i, then i itself with probability prob[i], otherwise alias[i]. See
+ *  mdeGranularAliasBuild and mdeGranularAliasPick. */
+
+typedef struct _mdeGranularAlias
+{
+  /** how many things we're choosing between, and the most there can be */
+  int n;
+  int capacity;
+  mdefloat* prob;
+  int* alias;
+  /** scratch space for building the table */
+  int* work;
+} mdeGranularAlias;
+
+/*****************************************************************************/
+
+/** What mdeGranularGrainInit works out from the parameters before it gets to
+ *  the random part, kept until one of them changes (see
+ *  mdeGranularInitCacheUpdate). */
+
+typedef struct _mdeGranularInitCache
+{
+  /** the parameters these were worked out from */
+  mdelong grainLength;
+  long rampLenSamples;
+  mdelong samplesStart;
+  mdelong samplesEnd;
+  mdefloat grainLengthDeviation;
+  long nOutputSamples;
+  /** the grain length made long enough for both ramps, twice the ramp
+   *  length, and the deviation as a fraction of the length */
+  mdelong plen;
+  int ramplength2;
+  mdefloat deviation;
+  /** start and end the forwards way round, and whether they were swapped */
+  mdelong start;
+  mdelong end;
+  int backwards;
+  /** log2 of nOutputSamples if it's a power of 2 (as it always is in
+   *  practice), otherwise -1 */
+  int outShift;
+} mdeGranularInitCache;
+
+/*****************************************************************************/
+
+/** A parameter that moves smoothly to new values a block at a time (see
+ *  mdeSmootherBlock). A new target can be given at any time, the segment
+ *  starting from wherever it's got to. */
+
+typedef struct _mdeSmoother
+{
+  /** the value now, i.e. the last one output */
+  mdefloat value;
+  /** where the segment started and where it's going */
+  mdefloat from;
+  mdefloat target;
+  /** the increment per sample (SMOOTH_LINEAR) or the multiplier of the
+   *  distance to go (SMOOTH_EXPONENTIAL) */
+  mdefloat step;
+  mdefloat coef;
+  /** for SMOOTH_TABLE: -length- values rising from 0 to 1 */
+  const mdefloat* table;
+  /** the segment's length and how much of it is left, in samples: 0 when
+   *  we're there */
+  long length;
+  long remaining;
+  t_smoothshape shape;
+} mdeSmoother;
+
+/*****************************************************************************/
+
+/** A scene: the parameters as they were when the snapshot message was sent
+ *  and, if asked for, the grains themselves. Everything is allocated by
+ *  snapshot so that recalling (see mdeGranularRecallNow) only copies. */
+
+typedef struct _mdeGranularScene
+{
+  /** whether the grains were kept */
+  char hasGrains;
+  int activeVoices;
+  mdefloat transpositionOffsetST;
+  mdefloat transpositionOffset;
+  int numTranspositions;
+  mdefloat transpositions[MAXTRANSPOSITIONS];
+  mdefloat srcs[MAXTRANSPOSITIONS];
+  mdefloat transpositionWeights[MAXTRANSPOSITIONS];
+  int numTranspositionWeights;
+  mdefloat octaveSize;
+  mdefloat octaveDivisions;
+  mdefloat grainLengthMS;
+  mdelong grainLength;
+  mdefloat grainLengthDeviation;
+  int activeChannels;
+  /** numChannels of them */
+  mdefloat* channelWeights;
+  int numChannelWeights;
+  mdefloat samplesStartMS;
+  mdefloat samplesEndMS;
+  mdefloat portionPosition;
+  mdefloat portionWidth;
+  char rampType[RAMPTYPELEN];
+  mdefloat rampLenMS;
+  long rampLenSamples;
+  /** the ramp up and down (rampLenSamples * 2), and the room for it */
+  mdefloat* ramp;
+  long rampCapacity;
+  mdefloat density;
+  mdefloat grainAmp;
+  mdefloat grainAmpSmoothMS;
+  t_smoothshape grainAmpShape;
+  t_srcmode sourceChannelMode;
+  int sourceChannel;
+  t_panmode panMode;
+  mdefloat panCentre;
+  mdefloat panWidth;
+  int ambiOrder;
+  mdefloat ambiAzimuth;
+  mdefloat ambiAzimuthWidth;
+  mdefloat ambiElevation;
+  mdefloat ambiElevationWidth;
+  mdefloat onsetRate;
+  mdefloat onsetJitter;
+  t_stealmode stealMode;
+  mdefloat idleAfterMS;
+  /** when hasGrains: copies of the voices (maxVoices of them) and the pool */
+  int maxVoices;
+  mdeGranularGrain* grains;
+  int* pool;
+  int nPlaying;
+  int pendingOnsets;
+  double onsetPhase;
+  /** each layer's parameters (and grains), kept the same way */
+  struct _mdeGranularScene* layers;
+  int numLayers;
+} mdeGranularScene;
+
+/*****************************************************************************/
+
 /** Wrapper structure to hold the grain voices and other data relating
  *  to the overal granulation process.
  *
@@ -177,10 +572,16 @@ typedef struct _mdeGranular
   /** an array of transpositions in src (1 no transposition, 0.5 octave lower,
    *  2 octave above), convereted from above */
   mdefloat srcs[MAXTRANSPOSITIONS];
+  /** how likely each transposition is to be chosen, relative to the others
+   *  (see TranspositionWeights); those without a weight have 1 */
+  mdefloat transpositionWeights[MAXTRANSPOSITIONS];
+  int numTranspositionWeights;
+  /** built from the above whenever it or the transpositions change */
+  mdeGranularAlias transpositionAlias;
   /** the grain length in milliseconds, as given to the object */
   mdefloat grainLengthMS;
   /** the grain length in samples, converted from above */
-  int grainLength;
+  mdelong grainLength;
   /** percentage deviation for grain length: actual grain length will be
    * randomised within grainLength +/- deviation */
   mdefloat grainLengthDeviation;
@@ -190,6 +591,21 @@ typedef struct _mdeGranular
   int numChannels;
   /** the number of output channels currently sending grains */
   int activeChannels;
+  /** as transpositionWeights, but for the active channels (numChannels of
+   *  them), when grains aren't panned (see ChannelWeights) */
+  mdefloat* channelWeights;
+  int numChannelWeights;
+  mdeGranularAlias channelAlias;
+  /** where the random numbers for new grains come from: the next position in
+   *  a counter-based stream (see mdeGranularRandom) */
+  uint32_t rngCounter;
+  /** the planner: random numbers drawn together at the start of the tick for
+   *  the grains that will end during it (planFilled of them, planUsed so
+   *  far) */
+  mdefloat* planRandoms;
+  int planFilled;
+  int planUsed;
+  mdeGranularInitCache initCache;
   /** where MSP/PD wants us to write each individual output channel
    * i.e. the signal outlets. N.B. Although it would seem that this
    * should be external to our object, we need access to all the
@@ -203,22 +619,86 @@ typedef struct _mdeGranular
   long nOutputSamples;
   /** array of grain structures, one for each voice */
   mdeGranularGrain* grains;
+  /** onset mode: new grains are started this many times a second (rather
+   *  than each voice restarting as soon as its last grain is over); 0 when
+   *  we're using voices */
+  mdefloat onsetRate;
+  /** the percentage by which the time between onsets is randomly varied */
+  mdefloat onsetJitter;
+  /** the number of samples from the start of this tick until the next onset
+   */
+  double onsetPhase;
+  /** the voices as a pool: indices into grains, the first nPlaying of which
+   *  are playing, the rest being free */
+  int* pool;
+  int nPlaying;
+  /** onsets waiting for a stolen voice to finish fading out */
+  int pendingOnsets;
+  /** which voice to steal when they're all busy */
+  t_stealmode stealMode;
+  /** the CPU governor: the percentage of a tick's duration mdeGranularGo may
+   *  take before we start shedding work; 0 turns the governor off */
+  mdefloat cpuBudget;
+  /** the (smoothed) percentage mdeGranularGo has been taking */
+  double cpuLoad;
+  /** how much work we're shedding, from 0 to GOVSTAGES, and the whole stage
+   *  we last reported */
+  double govShed;
+  int govStage;
+  /** what the governor leaves us with: cubic or linear interpolation, and
+   *  scalers for the number of voices and the density */
+  char govCheap;
+  mdefloat govVoices;
+  mdefloat govDensity;
+  /** how important this instance's grains are when the process-wide grain
+   *  budget (see GrainBudget) runs short: 0-100 */
+  mdefloat priority;
+  /** what's been happening since the stats were last read, and whether
+   *  they've just been read (so mdeGranularGo should start them again) */
+  mdeGranularStats stats;
+  atomic_int statsReset;
+  /** the stats as they were at the end of the last tick, layers and all,
+   *  handed over to the stats message by triple buffering: the audio thread
+   *  fills statsSlots[statsBack] and swaps it with statsMiddle (setting
+   *  STATSFRESH); the reader swaps statsFront for statsMiddle when that's
+   *  set. Neither ever looks at a slot the other has. */
+  mdeGranularStats statsSlots[3];
+  atomic_int statsMiddle;
+  int statsBack;
+  int statsFront;
+#ifdef MDEPROFILE
+  /** the time (in cycles or nanoseconds, see mdeTicks) spent in each stage,
+   *  and how many times we've been through it */
+  unsigned long long profTicks[NUMPROFSTAGES];
+  unsigned long long profCounts[NUMPROFSTAGES];
+#endif
   /** a sample buffer for storing live incoming samples; samples will
    *  point to this when we are granulating live. */
   mdefloat* theSamples;
-  /** the samples to granulate, whether live or from a buffer (always
-   *  a mono signal). this is only a pointer; the actual allocated buffer is
-   *  theSamples */  
+  /** the samples to granulate, whether live or from a buffer (interleaved
+   *  if there's more than one sourceChannel). this is only a pointer; the
+   *  actual allocated buffer is theSamples */  
   mdefloat* samples;
+  /** how many interleaved channels there are in samples: always 1 for live
+   *  input and PD arrays */
+  int sourceChannels;
+  /** how grains choose their source channel */
+  t_srcmode sourceChannelMode;
+  /** the (0-based) source channel when sourceChannelMode is SRC_FIXED */
+  int sourceChannel;
   /** how many samples there are in the buffer. NB If live
    *  granulation, this will actually be the size of the circular
    *  buffer into which samples are read (i.e. set in Init3()), not the
    *  actual buffer allocated by SetLiveBufferSize(), which will
    *  probably be larger. */
-  long nBufferSamples;
+  mdelong nBufferSamples;
+  /** the length of the circular buffer grains actually read samples from:
+   *  the same as nBufferSamples except when streaming, when samples is only
+   *  a cache of part of the file */
+  mdelong nReadSamples;
   /** this is the actual number of samples allocated for in the live
    *  buffer */
-  long nAllocatedBufferSamples;
+  mdelong nAllocatedBufferSamples;
   /** this is the same in millisecs */
   mdefloat AllocatedBufferMS;
   /** how many millisecs of samples there are in the buffer */
@@ -226,11 +706,11 @@ typedef struct _mdeGranular
   /** where to start in the samples in millisecs */
   mdefloat samplesStartMS;
   /** where to start in the samples in samples */
-  long samplesStart;
+  mdelong samplesStart;
   /** where to end in the samples in millisecs */
   mdefloat samplesEndMS;
   /** where to end in the samples in samples */
-  long samplesEnd;
+  mdelong samplesEnd;
   /** we do a straight ramp up, this is the length of such in
    *  milliseconds... */ 
   mdefloat rampLenMS;
@@ -240,6 +720,9 @@ typedef struct _mdeGranular
   mdefloat* rampUp;
   /** ...and ramp down */
   mdefloat* rampDown;
+  /** how many samples rampUp has room for (both ramps): it only ever grows,
+   *  so any scene's ramp can be recalled into it */
+  long rampCapacity;
   /** what percentage of grains should actually produce output. This
    *  is a percentage that will be used to randomly switch a grain on
    *  when it's over this threshold. */
@@ -247,29 +730,93 @@ typedef struct _mdeGranular
   /** whether the granulator should produce output or not (i.e. if this is 0,
    *  then it is silent) */
   t_status status;
-  /** amplitude scaler applied to all grains */
-  mdefloat grainAmp;
-  /** the last grain amp accepted */
-  mdefloat lastGrainAmp;
-  /** the grain amp we're aiming to reach */
-  mdefloat targetGrainAmp;
-  /** the increment needed to get from lastGrainAmp to targetGrainAmp over
-   *  a tick's worth of samples */
-  mdefloat grainAmpInc;
-  /** we need a tick's worth of grainAmps when moving from lastGrainAmp to
-   *  targetGrainAmp so here's storage for them */
+  /** amplitude scaler applied to all grains, smoothed */
+  mdeSmoother grainAmp;
+  /** how long new grain amps take to arrive (0 = one tick) and how (see the
+   *  GrainAmpSmoothing message) */
+  mdefloat grainAmpSmoothMS;
+  t_smoothshape grainAmpShape;
+  /** we need a tick's worth of grainAmps when moving to a new grain amp so
+   *  here's storage for them */
   mdefloat* grainAmps;
-  /** index into rampDown or rampUp for doing a quick fade in/out when the
-   *  granulator is stopped. */
-  long statusRampIndex;
+  /** the host's signal vectors for those parameters given signals (NULL for
+   *  the rest), set by PD/Max; they can share memory with our outputs so
+   *  mdeGranularCopySignals copies them into sigCopies before we write
+   *  anything and points sigIns there */
+  mdefloat* sigHost[NUMSIGPARAMS];
+  mdefloat* sigCopies;
+  mdefloat* sigIns[NUMSIGPARAMS];
+  /** the last value read from each signal: parameters are only updated when
+   *  their signal changes, so that messages still work for a constant (or
+   *  unconnected) signal inlet */
+  mdefloat sigLast[NUMSIGPARAMS];
+  /** where in the signal vectors we are (i.e. the sample a grain is being
+   *  initialised at); -1 when outside mdeGranularGo */
+  long sigIndex;
+  /** panned grains are rendered here first then mixed into their output
+   *  channels with their gains */
+  mdefloat* grainScratch;
+  /** how grains are placed in the output channels */
+  t_panmode panMode;
+  /** when panning: the centre of the grains' positions, in (0-based)
+   *  channels, and how far either side of it they can be */
+  mdefloat panCentre;
+  mdefloat panWidth;
+  /** the Ambisonic order we're encoding when panMode is PAN_AMBISONIC: the
+   *  highest the number of output channels allows */
+  int ambiOrder;
+  /** where Ambisonic grains are placed: random directions within the width
+   *  of each centre, all in radians */
+  mdefloat ambiAzimuth;
+  mdefloat ambiAzimuthWidth;
+  mdefloat ambiElevation;
+  mdefloat ambiElevationWidth;
+  /** the quick fade in/out when the granulator is started and stopped: the
+   *  shape of rampUp or rampDown, turning round smoothly if we're told to
+   *  stop whilst starting or vice versa. statusAmps holds a tick's worth.
+   *  NB the smoother points straight into the ramp, so whenever that's
+   *  rebuilt or moved whilst it's ramping, mdeGranularStatusTarget has to be
+   *  called again (see mdeGranularSetRampLenMS, mdeGranularRecallNow). */
+  mdeSmoother statusAmp;
+  mdefloat* statusAmps;
   /** we can granulate a static buffer of samples or a live incoming signal,
    *  this will be 0 or 1 respectively */
   char live;
   /** we store the incoming samples in |samples| which is then a circular
    *  buffer; this is the index to the oldest sample. */
-  long liveIndex;
+  mdelong liveIndex;
+  /** when not NULL, samples (and the live index) come from this shared ring
+   *  rather than theSamples and liveIndex */
+  mdeGranularLiveShare* liveShare;
+  /** the sound file we're granulating straight from the page cache (see the
+   *  open message), or NULL */
+  mdeGranularMapping* mapping;
+  /** the sound file we're streaming from disk (see the stream message), or
+   *  NULL */
+  mdeGranularStream* stream;
+  /** where grain events go when we're tracing (see the trace message); NULL
+   *  if we've never traced. A layer borrows its object's whilst it plays */
+  mdeGranularTrace* trace;
+  /** where the outputs go when we're recording (see the record message);
+   *  NULL if we've never recorded. Swapped, not freed, when record needs a
+   *  different shape, as the audio thread may be looking at it */
+  _Atomic(mdeGranularRecorder*) recorder;
+  /** those swapped out: freed by mdeGranularRecordFreeRetired once DSP
+   *  has stopped (the hosts call it when it starts again) or by
+   *  mdeGranularFree */
+  mdeGranularRecorder* recordersRetired;
+  /** how many samples we've output, i.e. the time in samples */
+  unsigned long long sampleClock;
+  /** when granulating live, how long (in millisecs) the input has to have been
+   *  silent before we stop granulating it (see mdeGranularInputIdle); 0 =
+   *  never */
+  mdefloat idleAfterMS;
+  /** how many silent input samples there've been in a row */
+  mdelong silentInput;
+  /** whether we're idling because of that */
+  char inputIdle;
   /** the type of window to use for ramping: hamming, blackman etc. */
-  char* rampType;
+  char rampType[RAMPTYPELEN];
   /** when doing transposition, what octave size and number of divisions are we
    *  working with (default 2 and 12) */
   mdefloat octaveSize;
@@ -280,6 +827,35 @@ typedef struct _mdeGranular
    *  Portion message */ 
   mdefloat portionPosition;
   mdefloat portionWidth;
+  /** MAXSCENES scenes (see the snapshot message), each NULL until it's
+   *  first snapshot. The audio thread reads them whilst snapshot makes new
+   *  ones, so snapshot fills sceneSpare, which nobody else can see, and
+   *  swaps it in, taking the old one as the next spare once the audio thread
+   *  isn't reading it (sceneReaders). */
+  _Atomic(mdeGranularScene*) scenes[MAXSCENES];
+  _Atomic(mdeGranularScene*) sceneReaders[SCENEREADERS];
+  mdeGranularScene* sceneSpare;
+  /** the (0-based) scene to recall at the start of the next tick (-1 =
+   *  none) */
+  atomic_int recallScene;
+  /** the two (0-based) scenes we're morphing between and how far from the
+   *  first to the second (0 to 1); morphPending says a new morph message
+   *  has come since the last tick (and publishes the other three) */
+  atomic_int morphA;
+  atomic_int morphB;
+  _Atomic(mdefloat) morphT;
+  atomic_int morphPending;
+  /** whether the transpositions and their weights are a morph's mixture
+   *  rather than the user's or a scene's own: a new transposition list then
+   *  starts without weights */
+  char morphedTranspositions;
+  /** more sets of parameters, each with its own voices, granulating our
+   *  source into our outputs (see the Layers and layer messages); NULL when
+   *  there are none */
+  struct _mdeGranular* layers;
+  int numLayers;
+  /** which of its object's layers this is (from 1), 0 for the object */
+  int layer;
 } mdeGranular;
 
 /*****************************************************************************/
@@ -290,12 +866,23 @@ typedef struct _mdeGranular
 typedef struct _mdeGranular_tilde {
   t_object x_obj;
   t_symbol *x_arrayname;
+  /* the patch we're in, for finding sound files relative to it */
+  t_canvas *x_canvas;
   mdeGranular x_g;
   /* whether we're recording the incoming signal or not */
   char x_liverunning;
   /* all classes that have a signal in need a float member in case a single
    * float instead of a signal is given (apparently). */
   t_float x_f;
+  /* whether the parameter inlets are signal inlets (third argument) */
+  char x_signals;
+  /* whether all the channels come out of one multichannel outlet (fourth
+   * argument, Pd 0.54 and later) */
+  char x_multi;
+  /* the rightmost outlet, for the stats message */
+  t_outlet *x_info;
+  /* posts the messages from the audio thread (mdeGranularLogFlush) */
+  t_clock *x_logclock;
 } t_mdeGranular_tilde;
 #endif
 
@@ -307,6 +894,16 @@ typedef struct _mdeGranular_tilde {
   mdeGranular x_g;
   /* whether we're recording the incoming signal or not */
   char x_liverunning;
+  /* whether the parameter inlets are signal inlets (third argument) */
+  char x_signals;
+  /* which of those have signals connected (from the dsp64 method) */
+  short x_connected[NUMSIGPARAMS];
+  /* the rightmost outlet, for the stats message */
+  void* x_info;
+  /* posts the messages from the audio thread (mdeGranularLogFlush) */
+  void* x_logqelem;
+  /* sets x_logqelem every LOGPOLLMS whilst our background threads run */
+  void* x_logclock;
 } t_mdeGranular_tilde;
 #endif
 
@@ -319,25 +916,41 @@ void mdeGranularGrainMixIn(mdeGranularGrain* gg, mdeGranular* g,
                            mdefloat* where, int howMany);
 inline mdefloat st2src(mdefloat st, mdefloat octaveSize, 
                        mdefloat octaveDivisions);
-inline long ms2samples(mdefloat samplingRate, mdefloat milliseconds);
-inline mdefloat samples2ms(mdefloat samplingRate, int samples);
+inline mdelong ms2samples(mdefloat samplingRate, mdefloat milliseconds);
+inline mdefloat samples2ms(mdefloat samplingRate, mdelong samples);
 inline mdefloat between(mdefloat min, mdefloat max);
+inline mdefloat mdeGranularHashRandom(uint32_t n);
+inline mdefloat mdeGranularRandom(mdeGranular* g);
+void mdeGranularPlan(mdeGranular* g, long tickSize);
+void mdeGranularInitCacheUpdate(mdeGranular* g);
+int mdeGranularAliasAlloc(mdeGranularAlias* a, int capacity, char warn);
+void mdeGranularAliasFree(mdeGranularAlias* a);
+void mdeGranularAliasBuild(mdeGranularAlias* a, mdefloat* weights,
+                           int nWeights, int n);
+inline int mdeGranularAliasPick(mdeGranularAlias* a, mdefloat r);
+void mdeGranularSetTranspositionWeights(mdeGranular* g, int num,
+                                        mdefloat* list);
+void mdeGranularSetChannelWeights(mdeGranular* g, int num, mdefloat* list);
 inline int flip(void);
 void mdeGranularMdeFree(mdeGranular* g);
 void makeRamps(int rampLen, mdefloat* rampUp, mdefloat* rampDown);
 mdefloat randomlyDeviate(mdefloat number, mdefloat maxDeviation);
 /* MDE Thu Feb 20 11:39:46 2020 -- 'live' arg doesn't seem to be used at all, so
    removing  */
-mdefloat interpolate(mdefloat findex, mdefloat* samples, long numSamples,
-                     char backwards); /* , char live);*/
+mdefloat interpolate(mdelong index, mdefloat fraction, mdefloat* samples,
+                     mdelong numSamples, int stride, char backwards);
+mdefloat interpolateLinear(mdelong index, mdefloat fraction, mdefloat* samples,
+                           mdelong numSamples, int stride, char backwards);
+mdePhase mdeGranularToPhase(double position);
+inline mdelong mdeGranularPhaseIndex(mdelong base, mdePhase phase,
+                                     mdelong numSamples, mdelong mask);
 inline int mdeGranularGrainExhausted(mdeGranularGrain* g);
 inline mdefloat mdeGranularGrainGetRampVal(mdeGranularGrain* gg, 
                                            mdefloat* rampUp, 
                                            mdefloat* rampDown, long rampLen);
-inline void* mdeCalloc(int howmany, size_t size, char* caller, char warn);
+inline void* mdeCalloc(size_t howmany, size_t size, char* caller, char warn);
 inline void mdeFree(void* what);
-inline void silence(mdefloat* where, int numSamples);
-inline int mdeGranularAtTargetGrainAmp(mdeGranular* g);
+inline void silence(mdefloat* where, mdelong numSamples);
 int isanum(char *input);
 mdefloat* makeWindow(char* type, int size, mdefloat beta, mdefloat* window);
 void mdeGranularStoreRampType(mdeGranular* g, char* type);
@@ -349,9 +962,118 @@ inline void mdeGranularForceGrainReinit(mdeGranular* g);
 int mdeGranularInit1(mdeGranular* g, int maxVoices, int numChannels);
 void mdeGranularPrint(mdeGranular* g);
 int mdeGranularInit3(mdeGranular* g, mdefloat* samples, mdefloat samplesMS,
-                     mdefloat numSamples);
+                     mdelong numSamples, int channels);
 inline void mdeGranularCopyInputSamples(mdeGranular* g, mdefloat* in,
                                         long nsamps);
+void mdeGranularSetSourceChannel(mdeGranular* g, char* mode, int channel);
+void mdeGranularSetPanMode(mdeGranular* g, char* mode);
+void mdeGranularSetPanSpread(mdeGranular* g, mdefloat centre, mdefloat width);
+void mdeGranularMakePanTable(void);
+void mdeGranularCopySignals(mdeGranular* g);
+void mdeGranularReadSignals(mdeGranular* g);
+void mdeGranularSignalParam(mdeGranular* g, t_sigparam p, mdefloat v);
+int mdeGranularSignalGrainAmps(mdeGranular* g);
+void mdeGranularSetWindow(mdeGranular* g, mdefloat startMS, mdefloat endMS);
+void mdeGranularSetAmbiSpread(mdeGranular* g, mdefloat azimuth,
+                              mdefloat azimuthWidth, mdefloat elevation,
+                              mdefloat elevationWidth);
+void mdeGranularSetOnsets(mdeGranular* g, mdefloat rate, mdefloat jitter);
+void mdeGranularSetSteal(mdeGranular* g, char* mode);
+void mdeGranularResetPool(mdeGranular* g);
+void mdeGranularOnsets(mdeGranular* g);
+void mdeGranularStartGrain(mdeGranular* g, long offset);
+int mdeGranularStealGrain(mdeGranular* g);
+inline mdefloat mdeGranularGrainEnvelope(mdeGranularGrain* gg,
+                                         mdeGranular* parent);
+void mdeGranularGrainFadeOut(mdeGranularGrain* gg, mdeGranular* parent);
+void mdeGranularSetCPUBudget(mdeGranular* g, mdefloat percent);
+void mdeGranularGovern(mdeGranular* g, double seconds);
+double mdeGranularSeconds(void);
+void mdeGranularSetGrainBudget(mdeGranular* g, mdefloat grainsPerSecond);
+void mdeGranularSetPriority(mdeGranular* g, mdefloat priority);
+void mdeGranularBudgetRefill(void);
+int mdeGranularBudgetTake(mdeGranular* g);
+void mdeGranularGetStats(mdeGranular* g, mdeGranularStats* stats);
+void mdeGranularPublishStats(mdeGranular* g);
+void mdeGranularProfile(mdeGranular* g, char* what);
+int mdeGranularSounding(mdeGranular* g);
+void mdeGranularSetIdleAfter(mdeGranular* g, mdefloat ms);
+int mdeGranularInputIdle(mdeGranular* g, mdefloat* in, long nsamps);
+void mdeGranularWake(mdeGranular* g);
+inline int mdeGranularIsIdle(mdeGranular* g);
+void mdeGranularSphericalHarmonics(int order, mdefloat azimuth,
+                                   mdefloat elevation, mdefloat* coeffs);
+void mdeGranularGrainEncode(mdeGranularGrain* gg, mdeGranular* parent,
+                            const mdefloat* r);
+void mdeGranularGrainPan(mdeGranularGrain* gg, mdeGranular* parent,
+                         const mdefloat* r);
+inline mdefloat* mdeGranularGrainWhere(mdeGranularGrain* gg,
+                                       mdeGranular* parent);
+inline void mdeGranularGrainFlush(mdeGranularGrain* gg, mdeGranular* parent,
+                                  int from, int to);
+void mdeGranularSetLiveShare(mdeGranular* g, char* name);
+void mdeGranularLeaveLiveShare(mdeGranular* g);
+void mdeGranularDetachLiveShare(mdeGranular* g);
+int mdeGranularOpenFile(mdeGranular* g, char* path, int rawChannels,
+                        mdefloat rawRate);
+int mdeGranularReopenFile(mdeGranular* g, char* path);
+void mdeGranularCloseFile(mdeGranular* g);
+void mdeGranularAdviseMapping(mdeGranular* g);
+int mdeGranularMapFile(mdeGranularMapping* m);
+void mdeGranularUnmapFile(mdeGranularMapping* m);
+int mdeGranularStreamFile(mdeGranular* g, char* path, int rawChannels,
+                          mdefloat rawRate);
+void mdeGranularStreamFree(mdeGranularStream* s);
+int mdeGranularStreamLoad(mdeGranularStream* s, mdelong b);
+void mdeGranularStreamReader(void* arg);
+void mdeGranularStreamWant(mdeGranularStream* s, mdelong start, mdelong end);
+int mdeGranularStreamResident(mdeGranularStream* s, mdelong first,
+                              mdelong last);
+int mdeGranularStreamPin(mdeGranularStream* s, mdeGranularGrain* gg,
+                         mdelong first, mdelong last);
+void mdeGranularStreamUnpin(mdeGranularStream* s, mdeGranularGrain* gg);
+void mdeGranularStreamUnpinAll(mdeGranular* g);
+void mdeGranularStreamWindow(mdeGranularStream* s, mdelong* start,
+                             mdelong* end);
+int mdeGranularTraceStart(mdeGranular* g, char* path);
+void mdeGranularTraceStop(mdeGranular* g);
+void mdeGranularTraceFree(mdeGranular* g);
+void mdeGranularTraceWriter(void* arg);
+void mdeGranularTraceGrain(mdeGranular* g, mdeGranularGrain* gg,
+                           t_traceevent type);
+void mdeGranularLog(int error, const char* format, ...);
+void mdeGranularDeferLog(int defer);
+int mdeGranularLogPending(void);
+void mdeGranularLogFlush(void);
+int mdeGranularHasWorkers(mdeGranular* g);
+inline unsigned long mdeGetLE16(const unsigned char* p);
+inline unsigned long mdeGetLE32(const unsigned char* p);
+inline void mdePutLE16(unsigned char* p, unsigned long v);
+inline void mdePutLE32(unsigned char* p, unsigned long v);
+void mdePutLE64(unsigned char* p, unsigned long long v);
+int mdeGranularRecordStart(mdeGranular* g, char* path, char* what);
+int mdeGranularRecordHeader(mdeGranularRecorder* r);
+void mdeGranularRecordStop(mdeGranular* g);
+void mdeGranularRecordFree(mdeGranular* g);
+void mdeGranularRecordFreeRetired(mdeGranular* g);
+void mdeGranularRecorderDelete(mdeGranularRecorder* r);
+void mdeGranularRecordWriter(void* arg);
+void mdeGranularRecordInput(mdeGranular* g, mdefloat* in, long n);
+void mdeGranularRecordPut(mdeGranularRecorder* r, unsigned long head,
+                          const mdefloat* samples, long n);
+void mdeGranularRecordBlock(mdeGranular* g);
+int mdeGranularReadSoundFileInfo(char* path, mdeGranularSoundFile* sf);
+int mdeGranularRawSoundFileInfo(char* path, int channels, mdefloat rate,
+                                mdeGranularSoundFile* sf);
+int mdeGranularSoundFileInfo(char* path, int rawChannels, mdefloat rawRate,
+                             mdeGranularSoundFile* sf);
+inline mdefloat mdeGranularDecodeSample(const unsigned char* src,
+                                        t_sfformat format);
+void mdeGranularDecodeSamples(const unsigned char* src,
+                              mdeGranularSoundFile* sf, mdelong nFrames,
+                              mdefloat* dst);
+inline mdelong mdeGranularGetLiveIndex(mdeGranular* g);
+inline int mdeGranularWantsInput(mdeGranular* g);
 void mdeGranularGo(mdeGranular* g);
 int mdeGranularInit2(mdeGranular* g, long nOutputSamples, mdefloat rampLenMS,
                      mdefloat** channelBuffers);
@@ -369,6 +1091,31 @@ inline void mdeGranularSetDensity(mdeGranular* g, mdefloat f);
 void mdeGranularSetActiveChannels(mdeGranular* g, long l);
 void mdeGranularSetWarnings(mdeGranular* g, long l);
 inline void mdeGranularSetGrainAmp(mdeGranular* g, mdefloat f);
+void mdeGranularSetGrainAmpSmoothing(mdeGranular* g, mdefloat ms,
+                                     char* shape);
+void mdeGranularStatusRamp(mdeGranular* g, long n);
+void mdeGranularStatusTarget(mdeGranular* g, mdefloat target);
+void mdeSmootherJump(mdeSmoother* s, mdefloat value);
+void mdeSmootherSetTarget(mdeSmoother* s, mdefloat target, long samples,
+                          t_smoothshape shape, const mdefloat* table);
+inline int mdeSmootherMoving(mdeSmoother* s);
+int mdeSmootherBlock(mdeSmoother* s, mdefloat* out, long n);
+int mdeGranularSnapshot(mdeGranular* g, int scene, char* what);
+void mdeGranularRecall(mdeGranular* g, int scene);
+void mdeGranularRecallNow(mdeGranular* g);
+void mdeGranularMorph(mdeGranular* g, int a, int b, mdefloat t);
+void mdeGranularMorphNow(mdeGranular* g);
+void mdeGranularScenesFree(mdeGranular* g);
+mdeGranularScene* mdeGranularSceneAcquire(mdeGranular* g, int n, int reader);
+void mdeGranularSceneRelease(mdeGranular* g, int reader);
+void mdeGranularSceneFree(mdeGranularScene* sc);
+void mdeGranularSceneClear(mdeGranularScene* sc);
+void mdeGranularSetLayers(mdeGranular* g, int num);
+int mdeGranularLayerMessage(mdeGranular* g, int layer, char* name, int argc,
+                            mdefloat* argv);
+void mdeGranularLayerSource(mdeGranular* g, mdeGranular* l);
+void mdeGranularLayersGo(mdeGranular* g, long tickSize);
+void mdeGranularLayersFree(mdeGranular* g);
 void mdeGranularSetMaxVoices(mdeGranular* g, mdefloat maxVoices);
 void mdeGranularSetActiveVoices(mdeGranular* g, mdefloat activeVoices);
 void mdeGranularSetRampLenMS(mdeGranular* g, mdefloat rampLenMS);
@@ -389,7 +1136,8 @@ inline int mdeGranularDidInit(mdeGranular* g);
 void mdegranular_tildeUnlockBuffer(t_buffer_ref* buf);
 #endif
 void mdeGranularClearTheSamples(mdeGranular* g);
-long mdeGranularCopyFloatSamples(mdeGranular* g, float* in, long nsamps);
+mdelong mdeGranularCopyFloatSamples(mdeGranular* g, float* in,
+                                    mdelong nframes, int channels);
 void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s);
 
 void mdeGranular_tildeTranspositionOffsetST(t_mdeGranular_tilde* x, mdefloat f);
@@ -401,6 +1149,8 @@ void mdeGranular_tildeDensity(t_mdeGranular_tilde* x, mdefloat f);
 void mdeGranular_tildeActiveChannels(t_mdeGranular_tilde* x, long l);
 void mdeGranular_tildeWarnings(t_mdeGranular_tilde* x, long l);
 void mdeGranular_tildeGrainAmp(t_mdeGranular_tilde* x, mdefloat f);
+void mdeGranular_tildeGrainAmpSmoothing(t_mdeGranular_tilde* x, mdefloat ms,
+                                        t_symbol* s);
 void mdeGranular_tildeMaxVoices(t_mdeGranular_tilde* x, mdefloat f);
 void mdeGranular_tildeActiveVoices(t_mdeGranular_tilde* x, mdefloat f);
 void mdeGranular_tildeRampLenMS(t_mdeGranular_tilde* x, mdefloat f);
@@ -419,6 +1169,60 @@ void mdeGranular_tildePortionPosition(t_mdeGranular_tilde *x,
 void mdeGranular_tildePortionWidth(t_mdeGranular_tilde *x, mdefloat width);
 void mdeGranular_tildeBufferGrainRamp(t_mdeGranular_tilde *x, t_symbol *s,
                                       mdefloat grain_len, mdefloat ramp_len);
+void mdeGranular_tildeLiveShare(t_mdeGranular_tilde *x, t_symbol *s);
+void mdeGranular_tildeSourceChannel(t_mdeGranular_tilde *x, t_symbol *s,
+                                    mdefloat channel);
+void mdeGranular_tildePanMode(t_mdeGranular_tilde *x, t_symbol *s);
+void mdeGranular_tildePanSpread(t_mdeGranular_tilde *x, mdefloat centre,
+                                mdefloat width);
+void mdeGranular_tildeAmbiSpread(t_mdeGranular_tilde *x, mdefloat azimuth,
+                                 mdefloat azimuthWidth, mdefloat elevation,
+                                 mdefloat elevationWidth);
+void mdeGranular_tildeOnsets(t_mdeGranular_tilde *x, mdefloat rate,
+                             mdefloat jitter);
+void mdeGranular_tildeSteal(t_mdeGranular_tilde *x, t_symbol *s);
+void mdeGranular_tildeCPUBudget(t_mdeGranular_tilde *x, mdefloat percent);
+void mdeGranular_tildeIdleAfter(t_mdeGranular_tilde *x, mdefloat ms);
+void mdeGranular_tildeGrainBudget(t_mdeGranular_tilde *x, mdefloat rate);
+void mdeGranular_tildePriority(t_mdeGranular_tilde *x, mdefloat priority);
+void mdeGranular_tildeOpen(t_mdeGranular_tilde *x, t_symbol *s,
+                           mdefloat channels, mdefloat rate);
+void mdeGranular_tildeStream(t_mdeGranular_tilde *x, t_symbol *s,
+                             mdefloat channels, mdefloat rate);
+void mdeGranular_tildeStats(t_mdeGranular_tilde *x);
+void mdeGranular_tildeTrace(t_mdeGranular_tilde *x, t_symbol *s);
+void mdeGranular_tildeRecord(t_mdeGranular_tilde *x, t_symbol *s,
+                             t_symbol *what);
+void mdeGranular_tildeStop(t_mdeGranular_tilde *x);
+void mdeGranular_tildeLogFlush(t_mdeGranular_tilde *x);
+#ifndef PD
+void mdeGranular_tildeLogPoll(t_mdeGranular_tilde *x);
+#endif
+#ifdef PD
+void mdeGranular_tildeTranspositionWeights(t_mdeGranular_tilde *x,
+                                           t_symbol *s, int argc,
+                                           t_atom *argv);
+void mdeGranular_tildeChannelWeights(t_mdeGranular_tilde *x, t_symbol *s,
+                                     int argc, t_atom *argv);
+void mdeGranular_tildeLayer(t_mdeGranular_tilde *x, t_symbol *s, int argc,
+                            t_atom *argv);
+#endif
+#ifdef MAXMSP
+void mdeGranular_tildeTranspositionWeights(t_mdeGranular_tilde *x,
+                                           t_symbol *s, short argc,
+                                           t_atom *argv);
+void mdeGranular_tildeChannelWeights(t_mdeGranular_tilde *x, t_symbol *s,
+                                     short argc, t_atom *argv);
+void mdeGranular_tildeLayer(t_mdeGranular_tilde *x, t_symbol *s, short argc,
+                            t_atom *argv);
+#endif
+void mdeGranular_tildeProfile(t_mdeGranular_tilde *x, t_symbol *s);
+void mdeGranular_tildeSnapshot(t_mdeGranular_tilde *x, mdefloat scene,
+                               t_symbol *s);
+void mdeGranular_tildeRecall(t_mdeGranular_tilde *x, mdefloat scene);
+void mdeGranular_tildeMorph(t_mdeGranular_tilde *x, mdefloat a, mdefloat b,
+                            mdefloat t);
+void mdeGranular_tildeLayers(t_mdeGranular_tilde *x, mdefloat num);
 
 /*****************************************************************************/
 
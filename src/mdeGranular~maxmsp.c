@@ -53,9 +53,13 @@ void* mdeGranular_tildeClass;
 
 /*****************************************************************************/
 
-/** This is called second, after main  */
+/** This is called second, after main. The optional third argument, if
+ *  non-zero, makes the parameter inlets signal inlets (floats can still be
+ *  sent to them), with an extra one at the right for PortionPosition. See
+ *  mdeGranularReadSignals.
+ *  */
 
-void* mdeGranular_tildeNew(long maxVoices, long numChannels)
+void* mdeGranular_tildeNew(long maxVoices, long numChannels, long signals)
 {  
   t_mdeGranular_tilde* x =
     (t_mdeGranular_tilde *)object_alloc(mdeGranular_tildeClass);
@@ -64,7 +68,8 @@ void* mdeGranular_tildeNew(long maxVoices, long numChannels)
 
   if (!maxVoices || !numChannels)
     post("mdeGranular~ warning: this object takes two arguments: number of \
-         voices and number of output channels. The defaults are 10 and 2.");
+         voices and number of output channels. The defaults are 10 and 2. \
+         An optional third non-zero argument gives signal parameter inlets.");
   if (!maxVoices)
     maxVoices = 10;
   if (!numChannels)
@@ -72,17 +77,27 @@ void* mdeGranular_tildeNew(long maxVoices, long numChannels)
 
   /* post("%d %d", (int)maxVoices, (int)numChannels);*/
 
-  dsp_setup((t_pxobject*)x, 1);
-
-  /* couple an inlet to a method: */
-  /* inlets have to be defined in reverse order! */
-  floatin(x, 1); /* grain amplitude */
-  floatin(x, 2); /* density of the grains in % */
-  floatin(x, 3); /* end point in buffer in millisecs */
-  floatin(x, 4); /* start point in buffer in millisecs */
-  floatin(x, 5); /* grain length deviation in percentage of the grain length */
-  floatin(x, 6); /* grain length in milliseconds */
-  floatin(x, 7); /* transposition offset in semitones */ 
+  x->x_signals = signals != 0;
+  x->x_logqelem = qelem_new(x, (method)mdeGranular_tildeLogFlush);
+  x->x_logclock = clock_new(x, (method)mdeGranular_tildeLogPoll);
+  for (i = 0; i < NUMSIGPARAMS; i++)
+    x->x_connected[i] = 0;
+  if (x->x_signals)
+    /* floats sent to these arrive in mdeGranular_tildeFloat */
+    dsp_setup((t_pxobject*)x, 1 + NUMSIGPARAMS);
+  else {
+    dsp_setup((t_pxobject*)x, 1);
+
+    /* couple an inlet to a method: */
+    /* inlets have to be defined in reverse order! */
+    floatin(x, 1); /* grain amplitude */
+    floatin(x, 2); /* density of the grains in % */
+    floatin(x, 3); /* end point in buffer in millisecs */
+    floatin(x, 4); /* start point in buffer in millisecs */
+    floatin(x, 5); /* grain length deviation in % of the grain length */
+    floatin(x, 6); /* grain length in milliseconds */
+    floatin(x, 7); /* transposition offset in semitones */ 
+  }
   /* x->x_arrayname = buffer; */
   /* this ensures that a 1000ms buffer will be allocated when the DSP
    * method is called */  
@@ -92,6 +107,8 @@ void* mdeGranular_tildeNew(long maxVoices, long numChannels)
    * used in init2 once audio is turned on
    */
   mdeGranularInit1(g, (int)maxVoices, (int)numChannels);
+  /* outlets are created right to left so this one's the rightmost */
+  x->x_info = outlet_new((t_object*)x, NULL);
   for (i = 0; i < (int)numChannels; i++)
     outlet_new((t_object*)x, "signal");
   /* MDE Thu Sep 19 10:41:07 2013 -- do this here now as srate is always
@@ -117,34 +134,43 @@ void* mdeGranular_tildeNew(long maxVoices, long numChannels)
 void mdeGranular_tildeAssist(t_mdeGranular_tilde *x, void *box, long message,
                              long arg, char *dstString)
 {
-  if (message == 2)
-    sprintf(dstString, "(signal) granulated output");
+  /* in signal mode the parameter inlets take signals too */
+  char* type = x->x_signals ? "(signal/float)" : "(float)";
+
+  if (message == 2) {
+    if (arg == x->x_g.numChannels)
+      sprintf(dstString, "(messages) stats output");
+    else sprintf(dstString, "(signal) granulated output");
+  }
   else {
     switch (arg) {    
     case 0:
       sprintf(dstString, "(bang/list/message) bang starts granulation...");
       break;
     case 1:
-      sprintf(dstString, "(float) Transposition offset in semitones");
+      sprintf(dstString, "%s Transposition offset in semitones", type);
       break;
     case 2:
-      sprintf(dstString, "(float) Grain length in milliseconds");
+      sprintf(dstString, "%s Grain length in milliseconds", type);
       break;
     case 3:
-      sprintf(dstString, "(float) Grain length deviation in percentage \
-                          of the grain length");
+      sprintf(dstString, "%s Grain length deviation in percentage \
+                          of the grain length", type);
       break;
     case 4:
-      sprintf(dstString, "(float) Start point in buffer in millisecs");
+      sprintf(dstString, "%s Start point in buffer in millisecs", type);
       break;
     case 5:
-      sprintf(dstString, "(float) End point in buffer in millisecs");
+      sprintf(dstString, "%s End point in buffer in millisecs", type);
       break;
     case 6:
-      sprintf(dstString, "(float) Density of the grains in percent");
+      sprintf(dstString, "%s Density of the grains in percent", type);
       break;
     case 7:
-      sprintf(dstString, "(float) Grain amplitude");
+      sprintf(dstString, "%s Grain amplitude", type);
+      break;
+    case 8:
+      sprintf(dstString, "%s Portion position (0-100)", type);
       break;
     }
   }
@@ -152,6 +178,48 @@ void mdeGranular_tildeAssist(t_mdeGranular_tilde *x, void *box, long message,
 
 /*****************************************************************************/
 
+/** In signal mode the parameter inlets are proxies rather than floatins so
+ *  floats sent to them (when no signal is connected) end up here. */
+
+void mdeGranular_tildeFloat(t_mdeGranular_tilde *x, double f)
+{
+  switch (proxy_getinlet((t_object*)x)) {
+  case 1:
+    mdeGranular_tildeTranspositionOffsetST(x, f);
+    break;
+  case 2:
+    mdeGranular_tildeGrainLengthMS(x, f);
+    break;
+  case 3:
+    mdeGranular_tildeGrainLengthDeviation(x, f);
+    break;
+  case 4:
+    mdeGranular_tildeSamplesStartMS(x, f);
+    break;
+  case 5:
+    mdeGranular_tildeSamplesEndMS(x, f);
+    break;
+  case 6:
+    mdeGranular_tildeDensity(x, f);
+    break;
+  case 7:
+    mdeGranular_tildeGrainAmp(x, f);
+    break;
+  case 8:
+    mdeGranular_tildePortionPosition(x, f);
+    break;
+  }
+}
+
+/*****************************************************************************/
+
+void mdeGranular_tildeInt(t_mdeGranular_tilde *x, long n)
+{
+  mdeGranular_tildeFloat(x, (double)n);
+}
+
+/*****************************************************************************/
+
 /** Turns on granulating of the live input. */
 
 void mdeGranular_tildeLivestart(t_mdeGranular_tilde *x)
@@ -189,18 +257,25 @@ void mdeGranular_tildePrint(t_mdeGranular_tilde *x)
 void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
 {
   float* samples;
-  int nsamples;
+  mdelong nsamples;
   t_symbol *ps_buffer = gensym("buffer~");
   mdefloat srate = (mdefloat)sys_getsr();
   mdeGranular* g = &x->x_g;
   int got_ms = strncmp(s->s_name, "ms", 2) == 0;
   t_buffer_ref* bref = buffer_ref_new((t_object*)x, s);
   t_buffer_obj* bobj = buffer_ref_getobject(bref);
-  long copied;
+  mdelong copied;
+  long nchannels;
 
   /* MDE Thu Sep 19 10:39:17 2013 -- in case it's changed, might as well update
    */ 
   g->samplingRate = srate;
+  /* a sound file we've already opened: just pick it up again */
+  if (mdeGranularReopenFile(g, (char*)s->s_name)) {
+    object_free(bref);
+    return;
+  }
+  mdeGranularCloseFile(g);
   strncpy(g->BufferName, s->s_name, sizeof(g->BufferName));
   /* post("%s", g->BufferName); */
   if ((got_ms && isanum((char*)(s->s_name + 2))) || isanum((char*)s->s_name)) {
@@ -211,16 +286,19 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
   else { /* static buffer */
     x->x_arrayname = s;
     if ((bobj = (t_buffer_obj *)(s->s_thing)) && ob_sym(bobj) == ps_buffer) {
-      if ((buffer_getchannelcount(bobj) != 1) && g->warnings) {
-        post("mdeGranular~: Only mono buffers allowed: %s", s->s_name);
-        return;
-      }
+      /* multichannel buffer~s are fine: they stay interleaved and grains
+       * pick a channel (see SourceChannel) */
+      nchannels = buffer_getchannelcount(bobj);
+      /* we copy into our own live buffer so we can't be sharing one */
+      mdeGranularLeaveLiveShare(g);
       nsamples = buffer_getframecount(bobj);
       samples = buffer_locksamples(bobj);
-      copied = mdeGranularCopyFloatSamples(g, samples, nsamples);
+      copied = mdeGranularCopyFloatSamples(g, samples, nsamples,
+                                           (int)nchannels);
       mdegranular_tildeUnlockBuffer(bref);
       if (!samples || mdeGranularInit3(g, g->theSamples,
-                                       samples2ms(srate, nsamples), copied)
+                                       samples2ms(srate, copied), copied,
+                                       (int)nchannels)
           < 0)
         post("mdeGranular~: couldn't init Granular object");
     }
@@ -232,6 +310,53 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
   }
 }
 
+/*****************************************************************************/
+
+/** This gets called when you send the object an open message with the name
+ *  or path of a WAV file to granulate straight from disk. Names are looked
+ *  for in Max's search path. A file of raw 32-bit floats can be opened too
+ *  by following the name with its number of channels and, if it's not ours,
+ *  its sampling rate.
+ *  */
+
+void mdeGranular_tildeOpen(t_mdeGranular_tilde *x, t_symbol *s,
+                           mdefloat channels, mdefloat rate)
+{
+  char filename[MAX_PATH_CHARS];
+  char path[MAX_PATH_CHARS];
+  short vol;
+  t_fourcc type;
+
+  strncpy_zero(filename, s->s_name, MAX_PATH_CHARS);
+  if (locatefile_extended(filename, &vol, &type, NULL, 0) ||
+      path_toabsolutesystempath(vol, filename, path))
+    strncpy_zero(path, s->s_name, MAX_PATH_CHARS);
+  mdeGranularOpenFile(&x->x_g, path, (int)channels, rate);
+}
+
+/*****************************************************************************/
+
+/** The stream message is like open (raw float arguments included) but for
+ *  sound files too big to map: they are read from disk by a background
+ *  thread as the grains need them.
+ *  */
+
+void mdeGranular_tildeStream(t_mdeGranular_tilde *x, t_symbol *s,
+                             mdefloat channels, mdefloat rate)
+{
+  char filename[MAX_PATH_CHARS];
+  char path[MAX_PATH_CHARS];
+  short vol;
+  t_fourcc type;
+
+  strncpy_zero(filename, s->s_name, MAX_PATH_CHARS);
+  if (locatefile_extended(filename, &vol, &type, NULL, 0) ||
+      path_toabsolutesystempath(vol, filename, path))
+    strncpy_zero(path, s->s_name, MAX_PATH_CHARS);
+  mdeGranularStreamFile(&x->x_g, path, (int)channels, rate);
+  clock_delay(x->x_logclock, 0);
+}
+
 /*****************************************************************************/
 void mdegranular_tildeUnlockBuffer(t_buffer_ref* buf)
 {
@@ -243,6 +368,69 @@ void mdegranular_tildeUnlockBuffer(t_buffer_ref* buf)
 
 /*****************************************************************************/
 
+/** trace <file> writes the start and end of every grain to -file- (a full
+ *  path) until trace is sent on its own. See tools/mdeGranularTrace.c for
+ *  turning the file into something readable.
+ *  */
+
+void mdeGranular_tildeTrace(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  if (!s || !*s->s_name)
+    mdeGranularTraceStop(&x->x_g);
+  else mdeGranularTraceStart(&x->x_g, s->s_name);
+  clock_delay(x->x_logclock, 0);
+}
+
+/*****************************************************************************/
+
+/** record <file> [live] writes the outlets (and the live input after them,
+ *  with live) to a 32-bit float WAV (RF64 past 4GB) -file- (a full path)
+ *  until stop, or record on its own.
+ *  */
+
+void mdeGranular_tildeRecord(t_mdeGranular_tilde *x, t_symbol *s,
+                             t_symbol *what)
+{
+  if (!s || !*s->s_name)
+    mdeGranularRecordStop(&x->x_g);
+  else mdeGranularRecordStart(&x->x_g, s->s_name, what->s_name);
+  clock_delay(x->x_logclock, 0);
+}
+
+/*****************************************************************************/
+
+/** Send what's been happening since the last stats message out of the
+ *  rightmost outlet, as several messages for route: grains <started>,
+ *  skips <density> <window> <short> <stream> <governor> <budget> <novoice>,
+ *  sounding <grains>, reads <integer> <interpolated>, ns <min> <mean> <max>
+ *  (the time mdeGranularGo takes, in nanoseconds).
+ *  */
+
+void mdeGranular_tildeStats(t_mdeGranular_tilde *x)
+{
+  mdeGranularStats stats;
+  t_atom av[NUMSKIPS];
+  int i;
+
+  mdeGranularGetStats(&x->x_g, &stats);
+  atom_setlong(av, stats.grainsStarted);
+  outlet_anything(x->x_info, gensym("grains"), 1, av);
+  for (i = 0; i < NUMSKIPS; i++)
+    atom_setlong(av + i, stats.skips[i]);
+  outlet_anything(x->x_info, gensym("skips"), NUMSKIPS, av);
+  atom_setlong(av, mdeGranularSounding(&x->x_g));
+  outlet_anything(x->x_info, gensym("sounding"), 1, av);
+  atom_setlong(av, stats.integerReads);
+  atom_setlong(av + 1, stats.interpolatedReads);
+  outlet_anything(x->x_info, gensym("reads"), 2, av);
+  atom_setfloat(av, stats.minNS);
+  atom_setfloat(av + 1, stats.ticks ? stats.totalNS / stats.ticks : 0.0);
+  atom_setfloat(av + 2, stats.maxNS);
+  outlet_anything(x->x_info, gensym("ns"), 3, av);
+}
+
+/*****************************************************************************/
+
 /** This is called every 64 samples or whatever the tick size is.
  *  */
 
@@ -255,19 +443,27 @@ void mspExternalPerform(t_mdeGranular_tilde* x, t_object* dsp64, double** ins,
   mdeGranular* g = &x->x_g;
   int i;
 
+  /* unconnected signal inlets are left to floats/messages; the rest are
+   * copied before anything's written to outs, which might be the same
+   * memory */
+  for (i = 0; i < NUMSIGPARAMS; ++i)
+    g->sigHost[i] = x->x_signals && x->x_connected[i] 
+      ? (mdefloat*)ins[i + 1] : NULL;
+  mdeGranularCopySignals(g);
   for (i = 0; i < g->numChannels; ++i) {
     g->channelBuffers[i] = (mdefloat*)outs[i];
     /* post("%ld", g->channelBuffers[i]); */        
   }
-  if (g->live && x->x_liverunning && g->status)
+  mdeGranularDeferLog(1);
+  if (x->x_liverunning && mdeGranularWantsInput(g) &&
+      !mdeGranularInputIdle(g, in, sampleframes))
     mdeGranularCopyInputSamples(g, in, sampleframes);
 
-#ifdef DEBUG
-  if (DebugFP)
-    fprintf(DebugFP, "\n\nPerform\n\n");  
-#endif
-
   mdeGranularGo(g);
+  mdeGranularDeferLog(0);
+  /* qelem_set is safe from here: the flush happens on the main thread */
+  if (mdeGranularLogPending())
+    qelem_set(x->x_logqelem);
   /*
     post("toffset %f", x->x_g.transpositionOffsetST);
     post("glen %f", x->x_g.grainLengthMS);
@@ -276,7 +472,7 @@ void mspExternalPerform(t_mdeGranular_tilde* x, t_object* dsp64, double** ins,
     post("end %f", x->x_g.samplesEndMS);
     post("ramplen %f", x->x_g.rampLenMS);
     post("density %f", x->x_g.density);
-    post("gamp %f", x->x_g.grainAmp);
+    post("gamp %f", x->x_g.grainAmp.value);
   */
 }
 
@@ -287,6 +483,12 @@ void mspExternalPerform(t_mdeGranular_tilde* x, t_object* dsp64, double** ins,
 void mdeGranular_tildeDSP(t_mdeGranular_tilde* x, t_object* dsp64, short* count,
                           double samplerate, long vectorsize, long flags)
 {
+  int i;
+
+  for (i = 0; i < NUMSIGPARAMS; ++i)
+    x->x_connected[i] = x->x_signals ? count[i + 1] : 0;
+  /* DSP has stopped to get here, so no tick is using an old recorder */
+  mdeGranularRecordFreeRetired(&x->x_g);
   object_method(dsp64, gensym("dsp_add64"), x, mspExternalPerform, 0, NULL);
 }
 
@@ -298,7 +500,10 @@ void mdeGranular_tildeBang(t_mdeGranular_tilde *x)
 {
   mdeGranular* g = &x->x_g;
 
-  if (mdeGranularIsOn(g))
+  /* idling on a quiet input: wake up rather than switch off */
+  if (mdeGranularIsOn(g) && g->inputIdle)
+    mdeGranularWake(g);
+  else if (mdeGranularIsOn(g))
     mdeGranularOff(g);
   else if (mdeGranularIsOff(g))
     mdeGranularOn(g);
@@ -322,12 +527,102 @@ void mdeGranular_tildeList(t_mdeGranular_tilde *x, t_symbol *s,
 
 /*****************************************************************************/
 
+/** TranspositionWeights and ChannelWeights: lists of relative weights. */
+
+void mdeGranular_tildeTranspositionWeights(t_mdeGranular_tilde *x,
+                                           t_symbol *s, short argc,
+                                           t_atom *argv)
+{
+  static mdefloat weights[MAXTRANSPOSITIONS];
+  int i;
+
+  UNUSED(s);
+  for (i = 0; i < argc && i < MAXTRANSPOSITIONS; ++i)
+    weights[i] = atom_getfloatarg(i, argc, argv);
+  mdeGranularSetTranspositionWeights(&x->x_g, i, weights);
+}
+
+void mdeGranular_tildeChannelWeights(t_mdeGranular_tilde *x, t_symbol *s,
+                                     short argc, t_atom *argv)
+{
+  mdeGranular* g = &x->x_g;
+  mdefloat* weights = mdeCalloc(argc > 0 ? argc : 1, sizeof(mdefloat),
+                                "mdeGranular_tildeChannelWeights",
+                                g->warnings);
+  int i;
+
+  UNUSED(s);
+  if (!weights)
+    return;
+  for (i = 0; i < argc; ++i)
+    weights[i] = atom_getfloatarg(i, argc, argv);
+  mdeGranularSetChannelWeights(g, argc, weights);
+  mdeFree(weights);
+}
+
+/*****************************************************************************/
+
+/** layer <k> <message> <args>: pass a parameter message on to layer -k-. */
+
+void mdeGranular_tildeLayer(t_mdeGranular_tilde *x, t_symbol *s, short argc,
+                            t_atom *argv)
+{
+  static mdefloat args[MAXTRANSPOSITIONS];
+  t_symbol* name;
+  int i;
+
+  UNUSED(s);
+  if (argc < 2) {
+    if (x->x_g.warnings)
+      post("mdeGranular~: layer <layer> <message> <arguments>. Ignoring.");
+    return;
+  }
+  name = atom_getsym(argv + 1);
+  for (i = 2; i < argc && i - 2 < MAXTRANSPOSITIONS; ++i)
+    args[i - 2] = atom_getfloatarg(i, argc, argv);
+  mdeGranularLayerMessage(&x->x_g, (int)atom_getfloatarg(0, argc, argv),
+                          (char*)name->s_name, i - 2, args);
+}
+
+/*****************************************************************************/
+
 void mdeGranular_tildeFree(t_mdeGranular_tilde *x)
 {
   mdeGranular* g = &x->x_g;
 
   mdeGranularFree(g);
   dsp_free((t_pxobject*)x);
+  object_free(x->x_logclock);
+  qelem_free(x->x_logqelem);
+  mdeGranularLogFlush();
+}
+
+/*****************************************************************************/
+
+/** Called via our qelem, on the main thread, when the perform routine has
+ *  left messages to post. The queue is shared, so this posts those of all
+ *  instances. */
+
+void mdeGranular_tildeLogFlush(t_mdeGranular_tilde *x)
+{
+  UNUSED(x);
+  mdeGranularLogFlush();
+}
+
+/*****************************************************************************/
+
+/** Our background threads can queue messages when there's no tick to notice
+ *  them (e.g. with the audio off), so whilst any are running (they're started
+ *  by the stream, trace and record messages, which set this clock going) we
+ *  look every LOGPOLLMS. The clock runs in the scheduler so the flushing is
+ *  still left to the qelem. */
+
+void mdeGranular_tildeLogPoll(t_mdeGranular_tilde *x)
+{
+  if (mdeGranularLogPending())
+    qelem_set(x->x_logqelem);
+  if (mdeGranularHasWorkers(&x->x_g))
+    clock_delay(x->x_logclock, LOGPOLLMS);
 }
 
 /*****************************************************************************/
@@ -341,7 +636,7 @@ int C74_EXPORT main(void)
                          (short)sizeof(t_mdeGranular_tilde),
                          /* 0L, A_DEFFLOAT, A_DEFFLOAT, 0); */
                          /* MDE Fri Feb 21 09:03:38 2020 */
-                         0L, A_DEFLONG, A_DEFLONG, 0);
+                         0L, A_DEFLONG, A_DEFLONG, A_DEFLONG, 0);
   /* to couple an inlet to a method */
   class_addmethod(c, (method)mdeGranular_tildeTranspositionOffsetST, "ft7",
                   A_FLOAT, 0);
@@ -353,9 +648,16 @@ int C74_EXPORT main(void)
   class_addmethod(c, (method)mdeGranular_tildeSamplesEndMS, "ft3", A_FLOAT, 0);
   class_addmethod(c, (method)mdeGranular_tildeDensity, "ft2", A_FLOAT, 0);
   class_addmethod(c, (method)mdeGranular_tildeGrainAmp, "ft1", A_FLOAT, 0);
+  /* signal mode only: see mdeGranular_tildeFloat */
+  class_addmethod(c, (method)mdeGranular_tildeFloat, "float", A_FLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeInt, "int", A_LONG, 0);
   class_addmethod(c, (method)mdeGranular_tildeBang, "bang", 0); /* start/stop */
   class_addmethod(c, (method)mdeGranular_tildeList, "list", 
                   A_GIMME, 0); /* transpositions */
+  class_addmethod(c, (method)mdeGranular_tildeTranspositionWeights,
+                  "TranspositionWeights", A_GIMME, 0);
+  class_addmethod(c, (method)mdeGranular_tildeChannelWeights,
+                  "ChannelWeights", A_GIMME, 0);
   class_addmethod(c, (method)mdeGranular_tildeLivestart, "livestart", 0);
   class_addmethod(c, (method)mdeGranular_tildeLivestop, "livestop", 0);
   class_addmethod(c, (method)mdeGranular_tildePrint, "print", 0);
@@ -383,6 +685,8 @@ int C74_EXPORT main(void)
                   0);
   class_addmethod(c, (method)mdeGranular_tildeGrainAmp, "GrainAmp", A_DEFFLOAT,
                   0);
+  class_addmethod(c, (method)mdeGranular_tildeGrainAmpSmoothing,
+                  "GrainAmpSmoothing", A_DEFFLOAT, A_DEFSYM, 0);
   class_addmethod(c, (method)mdeGranular_tildeActiveChannels, "ActiveChannels", 
                   A_DEFLONG, 0);
   class_addmethod(c, (method)mdeGranular_tildeAssist,"assist", A_CANT,0);
@@ -408,6 +712,46 @@ int C74_EXPORT main(void)
                   A_DEFFLOAT, 0);
   class_addmethod(c, (method)mdeGranular_tildeBufferGrainRamp,
                   "BufferGrainRamp", A_DEFSYM, A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeLiveShare, "liveshare",
+                  A_DEFSYM, 0);
+  class_addmethod(c, (method)mdeGranular_tildeSourceChannel, "SourceChannel",
+                  A_DEFSYM, A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeOnsets, "Onsets", A_DEFFLOAT,
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeSteal, "Steal", A_DEFSYM, 0);
+  class_addmethod(c, (method)mdeGranular_tildeCPUBudget, "CPUBudget",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeIdleAfter, "IdleAfter",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeGrainBudget, "GrainBudget",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildePriority, "Priority",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildePanMode, "PanMode", A_DEFSYM, 0);
+  class_addmethod(c, (method)mdeGranular_tildePanSpread, "PanSpread",
+                  A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeAmbiSpread, "AmbiSpread",
+                  A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeOpen, "open", A_DEFSYM,
+                  A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeStream, "stream", A_DEFSYM,
+                  A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeStats, "stats", 0);
+  class_addmethod(c, (method)mdeGranular_tildeTrace, "trace", A_DEFSYM, 0);
+  class_addmethod(c, (method)mdeGranular_tildeRecord, "record", A_DEFSYM,
+                  A_DEFSYM, 0);
+  class_addmethod(c, (method)mdeGranular_tildeStop, "stop", 0);
+  class_addmethod(c, (method)mdeGranular_tildeProfile, "profile", A_DEFSYM,
+                  0);
+  class_addmethod(c, (method)mdeGranular_tildeSnapshot, "snapshot",
+                  A_DEFFLOAT, A_DEFSYM, 0);
+  class_addmethod(c, (method)mdeGranular_tildeRecall, "recall", A_DEFFLOAT,
+                  0);
+  class_addmethod(c, (method)mdeGranular_tildeMorph, "morph", A_DEFFLOAT,
+                  A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeLayers, "Layers", A_DEFFLOAT,
+                  0);
+  class_addmethod(c, (method)mdeGranular_tildeLayer, "layer", A_GIMME, 0);
   class_dspinit(c);
   class_register(CLASS_BOX, c);
   mdeGranular_tildeClass = c;
@@ -48,17 +48,40 @@
 #ifdef PD
 
 #include "m_pd.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
 
 /*****************************************************************************/
 
 /* PD seems to really need the _ before tilde! */
 static t_class *mdeGranular_tildeClass;
 
+/* Multichannel outlets came with Pd 0.54: rather than linking against
+ * signal_setmultiout (and so not loading at all in anything older) we look
+ * for it when we're set up, and only make a multichannel class if the Pd
+ * we're in has it. Otherwise it's one outlet per channel, whatever the
+ * fourth argument. */
+#ifndef CLASS_MULTICHANNEL
+#define CLASS_MULTICHANNEL 0x10
+#endif
+typedef void (*t_setmultiout)(t_signal **sig, int nchans);
+static t_setmultiout mdeGranular_tildeSetMultiOut = NULL;
+
 /*****************************************************************************/
 
-/** This is called second, after _setup  */
+/** This is called second, after _setup. The optional third argument, if
+ *  non-zero, makes the parameter inlets signal inlets (floats can still be
+ *  sent to them), with an extra one at the right for PortionPosition. See
+ *  mdeGranularReadSignals. The optional fourth, if non-zero, puts all the
+ *  output channels on one multichannel outlet rather than one outlet each
+ *  (Pd 0.54 and later, e.g. for [snake~]).
+ *  */
 
-void *mdeGranular_tildeNew(t_float maxVoices, t_float numChannels)
+void *mdeGranular_tildeNew(t_float maxVoices, t_float numChannels,
+                           t_float signals, t_float multi)
 {
   t_mdeGranular_tilde *x =
     (t_mdeGranular_tilde *)pd_new(mdeGranular_tildeClass);
@@ -67,7 +90,9 @@ void *mdeGranular_tildeNew(t_float maxVoices, t_float numChannels)
 
   if (!maxVoices || !numChannels)
     post("mdeGranular~ warning: this object takes two arguments: number of \
-         \nvoices and number of output channels. The defaults are 10 and 2.");
+         \nvoices and number of output channels. The defaults are 10 and 2. \
+         \nAn optional third non-zero argument gives signal parameter inlets, \
+         \na fourth one multichannel outlet for all the channels.");
   if (!maxVoices)
     maxVoices = 10.0;
   if (!numChannels)
@@ -75,12 +100,29 @@ void *mdeGranular_tildeNew(t_float maxVoices, t_float numChannels)
   
   g->samplingRate = sys_getsr(); 
   x->x_arrayname = gensym("ms1000");
+  x->x_canvas = canvas_getcurrent();
   x->x_f = 0;
   x->x_liverunning = 1;
+  x->x_signals = signals != 0;
+  x->x_multi = multi != 0 && mdeGranular_tildeSetMultiOut;
+  if (multi != 0 && !x->x_multi)
+    post("mdeGranular~ warning: this Pd has no multichannel support (0.54 \
+         \nor later): using one outlet per channel.");
+  x->x_logclock = clock_new(x, (t_method)mdeGranular_tildeLogFlush);
   mdeGranularInit1(g, maxVoices, numChannels);
-  for (i = 0; i < (int)numChannels; i++)
+  if (x->x_multi)
     outlet_new(&x->x_obj, gensym("signal"));
-
+  else for (i = 0; i < (int)numChannels; i++)
+    outlet_new(&x->x_obj, gensym("signal"));
+  x->x_info = outlet_new(&x->x_obj, 0);
+
+  if (x->x_signals) {
+    /* the floats these start off with must match g->sigLast (i.e. 0) so
+     * that nothing changes until a signal or float arrives */
+    for (i = 0; i < NUMSIGPARAMS; i++)
+      signalinlet_new(&x->x_obj, 0);
+    return (x);
+  }
   /* couple an inlet to a method:
    * class_addmethod must also be called in setup below
    * */
@@ -140,6 +182,7 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
 {
   t_garray *a;
   mdefloat* samples;
+  /* garray_getfloatwords wants an int: pd arrays can't be any longer */
   int nsamples;
   mdefloat srate = (mdefloat)sys_getsr();
   int got_ms = strncmp(s->s_name, "ms", 2) == 0;
@@ -148,6 +191,10 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
   /* MDE Thu Sep 19 10:39:17 2013 -- in case it's changed, might as well update
    */ 
   g->samplingRate = srate;
+  /* a sound file we've already opened: just pick it up again */
+  if (mdeGranularReopenFile(g, (char*)s->s_name))
+    return;
+  mdeGranularCloseFile(g);
   /* 18.6.20: avoid unnecessary gcc warnings: strncpy is OK here */
 #ifndef MACOSX
 #pragma GCC diagnostic push
@@ -162,7 +209,7 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
     mdeGranular_tildeSetF(x, bufsize);
     if (mdeGranularInit3(&x->x_g, NULL, bufsize,
                          ms2samples((mdefloat)sys_getsr(),
-                                    bufsize))
+                                    bufsize), 1)
         < 0)
 
       pd_error(x, "mdeGranular~: couldn't init Granular object");
@@ -186,7 +233,7 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
     }
     else {                 /* success!! */
       if (mdeGranularInit3(&x->x_g, samples, samples2ms(srate, nsamples),
-                           (mdefloat)nsamples)
+                           (mdelong)nsamples, 1)
           < 0)
         pd_error(x, "mdeGranular~: couldn't init Granular object");
       garray_usedindsp(a);
@@ -196,6 +243,117 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
 
 /*****************************************************************************/
 
+/** This gets called when you send the object an open message with the path
+ *  of a WAV file to granulate straight from disk. Relative paths are taken
+ *  to be relative to the patch. A file of raw 32-bit floats can be opened
+ *  too by following the path with its number of channels and, if it's not
+ *  ours, its sampling rate.
+ *  */
+
+void mdeGranular_tildeOpen(t_mdeGranular_tilde *x, t_symbol *s,
+                           mdefloat channels, mdefloat rate)
+{
+  char path[MAXPDSTRING];
+
+  canvas_makefilename(x->x_canvas, (char*)s->s_name, path, MAXPDSTRING);
+  /* remember it so that mdeGranular_tildeDSP picks it up again */
+  if (!mdeGranularOpenFile(&x->x_g, path, (int)channels, rate))
+    x->x_arrayname = gensym(path);
+}
+
+/*****************************************************************************/
+
+/** The stream message is like open (raw float arguments included) but for
+ *  sound files too big to map: they are read from disk by a background
+ *  thread as the grains need them.
+ *  */
+
+void mdeGranular_tildeStream(t_mdeGranular_tilde *x, t_symbol *s,
+                             mdefloat channels, mdefloat rate)
+{
+  char path[MAXPDSTRING];
+
+  canvas_makefilename(x->x_canvas, (char*)s->s_name, path, MAXPDSTRING);
+  if (!mdeGranularStreamFile(&x->x_g, path, (int)channels, rate))
+    x->x_arrayname = gensym(path);
+  clock_delay(x->x_logclock, 0);
+}
+
+/*****************************************************************************/
+
+/** trace <file> writes the start and end of every grain to -file- (relative
+ *  to the patch) until trace is sent on its own. See tools/mdeGranularTrace.c
+ *  for turning the file into something readable.
+ *  */
+
+void mdeGranular_tildeTrace(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  char path[MAXPDSTRING];
+
+  if (!s || !*s->s_name) {
+    mdeGranularTraceStop(&x->x_g);
+    return;
+  }
+  canvas_makefilename(x->x_canvas, (char*)s->s_name, path, MAXPDSTRING);
+  mdeGranularTraceStart(&x->x_g, path);
+  clock_delay(x->x_logclock, 0);
+}
+
+/*****************************************************************************/
+
+/** record <file> [live] writes the outlets (and the live input after them,
+ *  with live) to a 32-bit float WAV (RF64 past 4GB) -file- (relative to the
+ *  patch) until stop, or record on its own.
+ *  */
+
+void mdeGranular_tildeRecord(t_mdeGranular_tilde *x, t_symbol *s,
+                             t_symbol *what)
+{
+  char path[MAXPDSTRING];
+
+  if (!s || !*s->s_name) {
+    mdeGranularRecordStop(&x->x_g);
+    return;
+  }
+  canvas_makefilename(x->x_canvas, (char*)s->s_name, path, MAXPDSTRING);
+  mdeGranularRecordStart(&x->x_g, path, (char*)what->s_name);
+  clock_delay(x->x_logclock, 0);
+}
+
+/*****************************************************************************/
+
+/** Send what's been happening since the last stats message out of the
+ *  rightmost outlet, as several messages for [route]: grains <started>,
+ *  skips <density> <window> <short> <stream> <governor> <budget> <novoice>,
+ *  sounding <grains>, reads <integer> <interpolated>, ns <min> <mean> <max>
+ *  (the time mdeGranularGo takes, in nanoseconds).
+ *  */
+
+void mdeGranular_tildeStats(t_mdeGranular_tilde *x)
+{
+  mdeGranularStats stats;
+  t_atom av[NUMSKIPS];
+  int i;
+
+  mdeGranularGetStats(&x->x_g, &stats);
+  SETFLOAT(av, (t_float)stats.grainsStarted);
+  outlet_anything(x->x_info, gensym("grains"), 1, av);
+  for (i = 0; i < NUMSKIPS; i++)
+    SETFLOAT(av + i, (t_float)stats.skips[i]);
+  outlet_anything(x->x_info, gensym("skips"), NUMSKIPS, av);
+  SETFLOAT(av, (t_float)mdeGranularSounding(&x->x_g));
+  outlet_anything(x->x_info, gensym("sounding"), 1, av);
+  SETFLOAT(av, (t_float)stats.integerReads);
+  SETFLOAT(av + 1, (t_float)stats.interpolatedReads);
+  outlet_anything(x->x_info, gensym("reads"), 2, av);
+  SETFLOAT(av, (t_float)stats.minNS);
+  SETFLOAT(av + 1, (t_float)(stats.ticks ? stats.totalNS / stats.ticks : 0.0));
+  SETFLOAT(av + 2, (t_float)stats.maxNS);
+  outlet_anything(x->x_info, gensym("ns"), 3, av);
+}
+
+/*****************************************************************************/
+
 /** This is called every 64 samples or whatever the tick size is. */
 
 t_int *mdeGranular_tildePerform(t_int *w)
@@ -205,15 +363,17 @@ t_int *mdeGranular_tildePerform(t_int *w)
   long nsamps = (long)(w[3]);
   mdeGranular* g = &x->x_g;
 
-  if (g->live && x->x_liverunning && g->status)
+  mdeGranularDeferLog(1);
+  mdeGranularCopySignals(g);
+  if (x->x_liverunning && mdeGranularWantsInput(g) &&
+      !mdeGranularInputIdle(g, in, nsamps))
     mdeGranularCopyInputSamples(g, in, nsamps);
 
-#ifdef DEBUG
-  if (DebugFP)
-    fprintf(DebugFP, "\n\nPerform\n\n");  
-#endif
-
   mdeGranularGo(g);
+  mdeGranularDeferLog(0);
+  /* post whatever came up once the tick's done */
+  if (mdeGranularLogPending())
+    clock_delay(x->x_logclock, 0);
   /*
     post("toffset %f", x->x_g.transpositionOffsetST);
     post("glen %f", x->x_g.grainLengthMS);
@@ -222,7 +382,7 @@ t_int *mdeGranular_tildePerform(t_int *w)
     post("end %f", x->x_g.samplesEndMS);
     post("ramplen %f", x->x_g.rampLenMS);
     post("density %f", x->x_g.density);
-    post("gamp %f", x->x_g.grainAmp);
+    post("gamp %f", x->x_g.grainAmp.value);
   */
   return w + 4;
 }
@@ -237,13 +397,32 @@ void mdeGranular_tildeDSP(t_mdeGranular_tilde *x, t_signal **sp)
   /* numChannels has already been set in mdeGranularInit1! */
   mdeGranular* g = &x->x_g;
   int nchan = g->numChannels;
+  int nsig = x->x_signals ? NUMSIGPARAMS : 0;
+  t_signal** out;
   mdefloat** chbufs = mdeCalloc(nchan, sizeof(mdefloat*), 
                                 "mdeGranular_tildeDSP", g->warnings);
 
-  for (i = 0; i < nchan; ++i)
-    /* sp[0] is the input of course, so the first output is sp[1] */
-    chbufs[i] = sp[i + 1]->s_vec;
+  /* the parameter signal inlets (if any) come straight after the input */
+  for (i = 0; i < NUMSIGPARAMS; ++i)
+    g->sigHost[i] = i < nsig ? sp[i + 1]->s_vec : NULL;
+  /* sp[0] is the input of course, so the first output is sp[1] (after any
+   * signal inlets) */
+  out = sp + 1 + nsig;
+  /* as a multichannel class we make our own outputs: one with all the
+   * channels, one after the other, or one for each */
+  if (x->x_multi) {
+    mdeGranular_tildeSetMultiOut(out, nchan);
+    for (i = 0; i < nchan; ++i)
+      chbufs[i] = out[0]->s_vec + i * out[0]->s_n;
+  }
+  else for (i = 0; i < nchan; ++i) {
+    if (mdeGranular_tildeSetMultiOut)
+      mdeGranular_tildeSetMultiOut(out + i, 1);
+    chbufs[i] = out[i]->s_vec;
+  }
   mdeGranularInit2(g, sp[0]->s_n, (mdefloat)DEFAULT_RAMP_LEN, chbufs);
+  /* DSP has stopped to get here, so no tick is using an old recorder */
+  mdeGranularRecordFreeRetired(g);
   mdeGranular_tildeSet(x, x->x_arrayname);
   /* the second arg specifies how many elements of the w array arg to the
    * perform routine we can access and the remaining args are the objects that
@@ -260,7 +439,10 @@ void mdeGranular_tildeBang(t_mdeGranular_tilde *x)
 {
   mdeGranular* g = &x->x_g;
 
-  if (mdeGranularIsOn(g))
+  /* idling on a quiet input: wake up rather than switch off */
+  if (mdeGranularIsOn(g) && g->inputIdle)
+    mdeGranularWake(g);
+  else if (mdeGranularIsOn(g))
     mdeGranularOff(g);
   else if (mdeGranularIsOff(g))
     mdeGranularOn(g);
@@ -284,9 +466,86 @@ void mdeGranular_tildeList(t_mdeGranular_tilde *x, t_symbol *s,
 
 /*****************************************************************************/
 
+/** TranspositionWeights and ChannelWeights: lists of relative weights. */
+
+void mdeGranular_tildeTranspositionWeights(t_mdeGranular_tilde *x,
+                                           t_symbol *s, int argc,
+                                           t_atom *argv)
+{
+  static mdefloat weights[MAXTRANSPOSITIONS];
+  int i;
+
+  UNUSED(s);
+  for (i = 0; i < argc && i < MAXTRANSPOSITIONS; ++i)
+    weights[i] = atom_getfloatarg(i, argc, argv);
+  mdeGranularSetTranspositionWeights(&x->x_g, i, weights);
+}
+
+void mdeGranular_tildeChannelWeights(t_mdeGranular_tilde *x, t_symbol *s,
+                                     int argc, t_atom *argv)
+{
+  mdeGranular* g = &x->x_g;
+  mdefloat* weights = mdeCalloc(argc > 0 ? argc : 1, sizeof(mdefloat),
+                                "mdeGranular_tildeChannelWeights",
+                                g->warnings);
+  int i;
+
+  UNUSED(s);
+  if (!weights)
+    return;
+  for (i = 0; i < argc; ++i)
+    weights[i] = atom_getfloatarg(i, argc, argv);
+  mdeGranularSetChannelWeights(g, argc, weights);
+  mdeFree(weights);
+}
+
+/*****************************************************************************/
+
+/** layer <k> <message> <args>: pass a parameter message on to layer -k-. */
+
+void mdeGranular_tildeLayer(t_mdeGranular_tilde *x, t_symbol *s, int argc,
+                            t_atom *argv)
+{
+  static mdefloat args[MAXTRANSPOSITIONS];
+  t_symbol* name;
+  int i;
+
+  UNUSED(s);
+  if (argc < 2) {
+    if (x->x_g.warnings)
+      post("mdeGranular~: layer <layer> <message> <arguments>. Ignoring.");
+    return;
+  }
+  name = atom_getsymbolarg(1, argc, argv);
+  for (i = 2; i < argc && i - 2 < MAXTRANSPOSITIONS; ++i)
+    args[i - 2] = atom_getfloatarg(i, argc, argv);
+  mdeGranularLayerMessage(&x->x_g, (int)atom_getfloatarg(0, argc, argv),
+                          (char*)name->s_name, i - 2, args);
+}
+
+/*****************************************************************************/
+
 void mdeGranular_tildeFree(t_mdeGranular_tilde *x)
 {
   mdeGranularFree(&x->x_g);
+  clock_free(x->x_logclock);
+  mdeGranularLogFlush();
+}
+
+/*****************************************************************************/
+
+/** Called by our clock, on the main thread, when the perform routine has
+ *  left messages to post. The queue is shared, so this posts those of all
+ *  instances. Our background threads can queue messages when there's no
+ *  tick to notice them (e.g. with the audio off), so whilst any are running
+ *  (they're started by the stream, trace and record messages, which set the
+ *  clock going) we keep looking every LOGPOLLMS. */
+
+void mdeGranular_tildeLogFlush(t_mdeGranular_tilde *x)
+{
+  mdeGranularLogFlush();
+  if (mdeGranularHasWorkers(&x->x_g))
+    clock_delay(x->x_logclock, LOGPOLLMS);
 }
 
 /*****************************************************************************/
@@ -295,12 +554,28 @@ void mdeGranular_tildeFree(t_mdeGranular_tilde *x)
 
 void mdeGranular_tilde_setup(void)
 {
+  int major;
+  int minor;
+  int bugfix;
+
+  /* see mdeGranular_tildeSetMultiOut */
+  sys_getversion(&major, &minor, &bugfix);
+  if (major > 0 || minor >= 54) {
+#ifdef _WIN32
+    mdeGranular_tildeSetMultiOut = (t_setmultiout)(void*)
+      GetProcAddress(GetModuleHandleA("pd.dll"), "signal_setmultiout");
+#else
+    mdeGranular_tildeSetMultiOut = (t_setmultiout)
+      dlsym(dlopen(NULL, RTLD_NOW), "signal_setmultiout");
+#endif
+  }
   mdeGranular_tildeClass = 
     class_new(gensym("mdeGranular~"),
               (t_newmethod)mdeGranular_tildeNew, 
               (t_method)mdeGranular_tildeFree,
-              sizeof(t_mdeGranular_tilde), 0,
-              A_DEFFLOAT, A_DEFFLOAT, 0);
+              sizeof(t_mdeGranular_tilde),
+              mdeGranular_tildeSetMultiOut ? CLASS_MULTICHANNEL : 0,
+              A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, 0);
   CLASS_MAINSIGNALIN(mdeGranular_tildeClass, t_mdeGranular_tilde, x_f);
   class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeDSP,
                   gensym("dsp"), 0);
@@ -348,6 +623,9 @@ void mdeGranular_tilde_setup(void)
                   gensym("Density"), A_DEFFLOAT, 0);
   class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeGrainAmp,
                   gensym("GrainAmp"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeGrainAmpSmoothing,
+                  gensym("GrainAmpSmoothing"), A_DEFFLOAT, A_DEFSYM, 0);
   class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeOn,
                   gensym("on"), 0);
   class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeOff,
@@ -383,7 +661,67 @@ void mdeGranular_tilde_setup(void)
                   (t_method)mdeGranular_tildeBufferGrainRamp,
                   gensym("BufferGrainRamp"),
                   A_DEFSYM, A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeLiveShare,
+                  gensym("liveshare"), A_DEFSYM, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeSourceChannel,
+                  gensym("SourceChannel"), A_DEFSYM, A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeOnsets,
+                  gensym("Onsets"), A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeSteal,
+                  gensym("Steal"), A_DEFSYM, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeCPUBudget,
+                  gensym("CPUBudget"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeIdleAfter,
+                  gensym("IdleAfter"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeGrainBudget,
+                  gensym("GrainBudget"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildePriority,
+                  gensym("Priority"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildePanMode,
+                  gensym("PanMode"), A_DEFSYM, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildePanSpread,
+                  gensym("PanSpread"), A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeAmbiSpread,
+                  gensym("AmbiSpread"), A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT,
+                  A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeOpen,
+                  gensym("open"), A_DEFSYM, A_DEFFLOAT, A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeStats,
+                  gensym("stats"), 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeTrace,
+                  gensym("trace"), A_DEFSYM, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeRecord,
+                  gensym("record"), A_DEFSYM, A_DEFSYM, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeStop,
+                  gensym("stop"), 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeProfile,
+                  gensym("profile"), A_DEFSYM, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeSnapshot,
+                  gensym("snapshot"), A_FLOAT, A_DEFSYM, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeRecall,
+                  gensym("recall"), A_FLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeMorph,
+                  gensym("morph"), A_FLOAT, A_FLOAT, A_FLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeLayers,
+                  gensym("Layers"), A_FLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeLayer,
+                  gensym("layer"), A_GIMME, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeStream,
+                  gensym("stream"), A_DEFSYM, A_DEFFLOAT, A_DEFFLOAT, 0);
   class_addlist(mdeGranular_tildeClass, mdeGranular_tildeList);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeTranspositionWeights,
+                  gensym("TranspositionWeights"), A_GIMME, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeChannelWeights,
+                  gensym("ChannelWeights"), A_GIMME, 0);
   class_addbang(mdeGranular_tildeClass, mdeGranular_tildeBang);
   mdeGranularWelcome();
 }
@@ -0,0 +1,350 @@
+/******************************************************************************
+ *
+ * File:             mdeGranularBigCheck.c
+ *
+ * Author:           Michael Edwards - m@michael-edwards.org -
+ *                   http://www.michael-edwards.org
+ *
+ * Date:             October 18th 2026
+ *
+ * $$ Last modified:  11:24:40 Sun Oct 18 2026 CEST
+ *
+ * Purpose:          Check that mdeGranular~ really can granulate sources
+ *                   longer than 2^31 and 2^32 frames: phase indexing, sound
+ *                   file headers, seeking, mapping and streaming.
+ *
+ * License:          Copyright (c) 2026 Michael Edwards
+ *
+ *                   This file is part of mdeGranular~
+ *
+ *                   mdeGranular~ is free software; you can redistribute it
+ *                   and/or modify it under the terms of the GNU General
+ *                   Public License as published by the Free Software
+ *                   Foundation; either version 2 of the License, or (at your
+ *                   option) any later version.
+ *
+ *                   mdeGranular~ is distributed in the hope that it will be
+ *                   useful, but WITHOUT ANY WARRANTY; without even the
+ *                   implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *                   PARTICULAR PURPOSE.  See the GNU General Public License
+ *                   for more details.
+ *
+ *                   You should have received a copy of the <a
+ *                   href="../../COPYING.TXT">GNU General Public License</a>
+ *                   along with mdeGranular~; if not, write to the Free
+ *                   Software Foundation, Inc., 59 Temple Place, Suite 330,
+ *                   Boston, MA 02111-1307 USA
+ *
+ *****************************************************************************/
+
+/* Build (64-bit, with Pd's m_pd.h, which the engine's header wants) with e.g.
+ *
+ * cc -DPD -I../src -I<pd>/src -O2 -o mdeGranularBigCheck \
+ *    mdeGranularBigCheck.c ../src/mdeGranular~.c -lm -lpthread
+ *
+ * Usage: mdeGranularBigCheck [<scratch file>]
+ *
+ * First the phase arithmetic is checked on its own, then a float32 WAV of
+ * just over 2^32 frames (16GB, but sparse: only the few seconds we write
+ * take up any disk) is made in <scratch file> (default
+ * mdeGranularBigCheck.wav, deleted afterwards). It's silent apart from a
+ * second of 0.5 centred on frame 2^31 + 2^20 and another on 2^32 + 2^19, so
+ * grains only make a sound if they read from exactly there: any position
+ * truncated to 32 bits lands in the silence. Its header gives the data size
+ * as 0xFFFFFFFF, as big WAVs do. Both marks are then granulated from the
+ * open (mapped) file and the streamed one, along with silent windows just
+ * before them, and then again through a window narrow enough to fit inside
+ * one of the stream's cache blocks. The exit status is the number of failed
+ * checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <unistd.h>
+#include "mdeGranular~.h"
+
+/*****************************************************************************/
+
+#define SR 44100
+#define TICK 64
+#define CHANS 2
+/* the file: 2^32 + 2^20 frames, with the two marks */
+#define FRAMES (4294967296LL + 1048576LL)
+#define MARKFRAMES SR
+/* a quarter second in, the middle of a 200ms window that's well inside both
+ * the mark and the stream's cache block starting at it (the marks are on
+ * block boundaries) */
+#define NARROWOFFSET (SR / 4)
+#define NARROWMS 200.0
+static const mdelong Marks[2] = { 2147483648LL + 1048576LL,
+                                  4294967296LL + 524288LL };
+
+static mdefloat Out[CHANS][TICK];
+static int Failures = 0;
+
+/*****************************************************************************/
+
+/* What the engine needs from Pd */
+
+void post(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf("\n");
+}
+
+void pd_error(const void *object, const char *fmt, ...)
+{
+  va_list ap;
+
+  (void)object;
+  va_start(ap, fmt);
+  printf("error: ");
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf("\n");
+}
+
+t_float sys_getsr(void)
+{
+  return SR;
+}
+
+void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  (void)x;
+  (void)s;
+}
+
+/*****************************************************************************/
+
+static void check(int ok, const char* what, ...)
+{
+  va_list ap;
+
+  printf("%s: ", ok ? "ok  " : "FAIL");
+  va_start(ap, what);
+  vprintf(what, ap);
+  va_end(ap);
+  printf("\n");
+  if (!ok)
+    ++Failures;
+}
+
+/*****************************************************************************/
+
+/* mdeGranularPhaseIndex against floor(position) wrapped into the buffer, for
+ * a thousand steps from either side of 2^31 and 2^32, forwards and
+ * backwards, in buffers that are and aren't a power of two long. The
+ * increments are binary fractions so the doubles here are exact. */
+
+static void checkPhases(void)
+{
+  const double starts[] = { 2147483645.25, 4294967293.5, 12884901888.0 - 2.75,
+                            1.5 };
+  const double incs[] = { 1.0, 1.5, 0.25, -1.25, 7.0 };
+  const mdelong sizes[] = { 8589934592LL, 8589934592LL + 77 };
+  mdelong base, index, expected, n;
+  mdePhase phase, inc;
+  double position;
+  int s, i, z, k, bad;
+
+  for (z = 0; z < 2; ++z) {
+    n = sizes[z];
+    for (s = 0; s < 4; ++s)
+      for (i = 0; i < 5; ++i) {
+        base = (mdelong)floor(starts[s]);
+        phase = mdeGranularToPhase(starts[s] - (double)base);
+        inc = mdeGranularToPhase(incs[i]);
+        for (k = 0, bad = 0; k < 1000 && !bad; ++k) {
+          position = starts[s] + incs[i] * k;
+          expected = (mdelong)fmod(floor(position), (double)n);
+          if (expected < 0)
+            expected += n;
+          index = mdeGranularPhaseIndex(base, phase + inc * k, n,
+                                        z ? -1 : n - 1);
+          bad = index != expected;
+        }
+        check(!bad, "phase from %.2f by %.2f in %lld frames%s", starts[s],
+              incs[i], (long long)n, bad ? " (wrong index)" : "");
+      }
+  }
+}
+
+/*****************************************************************************/
+
+static void putLE32(FILE* fp, unsigned long v)
+{
+  fputc((int)(v & 0xff), fp);
+  fputc((int)((v >> 8) & 0xff), fp);
+  fputc((int)((v >> 16) & 0xff), fp);
+  fputc((int)((v >> 24) & 0xff), fp);
+}
+
+static void putLE16(FILE* fp, unsigned v)
+{
+  fputc((int)(v & 0xff), fp);
+  fputc((int)((v >> 8) & 0xff), fp);
+}
+
+/* The sparse file: header, the two marks, and the last frame so that it's
+ * the full length. */
+
+static int makeFile(const char* path)
+{
+  FILE* fp = fopen(path, "wb");
+  float* mark = malloc(MARKFRAMES * sizeof(float));
+  float zero = 0.0f;
+  long i;
+  int m;
+  int ok = fp && mark;
+
+  if (ok) {
+    for (i = 0; i < MARKFRAMES; ++i)
+      mark[i] = 0.5f;
+    fwrite("RIFF", 1, 4, fp);
+    putLE32(fp, 0xFFFFFFFFUL);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    putLE32(fp, 16);
+    putLE16(fp, 3);
+    putLE16(fp, 1);
+    putLE32(fp, SR);
+    putLE32(fp, SR * 4);
+    putLE16(fp, 4);
+    putLE16(fp, 32);
+    fwrite("data", 1, 4, fp);
+    putLE32(fp, 0xFFFFFFFFUL);
+    for (m = 0; m < 2 && ok; ++m)
+      ok = !fseeko(fp, (off_t)(44 + (Marks[m] - MARKFRAMES / 2) * 4),
+                   SEEK_SET) &&
+        fwrite(mark, sizeof(float), MARKFRAMES, fp) == MARKFRAMES;
+    ok = ok && !fseeko(fp, (off_t)(44 + (FRAMES - 1) * 4), SEEK_SET) &&
+      fwrite(&zero, sizeof(float), 1, fp) == 1;
+  }
+  if (fp && fclose(fp))
+    ok = 0;
+  free(mark);
+  return ok;
+}
+
+/*****************************************************************************/
+
+static void start(mdeGranular* g)
+{
+  mdefloat* bufs[CHANS];
+  int i;
+
+  for (i = 0; i < CHANS; ++i)
+    bufs[i] = Out[i];
+  memset(g, 0, sizeof(mdeGranular));
+  g->samplingRate = SR;
+  mdeGranularInit1(g, 20, CHANS);
+  mdeGranularInit2(g, TICK, 10, bufs);
+}
+
+/* Granulate -width- ms centred on -centre- (without transposition, so every
+ * grain stays inside it) for about a second and return the sum of the
+ * absolute output. When streaming, give the reader a second (in 10ms naps)
+ * to get there first. */
+
+static double granulate(mdeGranular* g, mdelong centre, double width)
+{
+  double ms = (double)centre * 1000.0 / SR;
+  double sum = 0.0;
+  int t, i, c;
+
+  mdeGranularSetWindow(g, (mdefloat)(ms - width / 2.0),
+                       (mdefloat)(ms + width / 2.0));
+  mdeGranularSetGrainLengthMS(g, 50);
+  mdeGranularOn(g);
+  for (t = 0; t < 800; ++t) {
+    mdeGranularGo(g);
+    for (c = 0; c < CHANS; ++c)
+      for (i = 0; i < TICK; ++i)
+        sum += fabs(Out[c][i]);
+    if (g->stream && t < 100)
+      usleep(10000);
+  }
+  mdeGranularOff(g);
+  for (t = 0; t < 20; ++t)
+    mdeGranularGo(g);
+  return sum;
+}
+
+/*****************************************************************************/
+
+/* Each window gets a new instance, so that no grain from the last one is
+ * still playing. The middle 600ms of each mark (and the second before it)
+ * spans two cache blocks; the narrow window is in just the one. */
+
+static void checkFile(const char* path)
+{
+  static t_mdeGranular_tilde x;
+  mdeGranular* g = &x.x_g;
+  mdeGranularSoundFile sf;
+  const char* how[2] = { "open", "stream" };
+  int m, s, quiet, narrow, err;
+  double sum;
+
+  err = mdeGranularReadSoundFileInfo((char*)path, &sf);
+  check(!err && sf.nFrames == FRAMES, "header: %lld frames (%lld expected)",
+        (long long)sf.nFrames, (long long)FRAMES);
+  if (err)
+    return;
+  for (s = 0; s < 2; ++s)
+    for (m = 0; m < 2; ++m)
+      for (quiet = 1; quiet >= 0; --quiet)
+        for (narrow = 0; narrow < 2; ++narrow) {
+          start(g);
+          err = s ? mdeGranularStreamFile(g, (char*)path, 0, 0)
+            : mdeGranularOpenFile(g, (char*)path, 0, 0);
+          if (err || g->nBufferSamples != FRAMES)
+            check(0, "%s: %lld frames", how[s], (long long)g->nBufferSamples);
+          else if (quiet) {
+            sum = narrow ? granulate(g, Marks[m] - SR + NARROWOFFSET, NARROWMS)
+              : granulate(g, Marks[m] - SR, 600.0);
+            check(sum == 0.0, "%s: grains%s a second before frame %lld are "
+                  "silent (%f)", how[s], narrow ? " in a narrow window" : "",
+                  (long long)Marks[m], sum);
+          }
+          else {
+            sum = narrow ? granulate(g, Marks[m] + NARROWOFFSET, NARROWMS)
+              : granulate(g, Marks[m], 600.0);
+            check(sum > 1.0, "%s: grains%s around frame %lld sound (%f)",
+                  how[s], narrow ? " in a narrow window" : "",
+                  (long long)Marks[m], sum);
+          }
+          mdeGranularFree(g);
+        }
+}
+
+/*****************************************************************************/
+
+int main(int argc, char** argv)
+{
+  const char* path = argc > 1 ? argv[1] : "mdeGranularBigCheck.wav";
+
+  if (sizeof(mdelong) < 8 || sizeof(void*) < 8) {
+    printf("mdeGranularBigCheck: needs a 64-bit build\n");
+    return 1;
+  }
+  checkPhases();
+  if (!makeFile(path)) {
+    printf("mdeGranularBigCheck: can't write %s\n", path);
+    remove(path);
+    return 1;
+  }
+  checkFile(path);
+  mdeGranularLogFlush();
+  remove(path);
+  printf("%d failed\n", Failures);
+  return Failures;
+}
+
+/* EOF mdeGranularBigCheck.c */
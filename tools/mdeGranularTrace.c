@@ -0,0 +1,160 @@
+/******************************************************************************
+ *
+ * File:             mdeGranularTrace.c
+ *
+ * Author:           Michael Edwards - m@michael-edwards.org - 
+ *                   http://www.michael-edwards.org
+ *
+ * Date:             October 18th 2026
+ *
+ * $$ Last modified:  10:12:41 Sun Oct 18 2026 CEST
+ *
+ * Purpose:          Convert the binary grain traces written by mdeGranular~'s
+ *                   trace message into CSV or Chrome trace (JSON) format.
+ *
+ * License:          Copyright (c) 2026 Michael Edwards
+ *
+ *                   This file is part of mdeGranular~
+ *
+ *                   mdeGranular~ is free software; you can redistribute it
+ *                   and/or modify it under the terms of the GNU General
+ *                   Public License as published by the Free Software
+ *                   Foundation; either version 2 of the License, or (at your
+ *                   option) any later version.
+ *
+ *                   mdeGranular~ is distributed in the hope that it will be
+ *                   useful, but WITHOUT ANY WARRANTY; without even the
+ *                   implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *                   PARTICULAR PURPOSE.  See the GNU General Public License
+ *                   for more details.
+ *
+ *                   You should have received a copy of the <a
+ *                   href="../../COPYING.TXT">GNU General Public License</a>
+ *                   along with mdeGranular~; if not, write to the Free
+ *                   Software Foundation, Inc., 59 Temple Place, Suite 330,
+ *                   Boston, MA 02111-1307 USA
+ *
+ *****************************************************************************/
+
+/* Build with e.g. cc -O2 -o mdeGranularTrace mdeGranularTrace.c
+ *
+ * Usage: mdeGranularTrace csv|chrome <trace file> [<output file>]
+ *
+ * csv gives one line per grain event; chrome gives a JSON file that can be
+ * opened in chrome://tracing or https://ui.perfetto.dev, with a row for each
+ * voice (the object's first, then each layer's) and a bar for each grain
+ * (skipped grains are called "skip").
+ * Without an output file we write to stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*****************************************************************************/
+
+/* These must be the same as in mdeGranular~.c */
+
+typedef struct _mdeGranularTraceHeader
+{
+  char magic[8];
+  int32_t version;
+  int32_t eventSize;
+  double samplingRate;
+} mdeGranularTraceHeader;
+
+typedef struct _mdeGranularTraceEvent
+{
+  uint64_t sample;
+  double start;
+  double end;
+  double inc;
+  int32_t type;
+  int32_t voice;
+  int32_t channel;
+  int32_t srcChannel;
+  int32_t length;
+  int32_t status;
+  int32_t layer;
+  int32_t unused;
+} mdeGranularTraceEvent;
+
+/* t_traceevent and the t_status values we'll see, from mdeGranular~.h */
+#define TRACE_INIT 0
+#define TRACE_END 1
+#define STATUS_ON 1
+
+/*****************************************************************************/
+
+int main(int argc, char** argv)
+{
+  mdeGranularTraceHeader header;
+  mdeGranularTraceEvent e;
+  FILE* in;
+  FILE* out = stdout;
+  int chrome;
+  int first = 1;
+  double usPerSample;
+
+  if (argc < 3 || (strcmp(argv[1], "csv") && strcmp(argv[1], "chrome"))) {
+    fprintf(stderr, "usage: %s csv|chrome <trace file> [<output file>]\n",
+            argv[0]);
+    return 1;
+  }
+  chrome = !strcmp(argv[1], "chrome");
+  in = fopen(argv[2], "rb");
+  if (!in) {
+    fprintf(stderr, "%s: can't open %s\n", argv[0], argv[2]);
+    return 1;
+  }
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, "MDETRACE", 8) || header.version != 2 ||
+      header.eventSize != (int32_t)sizeof(mdeGranularTraceEvent)) {
+    fprintf(stderr, "%s: %s isn't an mdeGranular~ trace (version 2)\n",
+            argv[0], argv[2]);
+    return 1;
+  }
+  if (argc > 3 && !(out = fopen(argv[3], "w"))) {
+    fprintf(stderr, "%s: can't write %s\n", argv[0], argv[3]);
+    return 1;
+  }
+  usPerSample = header.samplingRate > 0.0 ? 1e6 / header.samplingRate : 0.0;
+  if (chrome)
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  else fprintf(out, "event,sample,seconds,layer,voice,channel,srcChannel,"
+               "length,start,end,inc,status\n");
+  while (fread(&e, sizeof(e), 1, in) == 1) {
+    if (chrome) {
+      /* a begin/end pair on the voice's row for each grain, the object's
+       * voices and each layer's in their own group */
+      fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,"
+              "\"pid\":%d,\"tid\":%d", first ? "" : ",\n",
+              e.status == STATUS_ON ? "grain" : "skip",
+              e.type == TRACE_INIT ? "B" : "E",
+              (double)e.sample * usPerSample, e.layer + 1, e.voice);
+      if (e.type == TRACE_INIT)
+        fprintf(out, ",\"args\":{\"channel\":%d,\"srcChannel\":%d,"
+                "\"length\":%d,\"start\":%.3f,\"end\":%.3f,\"inc\":%f}",
+                e.channel, e.srcChannel, e.length, e.start, e.end, e.inc);
+      fprintf(out, "}");
+    }
+    else fprintf(out, "%s,%llu,%.6f,%d,%d,%d,%d,%d,%.3f,%.3f,%f,%s\n",
+                 e.type == TRACE_INIT ? "init" : "end",
+                 (unsigned long long)e.sample,
+                 (double)e.sample * usPerSample * 1e-6, e.layer, e.voice,
+                 e.channel, e.srcChannel, e.length, e.start, e.end, e.inc,
+                 e.status == STATUS_ON ? "on" : "skip");
+    first = 0;
+  }
+  if (chrome)
+    fprintf(out, "\n]}\n");
+  fclose(in);
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
+
+/*****************************************************************************/
+
+/* EOF mdeGranularTrace.c */